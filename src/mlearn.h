@@ -13,18 +13,24 @@
 #include "mlearn/clustering/kmeans.h"
 
 #include "mlearn/criterion/criterion.h"
+#include "mlearn/criterion/gridsearch.h"
 
 #include "mlearn/cuda/device.h"
 
+#include "mlearn/data/batchiterator.h"
 #include "mlearn/data/csviterator.h"
+#include "mlearn/data/dataloader.h"
 #include "mlearn/data/dataset.h"
 #include "mlearn/data/genomeiterator.h"
 #include "mlearn/data/imageiterator.h"
+#include "mlearn/data/kfold.h"
+#include "mlearn/data/packediterator.h"
 
 #include "mlearn/feature/ica.h"
 #include "mlearn/feature/lda.h"
 #include "mlearn/feature/pca.h"
 
+#include "mlearn/layer/modelfile.h"
 #include "mlearn/layer/pipeline.h"
 
 #include "mlearn/math/matrix.h"
@@ -34,6 +40,7 @@
 #include "mlearn/preprocessing/scaler.h"
 
 #include "mlearn/util/logger.h"
+#include "mlearn/util/threadpool.h"
 #include "mlearn/util/timer.h"
 
 #endif
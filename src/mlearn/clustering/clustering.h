@@ -22,6 +22,9 @@ public:
 
 	float score(const Matrix& X, const std::vector<int>& y) const;
 
+	virtual void fit_init(const Matrix& X, const ClusteringLayer *prev) = 0;
+	virtual bool fit_step(const Matrix& X, int num_iter) = 0;
+
 	virtual int num_clusters() const = 0;
 	virtual float aic() const = 0;
 	virtual float bic() const = 0;
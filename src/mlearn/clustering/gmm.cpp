@@ -3,10 +3,16 @@
  *
  * Implementation of Gaussian mixture models.
  */
+#include <algorithm>
+#include <cfloat>
 #include <cmath>
 #include <stdexcept>
 #include "mlearn/clustering/gmm.h"
+#include "mlearn/cuda/device.h"
+#include "mlearn/data/batchiterator.h"
 #include "mlearn/math/matrix_utils.h"
+#include "mlearn/math/random.h"
+#include "mlearn/util/error.h"
 #include "mlearn/util/logger.h"
 #include "mlearn/util/timer.h"
 
@@ -19,7 +25,7 @@ IODevice& operator<<(IODevice& file, const GMMLayer::Component& component)
 	file << component.pi;
 	file << component.mu;
 	file << component.sigma;
-	file << component._sigma_inv;
+	file << component._L;
 	file << component._normalizer;
 	return file;
 }
@@ -31,7 +37,7 @@ IODevice& operator>>(IODevice& file, GMMLayer::Component& component)
 	file >> component.pi;
 	file >> component.mu;
 	file >> component.sigma;
-	file >> component._sigma_inv;
+	file >> component._L;
 	file >> component._normalizer;
 	return file;
 }
@@ -41,16 +47,48 @@ IODevice& operator>>(IODevice& file, GMMLayer::Component& component)
 /**
  * Construct a GMM layer.
  *
+ * The regularization reg_covar is added to each variance,
+ * so that a component which collapses onto a few identical
+ * points keeps a positive definite covariance and a bounded
+ * likelihood. The decay and prepare interval are only used by
+ * online EM (partial_fit).
+ *
  * @param K
+ * @param n_init
+ * @param covariance_type
+ * @param reg_covar
+ * @param decay
+ * @param prepare_interval
  */
-GMMLayer::GMMLayer(int K):
-	_K(K)
+GMMLayer::GMMLayer(int K, int n_init, GMMCovariance covariance_type, float reg_covar, float decay, int prepare_interval):
+	_K(K),
+	_n_init(n_init),
+	_covariance_type(covariance_type),
+	_reg_covar(reg_covar),
+	_decay(decay),
+	_prepare_interval(prepare_interval)
 {
+	CHECK_ERROR(n_init >= 1, "Number of initializations must be at least 1");
+	CHECK_ERROR(reg_covar >= 0, "Covariance regularization must be non-negative");
+	CHECK_ERROR(prepare_interval >= 1, "Prepare interval must be at least 1");
 }
 
 
 
-void GMMLayer::Component::initialize(float pi, const Matrix& mu)
+/**
+ * Initialize a component with a given mixture proportion
+ * and mean, and with unit covariance.
+ *
+ * The shape of sigma depends on the covariance type:
+ * a D x D matrix for full and tied covariance, a D x 1
+ * vector of variances for diagonal covariance, and a
+ * single variance for spherical covariance.
+ *
+ * @param pi
+ * @param mu
+ * @param covariance_type
+ */
+void GMMLayer::Component::initialize(float pi, const Matrix& mu, GMMCovariance covariance_type)
 {
 	const int D = mu.rows();
 
@@ -59,26 +97,76 @@ void GMMLayer::Component::initialize(float pi, const Matrix& mu)
 	this->mu = mu;
 
 	// use identity covariance- assume dimensions are independent
-	this->sigma = Matrix::identity(D);
+	if ( covariance_type == GMMCovariance::full || covariance_type == GMMCovariance::tied )
+	{
+		this->sigma = Matrix::identity(D);
+	}
+	else if ( covariance_type == GMMCovariance::diag )
+	{
+		this->sigma = Matrix::ones(D, 1);
+	}
+	else if ( covariance_type == GMMCovariance::spherical )
+	{
+		this->sigma = Matrix::ones(1, 1);
+	}
 
 	// initialize zero artifacts
-	_sigma_inv = Matrix::zeros(D, D);
+	_L = Matrix::zeros(this->sigma.rows(), this->sigma.cols());
 	_normalizer = 0;
 }
 
 
 
-void GMMLayer::Component::prepare()
+/**
+ * Pre-compute the Cholesky factor L of sigma and the normalizer
+ * of the multivariate normal distribution. For diagonal and
+ * spherical covariance, L holds the standard deviations.
+ *
+ * @param covariance_type
+ */
+void GMMLayer::Component::prepare(GMMCovariance covariance_type)
 {
 	const int D = mu.rows();
 
-	// compute inverse of sigma
-	_sigma_inv = sigma.inverse();
+	// compute log(det(S)) = 2 * sum(log(diag(L)))
+	float log_det = 0;
 
-	// compute normalizer for multivariate normal distribution
-	float det = sigma.determinant();
+	if ( covariance_type == GMMCovariance::full || covariance_type == GMMCovariance::tied )
+	{
+		// compute Cholesky factor of sigma
+		_L = sigma.cholesky();
+
+		for ( int i = 0; i < D; i++ )
+		{
+			log_det += log(_L.elem(i, i));
+		}
+	}
+	else
+	{
+		// compute standard deviations from variances
+		_L = sigma;
+
+		for ( int i = 0; i < _L.rows(); i++ )
+		{
+			CHECK_ERROR(_L.elem(i) > 0, "Variance is not positive");
+
+			_L.elem(i) = sqrtf(_L.elem(i));
+			log_det += log(_L.elem(i));
+		}
+
+		_L.gpu_write();
+
+		// spherical covariance shares one variance across all dimensions
+		if ( covariance_type == GMMCovariance::spherical )
+		{
+			log_det *= D;
+		}
+	}
 
-	_normalizer = -0.5f * (D * log(2.0f * M_PI) + log(det));
+	log_det *= 2;
+
+	// compute normalizer for multivariate normal distribution
+	_normalizer = -0.5f * (D * log(2.0f * M_PI) + log_det);
 }
 
 
@@ -90,33 +178,81 @@ void GMMLayer::Component::prepare()
  *
  *   P(x|k) = exp(-0.5 * (x - mu)^T S^-1 (x - mu)) / sqrt((2pi)^D det(S))
  *
+ * The Mahalanobis distance of every data point is computed at
+ * once with a triangular solve against the Cholesky factor of S:
+ *
+ *   Z = L^-1 * (X - mu)
+ *   (x_i - mu)^T S^-1 (x_i - mu) = ||z_i||^2
+ *
+ * For diagonal and spherical covariance, L is diagonal and the
+ * solve reduces to scaling each row of X - mu.
+ *
  * @param X
  * @param logP
  * @param k
+ * @param covariance_type
  */
-void GMMLayer::Component::compute_log_prob(const Matrix& X, Matrix& logP, int k) const
+void GMMLayer::Component::compute_log_prob(const Matrix& X, Matrix& logP, int k, GMMCovariance covariance_type) const
 {
+	const int D = X.rows();
 	const int N = X.cols();
 
+	// compute Z = L^-1 * (X - mu)
+	Matrix Z = X;
+	Z.subtract_columns(mu);
+
+	if ( covariance_type == GMMCovariance::full || covariance_type == GMMCovariance::tied )
+	{
+		Z.trsm(1.0f, _L);
+	}
+	else if ( covariance_type == GMMCovariance::diag )
+	{
+		for ( int i = 0; i < N; i++ )
+		{
+			for ( int j = 0; j < D; j++ )
+			{
+				Z.elem(j, i) /= _L.elem(j);
+			}
+		}
+	}
+	else if ( covariance_type == GMMCovariance::spherical )
+	{
+		Z /= _L.elem(0);
+	}
+
 	for ( int i = 0; i < N; i++ )
 	{
-		// compute xm = (x_i - mu)
-		Matrix xm = X(i);
-		xm -= mu;
+		// compute ||z_i||^2
+		float dist = 0;
 
-		// compute log(P(x_i|k)) = normalizer - 0.5 * xm^T * S^-1 * xm
-		logP.elem(k, i) = _normalizer - 0.5f * xm.dot(_sigma_inv * xm);
+		for ( int j = 0; j < D; j++ )
+		{
+			float z_ij = Z.elem(j, i);
+			dist += z_ij * z_ij;
+		}
+
+		// compute log(P(x_i|k)) = normalizer - 0.5 * ||z_i||^2
+		logP.elem(k, i) = _normalizer - 0.5f * dist;
 	}
 }
 
 
 
-void GMMLayer::kmeans(const Matrix& X)
+/**
+ * Refine the means of K components with Lloyd's algorithm,
+ * starting from their current means. A cluster which is
+ * assigned no samples keeps its mean.
+ *
+ * @param X
+ * @param components
+ */
+void GMMLayer::kmeans(const Matrix& X, std::vector<Component>& components) const
 {
+	const int D = X.rows();
 	const int N = X.cols();
 	const int MAX_ITERATIONS = 20;
 	const float TOLERANCE = 1e-3;
-	float diff = 0;
+	float diff = FLT_MAX;
 
 	std::vector<Matrix> MP(_K);
 	std::vector<int> counts(_K);
@@ -125,7 +261,7 @@ void GMMLayer::kmeans(const Matrix& X)
 	{
 		for ( int k = 0; k < _K; k++ )
 		{
-			MP[k].init_zeros();
+			MP[k] = Matrix::zeros(D, 1);
 		}
 
 		counts.assign(counts.size(), 0);
@@ -137,7 +273,7 @@ void GMMLayer::kmeans(const Matrix& X)
 
 			for ( int k = 0; k < _K; k++ )
 			{
-				float dist = m_dist_L2(X, i, _components[k].mu, 0);
+				float dist = m_dist_L2(X, i, components[k].mu, 0);
 				if ( min_dist > dist )
 				{
 					min_dist = dist;
@@ -151,26 +287,33 @@ void GMMLayer::kmeans(const Matrix& X)
 
 		for ( int k = 0; k < _K; k++ )
 		{
-			MP[k] /= counts[k];
+			if ( counts[k] > 0 )
+			{
+				MP[k] /= counts[k];
+			}
+			else
+			{
+				MP[k] = components[k].mu;
+			}
 		}
 
 		diff = 0;
 		for ( int k = 0; k < _K; k++ )
 		{
-			diff += m_dist_L2(MP[k], 0, _components[k].mu, 0);
+			diff += m_dist_L2(MP[k], 0, components[k].mu, 0);
 		}
 		diff /= _K;
 
 		for ( int k = 0; k < _K; k++ )
 		{
-			_components[k].mu = MP[k];
+			components[k].mu = MP[k];
 		}
 	}
 }
 
 
 
-float GMMLayer::e_step(const Matrix& X, Matrix& gamma) const
+float GMMLayer::e_step(const Matrix& X, const std::vector<Component>& components, Matrix& gamma) const
 {
 	const int N = X.cols();
 
@@ -179,7 +322,7 @@ float GMMLayer::e_step(const Matrix& X, Matrix& gamma) const
 
 	for ( int k = 0; k < _K; k++ )
 	{
-		logpi.elem(k) = log(_components[k].pi);
+		logpi.elem(k) = log(components[k].pi);
 	}
 
 	// compute log-probability for each point in X and each cluster
@@ -187,7 +330,7 @@ float GMMLayer::e_step(const Matrix& X, Matrix& gamma) const
 
 	for ( int k = 0; k < _K; k++ )
 	{
-		_components[k].compute_log_prob(X, logP, k);
+		components[k].compute_log_prob(X, logP, k, _covariance_type);
 	}
 
 	// compute loggamma and log-likelihood
@@ -229,52 +372,151 @@ float GMMLayer::e_step(const Matrix& X, Matrix& gamma) const
 
 
 
-void GMMLayer::m_step(const Matrix& X, const Matrix& gamma)
+/**
+ * Update the parameters of each component from the
+ * responsibilities gamma:
+ *
+ *   n_k = sum(gamma_ki, i=1:N)
+ *   mu_k = X * gamma_k' / n_k
+ *   S_k = W_k * W_k' / n_k + reg_covar * I,  W_k = (X - mu_k) * diag(sqrt(gamma_k))
+ *
+ * The means of all components are computed with a single GEMM
+ * and each full covariance is computed with a single syrk. Tied
+ * covariance is the weighted average of the full covariances,
+ * while diagonal and spherical covariance only accumulate the
+ * variances. The components are updated in parallel on the CPU.
+ *
+ * @param X
+ * @param gamma
+ * @param components
+ */
+void GMMLayer::m_step(const Matrix& X, const Matrix& gamma, std::vector<Component>& components) const
 {
+	const int D = X.rows();
 	const int N = X.cols();
 
-	for ( int k = 0; k < _K; k++ )
-	{
-		// compute n_k = sum(gamma_ki)
-		float n_k = 0;
+	// compute n_k = sum(gamma_ki)
+	std::vector<float> n(_K, 0.0f);
 
-		for ( int i = 0; i < N; i++ )
+	for ( int i = 0; i < N; i++ )
+	{
+		for ( int k = 0; k < _K; k++ )
 		{
-			n_k += gamma.elem(k, i);
+			n[k] += gamma.elem(k, i);
 		}
+	}
+
+	// compute unnormalized means M = X * gamma'
+	Matrix M = X * gamma.T();
 
+	#pragma omp parallel for if(!Device::instance())
+	for ( int k = 0; k < _K; k++ )
+	{
 		// update pi
-		_components[k].pi = n_k / N;
+		components[k].pi = n[k] / N;
 
 		// update mu
-		Matrix& mu = _components[k].mu;
-		mu.init_zeros();
+		Matrix& mu = components[k].mu;
+		mu = M(k);
+		mu /= n[k];
 
-		for ( int i = 0; i < N; i++ )
+		// update sigma
+		Matrix& sigma = components[k].sigma;
+
+		if ( _covariance_type == GMMCovariance::full || _covariance_type == GMMCovariance::tied )
 		{
-			mu.axpy(gamma.elem(k, i), X(i));
-		}
+			// compute W = (X - mu) * diag(sqrt(gamma_k))
+			Matrix W(D, N);
 
-		mu /= n_k;
+			for ( int i = 0; i < N; i++ )
+			{
+				float w_i = sqrtf(gamma.elem(k, i));
 
-		// update sigma
-		Matrix& sigma = _components[k].sigma;
-		sigma.init_zeros();
+				for ( int j = 0; j < D; j++ )
+				{
+					W.elem(j, i) = (X.elem(j, i) - mu.elem(j)) * w_i;
+				}
+			}
 
-		for ( int i = 0; i < N; i++ )
+			W.gpu_write();
+
+			// compute sigma = W * W' / n_k
+			sigma.syrk(false, 1.0f / n[k], W, 0.0f);
+
+			// copy the upper triangle of sigma into the lower triangle
+			for ( int j = 1; j < D; j++ )
+			{
+				for ( int i = 0; i < j; i++ )
+				{
+					sigma.elem(j, i) = sigma.elem(i, j);
+				}
+			}
+
+			// regularize the diagonal of sigma
+			for ( int j = 0; j < D; j++ )
+			{
+				sigma.elem(j, j) += _reg_covar;
+			}
+		}
+		else
 		{
-			// compute xm = (x - mu)
-			Matrix xm = X(i);
-			xm -= mu;
+			// compute var_j = sum(gamma_ki * (x_ji - mu_j)^2) / n_k
+			std::vector<float> var(D, 0.0f);
+
+			for ( int i = 0; i < N; i++ )
+			{
+				float g_i = gamma.elem(k, i);
 
-			// compute S_i = gamma_ki * (x - mu) (x - mu)^T
-			sigma.gemm(gamma.elem(k, i), xm, xm.T(), 1.0f);
+				for ( int j = 0; j < D; j++ )
+				{
+					float diff = X.elem(j, i) - mu.elem(j);
+					var[j] += g_i * diff * diff;
+				}
+			}
+
+			if ( _covariance_type == GMMCovariance::diag )
+			{
+				for ( int j = 0; j < D; j++ )
+				{
+					sigma.elem(j) = var[j] / n[k] + _reg_covar;
+				}
+			}
+			else if ( _covariance_type == GMMCovariance::spherical )
+			{
+				float sum = 0;
+
+				for ( int j = 0; j < D; j++ )
+				{
+					sum += var[j];
+				}
+
+				sigma.elem(0) = sum / (n[k] * D) + _reg_covar;
+			}
+		}
+
+		sigma.gpu_write();
+	}
+
+	// compute tied covariance S = sum(n_k * S_k) / N
+	if ( _covariance_type == GMMCovariance::tied )
+	{
+		Matrix sigma = Matrix::zeros(D, D);
+
+		for ( int k = 0; k < _K; k++ )
+		{
+			sigma.axpy(n[k] / N, components[k].sigma);
 		}
 
-		sigma /= n_k;
+		for ( int k = 0; k < _K; k++ )
+		{
+			components[k].sigma = sigma;
+		}
+	}
 
-		// pre-compute precision matrix and normalizer
-		_components[k].prepare();
+	// pre-compute Cholesky factor and normalizer
+	for ( int k = 0; k < _K; k++ )
+	{
+		components[k].prepare(_covariance_type);
 	}
 }
 
@@ -323,69 +565,711 @@ float GMMLayer::compute_entropy(const Matrix& gamma, const std::vector<int>& lab
 
 
 /**
- * Fit a Gaussian mixture model to a dataset.
+ * Compute the number of free parameters of a GMM, which
+ * consists of the mixture proportions, the means, and the
+ * covariance parameters for the given covariance type.
  *
- * @param X
+ * @param D
  */
-void GMMLayer::fit(const Matrix& X)
+int GMMLayer::compute_num_parameters(int D) const
 {
-	Timer::push("Gaussian mixture model");
+	int cov_params = 0;
+
+	if ( _covariance_type == GMMCovariance::full )
+	{
+		cov_params = _K * D * (D + 1) / 2;
+	}
+	else if ( _covariance_type == GMMCovariance::diag )
+	{
+		cov_params = _K * D;
+	}
+	else if ( _covariance_type == GMMCovariance::spherical )
+	{
+		cov_params = _K;
+	}
+	else if ( _covariance_type == GMMCovariance::tied )
+	{
+		cov_params = D * (D + 1) / 2;
+	}
+
+	return (_K - 1) + _K * D + cov_params;
+}
+
 
+
+/**
+ * Initialize K components with uniform mixture proportions,
+ * identity covariance and means sampled randomly from X.
+ *
+ * @param X
+ * @param rng
+ * @param components
+ */
+void GMMLayer::init_components(const Matrix& X, std::default_random_engine& rng, std::vector<Component>& components) const
+{
 	int N = X.cols();
-	int D = X.rows();
 
-	// initialize components
-	_components.resize(_K);
+	std::uniform_int_distribution<int> U(0, N - 1);
+
+	components.clear();
+	components.resize(_K);
 
 	for ( int k = 0; k < _K; k++ )
 	{
 		// use uniform mixture proportion and randomly sampled mean
-		int i = rand() % N;
+		int i = U(rng);
 
-		_components[k].initialize(1.0f / _K, X(i));
-		_components[k].prepare();
+		components[k].initialize(1.0f / _K, X(i), _covariance_type);
+		components[k].prepare(_covariance_type);
 	}
 
 	// initialize means with k-means
-	kmeans(X);
+	kmeans(X, components);
+}
+
+
+
+/**
+ * Run at most num_iter iterations of the EM algorithm.
+ *
+ * L holds the log-likelihood of the previous E step, so
+ * that EM can be resumed where a previous call left off;
+ * it should be -inf for a new model. Returns true if the
+ * log-likelihood converged.
+ *
+ * @param X
+ * @param num_iter
+ * @param components
+ * @param L
+ * @param entropy
+ */
+bool GMMLayer::em(const Matrix& X, int num_iter, std::vector<Component>& components, float& L, float& entropy) const
+{
+	const float TOLERANCE = 1e-8;
+	bool converged = false;
 
 	// initialize workspace
-	Matrix gamma(_K, N);
+	Matrix gamma(_K, X.cols());
+
+	for ( int t = 0; t < num_iter; t++ )
+	{
+		// E step
+		float L_prev = L;
+		L = e_step(X, components, gamma);
 
-	// run EM algorithm
+		// treat a degenerate model as a failure
+		CHECK_ERROR(!std::isnan(L), "log-likelihood is undefined");
+
+		// check for convergence
+		if ( fabs(L - L_prev) < TOLERANCE )
+		{
+			Logger::log(LogLevel::Debug, "converged after %d iterations", t + 1);
+			converged = true;
+			break;
+		}
+
+		// M step
+		m_step(X, gamma, components);
+	}
+
+	entropy = compute_entropy(gamma, compute_labels(gamma));
+
+	return converged;
+}
+
+
+
+/**
+ * Run a single randomly-initialized trial of the EM algorithm.
+ *
+ * Each trial uses its own random engine and its own
+ * workspace, so that several trials can run concurrently.
+ * The log-likelihood of the final model is returned, or
+ * -inf if the trial failed.
+ *
+ * @param X
+ * @param rng
+ * @param components
+ * @param entropy
+ */
+float GMMLayer::fit_restart(const Matrix& X, std::default_random_engine& rng, std::vector<Component>& components, float& entropy) const
+{
 	const int MAX_ITERATIONS = 100;
-	const float TOLERANCE = 1e-8;
-	float L_prev = -INFINITY;
-	float L = -INFINITY;
 
 	try
 	{
-		for ( int t = 0; t < MAX_ITERATIONS; t++ )
+		float L = -INFINITY;
+
+		init_components(X, rng, components);
+		em(X, MAX_ITERATIONS, components, L, entropy);
+
+		return L;
+	}
+	catch ( std::runtime_error& e )
+	{
+		entropy = 0;
+
+		return -INFINITY;
+	}
+}
+
+
+
+/**
+ * Fit a Gaussian mixture model to a dataset.
+ *
+ * The model is fit n_init times from different random
+ * initializations, and the trial with the highest
+ * log-likelihood is kept. Trials are run in parallel
+ * on the CPU.
+ *
+ * @param X
+ */
+void GMMLayer::fit(const Matrix& X)
+{
+	Timer::push("Gaussian mixture model");
+
+	int N = X.cols();
+	int D = X.rows();
+
+	// create an independent random engine for each trial
+	std::vector<std::default_random_engine> rngs;
+	rngs.reserve(_n_init);
+
+	for ( int r = 0; r < _n_init; r++ )
+	{
+		rngs.push_back(Random::fork());
+	}
+
+	// run each trial
+	std::vector<std::vector<Component>> components(_n_init);
+	std::vector<float> entropies(_n_init);
+	std::vector<float> likelihoods(_n_init);
+
+	#pragma omp parallel for schedule(dynamic) if(!Device::instance())
+	for ( int r = 0; r < _n_init; r++ )
+	{
+		likelihoods[r] = fit_restart(X, rngs[r], components[r], entropies[r]);
+	}
+
+	// select the trial with the highest log-likelihood
+	int best = 0;
+
+	for ( int r = 0; r < _n_init; r++ )
+	{
+		Logger::log(LogLevel::Debug, "restart %d: %g", r + 1, likelihoods[r]);
+
+		if ( likelihoods[r] > likelihoods[best] )
 		{
-			// E step
-			L_prev = L;
-			L = e_step(X, gamma);
+			best = r;
+		}
+	}
+
+	// save outputs
+	_components = std::move(components[best]);
+	_log_likelihood = likelihoods[best];
+	_num_parameters = compute_num_parameters(D);
+	_num_samples = N;
+	_entropy = entropies[best];
+
+	// reset online EM state
+	_num_steps = 0;
+	_s0.clear();
+	_s1.clear();
+	_s2.clear();
+
+	Timer::pop();
+}
+
+
+
+/**
+ * Initialize a GMM for staged fitting.
+ *
+ * If prev is a fitted GMM with K - 1 components and the
+ * same covariance type, its components are reused and the
+ * component with the largest mixture proportion is split
+ * in two, with the means displaced by half a standard
+ * deviation in opposite directions. Otherwise the components
+ * are initialized randomly from X.
+ *
+ * @param X
+ * @param prev
+ */
+void GMMLayer::fit_init(const Matrix& X, const ClusteringLayer *prev)
+{
+	int N = X.cols();
+	int D = X.rows();
+	const GMMLayer *model = dynamic_cast<const GMMLayer *>(prev);
+
+	if ( model != nullptr && model->_K == _K - 1 && model->_covariance_type == _covariance_type && std::isfinite(model->_log_likelihood) )
+	{
+		_components = model->_components;
 
-			// check for convergence
-			if ( fabs(L - L_prev) < TOLERANCE )
+		// find the component with the largest mixture proportion
+		int k_split = 0;
+
+		for ( int k = 1; k < model->_K; k++ )
+		{
+			if ( _components[k].pi > _components[k_split].pi )
 			{
-				Logger::log(LogLevel::Debug, "converged after %d iterations", t + 1);
-				break;
+				k_split = k;
 			}
+		}
+
+		// compute displacement from the standard deviations of the component
+		const Matrix& sigma = _components[k_split].sigma;
+		Matrix delta(D, 1);
 
-			// M step
-			m_step(X, gamma);
+		for ( int i = 0; i < D; i++ )
+		{
+			float var;
+
+			if ( _covariance_type == GMMCovariance::full || _covariance_type == GMMCovariance::tied )
+			{
+				var = sigma.elem(i, i);
+			}
+			else if ( _covariance_type == GMMCovariance::diag )
+			{
+				var = sigma.elem(i);
+			}
+			else
+			{
+				var = sigma.elem(0);
+			}
+
+			delta.elem(i) = 0.5f * sqrtf(var);
 		}
 
-		// save outputs
-		_log_likelihood = L;
-		_num_parameters = _K * (1 + D + D * D);
-		_num_samples = N;
-		_entropy = compute_entropy(gamma, compute_labels(gamma));
+		delta.gpu_write();
+
+		// split the component
+		Component component = _components[k_split];
+
+		_components[k_split].pi /= 2;
+		_components[k_split].mu += delta;
+
+		component.pi /= 2;
+		component.mu -= delta;
+
+		_components.push_back(component);
+	}
+	else
+	{
+		std::default_random_engine rng = Random::fork();
+
+		init_components(X, rng, _components);
+	}
+
+	_log_likelihood = -INFINITY;
+	_entropy = 0;
+	_num_parameters = compute_num_parameters(D);
+	_num_samples = N;
+
+	// reset online EM state
+	_num_steps = 0;
+	_s0.clear();
+	_s1.clear();
+	_s2.clear();
+}
+
+
+
+/**
+ * Run at most num_iter iterations of a staged fit. Returns
+ * true if the model has converged or has failed, in which
+ * case the log-likelihood is -inf.
+ *
+ * @param X
+ * @param num_iter
+ */
+bool GMMLayer::fit_step(const Matrix& X, int num_iter)
+{
+	try
+	{
+		return em(X, num_iter, _components, _log_likelihood, _entropy);
 	}
 	catch ( std::runtime_error& e )
 	{
 		_log_likelihood = -INFINITY;
+		_entropy = 0;
+
+		return true;
+	}
+}
+
+
+
+/**
+ * Initialize the sufficient statistics for online EM
+ * from the current model parameters:
+ *
+ *   s0_k = pi_k
+ *   s1_k = pi_k * mu_k
+ *   s2_k = pi_k * S_k
+ *
+ * The second moment s2_k is kept centered about the current
+ * mean mu_k = s1_k / s0_k, so that the covariance is never
+ * computed as the difference of two large terms. For diagonal
+ * and spherical covariance, s2_k holds only the diagonal.
+ */
+void GMMLayer::init_statistics()
+{
+	const int D = _components[0].mu.rows();
+
+	_s0.resize(_K);
+	_s1.resize(_K);
+	_s2.resize(_K);
+
+	for ( int k = 0; k < _K; k++ )
+	{
+		const Component& c = _components[k];
+
+		_s0[k] = c.pi;
+		_s1[k] = c.pi * c.mu;
+
+		if ( _covariance_type == GMMCovariance::full || _covariance_type == GMMCovariance::tied )
+		{
+			_s2[k] = c.sigma;
+		}
+		else
+		{
+			_s2[k] = Matrix(D, 1);
+
+			for ( int j = 0; j < D; j++ )
+			{
+				_s2[k].elem(j) = (_covariance_type == GMMCovariance::diag)
+					? c.sigma.elem(j)
+					: c.sigma.elem(0);
+			}
+
+			_s2[k].gpu_write();
+		}
+
+		_s2[k] *= c.pi;
+	}
+}
+
+
+
+/**
+ * Update the sufficient statistics for online EM with
+ * the statistics of a mini-batch, using a step size eta:
+ *
+ *   s0_k = (1 - eta) * s0_k + eta * b0_k
+ *   s1_k = (1 - eta) * s1_k + eta * b0_k * m_k
+ *   s2_k = (1 - eta) * s2_k + eta * W_k * W_k' / N + w_k * d_k * d_k'
+ *
+ * where b0_k = sum(gamma_ki) / N and m_k = X * gamma_k' / (N * b0_k)
+ * are the weight and mean of the mini-batch, W_k = (X - m_k) *
+ * diag(sqrt(gamma_k)), d_k = m_k - s1_k / s0_k, and w_k is the
+ * harmonic weight (1 - eta) * s0_k * eta * b0_k / s0_k', so that
+ * the centered moments are merged as in the parallel variance
+ * algorithm (Chan et al.).
+ *
+ * @param X
+ * @param gamma
+ * @param eta
+ */
+void GMMLayer::update_statistics(const Matrix& X, const Matrix& gamma, float eta)
+{
+	const int D = X.rows();
+	const int N = X.cols();
+
+	// compute unnormalized batch means M = X * gamma'
+	Matrix M = X * gamma.T();
+
+	#pragma omp parallel for if(!Device::instance())
+	for ( int k = 0; k < _K; k++ )
+	{
+		float b0 = 0;
+
+		for ( int i = 0; i < N; i++ )
+		{
+			b0 += gamma.elem(k, i);
+		}
+
+		// compute the weights of the current and batch statistics
+		float w_a = (1 - eta) * _s0[k];
+		float w_b = eta * b0 / N;
+		float w = (w_a + w_b > 0) ? w_a * w_b / (w_a + w_b) : 0;
+
+		// skip the centered moments of a batch with negligible weight,
+		// since its mean cannot be computed accurately
+		bool has_batch = (w_b > FLT_EPSILON * w_a);
+
+		// compute the batch mean m and its offset d from the current mean
+		Matrix m = M(k);
+		Matrix d;
+
+		if ( has_batch )
+		{
+			m /= b0;
+			d = m;
+			d.axpy(-1.0f / _s0[k], _s1[k]);
+		}
+
+		// update s0 and s1
+		_s0[k] = w_a + w_b;
+
+		_s1[k] *= (1 - eta);
+		_s1[k].axpy(eta / N, M(k));
+
+		// update s2
+		_s2[k] *= (1 - eta);
+
+		if ( !has_batch )
+		{
+			continue;
+		}
+
+		if ( _covariance_type == GMMCovariance::full || _covariance_type == GMMCovariance::tied )
+		{
+			// compute W = (X - m) * diag(sqrt(gamma_k))
+			Matrix W(D, N);
+
+			for ( int i = 0; i < N; i++ )
+			{
+				float w_i = sqrtf(gamma.elem(k, i));
+
+				for ( int j = 0; j < D; j++ )
+				{
+					W.elem(j, i) = (X.elem(j, i) - m.elem(j)) * w_i;
+				}
+			}
+
+			W.gpu_write();
+
+			_s2[k].syrk(false, eta / N, W, 1.0f);
+			_s2[k].syr(w, d);
+
+			// copy the upper triangle of s2 into the lower triangle
+			for ( int j = 1; j < D; j++ )
+			{
+				for ( int i = 0; i < j; i++ )
+				{
+					_s2[k].elem(j, i) = _s2[k].elem(i, j);
+				}
+			}
+		}
+		else
+		{
+			for ( int i = 0; i < N; i++ )
+			{
+				float g_i = eta * gamma.elem(k, i) / N;
+
+				for ( int j = 0; j < D; j++ )
+				{
+					float diff = X.elem(j, i) - m.elem(j);
+
+					_s2[k].elem(j) += g_i * diff * diff;
+				}
+			}
+
+			for ( int j = 0; j < D; j++ )
+			{
+				_s2[k].elem(j) += w * d.elem(j) * d.elem(j);
+			}
+		}
+
+		_s2[k].gpu_write();
+	}
+}
+
+
+
+/**
+ * Update the model parameters from the sufficient
+ * statistics of online EM:
+ *
+ *   pi_k = s0_k / sum(s0)
+ *   mu_k = s1_k / s0_k
+ *   S_k = s2_k / s0_k + reg_covar * I
+ *
+ * The Cholesky factor of each component is then prepared.
+ */
+void GMMLayer::update_parameters()
+{
+	const int D = _components[0].mu.rows();
+
+	float s0_sum = 0;
+
+	for ( int k = 0; k < _K; k++ )
+	{
+		s0_sum += _s0[k];
+	}
+
+	for ( int k = 0; k < _K; k++ )
+	{
+		Component& c = _components[k];
+
+		// update pi
+		c.pi = _s0[k] / s0_sum;
+
+		// update mu
+		c.mu = _s1[k] / _s0[k];
+
+		// update sigma
+		if ( _covariance_type == GMMCovariance::full || _covariance_type == GMMCovariance::tied )
+		{
+			c.sigma = _s2[k] / _s0[k];
+
+			for ( int j = 0; j < D; j++ )
+			{
+				c.sigma.elem(j, j) += _reg_covar;
+			}
+		}
+		else
+		{
+			float sum = 0;
+
+			for ( int j = 0; j < D; j++ )
+			{
+				float var = _s2[k].elem(j) / _s0[k];
+
+				if ( _covariance_type == GMMCovariance::diag )
+				{
+					c.sigma.elem(j) = var + _reg_covar;
+				}
+
+				sum += var;
+			}
+
+			if ( _covariance_type == GMMCovariance::spherical )
+			{
+				c.sigma.elem(0) = sum / D + _reg_covar;
+			}
+		}
+
+		c.sigma.gpu_write();
+	}
+
+	// compute tied covariance S = sum(s0_k * S_k) / sum(s0)
+	if ( _covariance_type == GMMCovariance::tied )
+	{
+		Matrix sigma = Matrix::zeros(D, D);
+
+		for ( int k = 0; k < _K; k++ )
+		{
+			sigma.axpy(_s0[k] / s0_sum, _components[k].sigma);
+		}
+
+		for ( int k = 0; k < _K; k++ )
+		{
+			_components[k].sigma = sigma;
+		}
+	}
+
+	// pre-compute Cholesky factor and normalizer
+	for ( int k = 0; k < _K; k++ )
+	{
+		_components[k].prepare(_covariance_type);
+	}
+}
+
+
+
+/**
+ * Update a Gaussian mixture model with a mini-batch of
+ * data using stepwise (online) EM.
+ *
+ * The E step is performed on the mini-batch, and the
+ * sufficient statistics of each component are moved
+ * toward the statistics of the mini-batch with a step
+ * size eta_t = (t + 2)^-decay. The model parameters and
+ * Cholesky factors are re-computed from the sufficient
+ * statistics every prepare_interval mini-batches.
+ *
+ * If the model has not been fit, the components are
+ * initialized from randomly sampled points in the first
+ * mini-batch. The log-likelihood, entropy and number of
+ * samples are accumulated over all mini-batches since
+ * the statistics were initialized.
+ *
+ * @param X
+ */
+void GMMLayer::partial_fit(const Matrix& X)
+{
+	const int D = X.rows();
+	const int N = X.cols();
+
+	// initialize components from the first mini-batch
+	if ( _components.empty() )
+	{
+		std::default_random_engine rng = Random::fork();
+		std::uniform_int_distribution<int> U(0, N - 1);
+
+		_components.resize(_K);
+
+		for ( int k = 0; k < _K; k++ )
+		{
+			_components[k].initialize(1.0f / _K, X(U(rng)), _covariance_type);
+			_components[k].prepare(_covariance_type);
+		}
+	}
+
+	// initialize sufficient statistics from the current model
+	if ( _s0.empty() )
+	{
+		init_statistics();
+
+		_entropy = 0;
+		_log_likelihood = 0;
+		_num_samples = 0;
+	}
+
+	// E step
+	Matrix gamma(_K, N);
+	float L = e_step(X, _components, gamma);
+
+	// update sufficient statistics
+	float eta = pow(_num_steps + 2, -_decay);
+
+	update_statistics(X, gamma, eta);
+	_num_steps++;
+
+	// update parameters periodically
+	if ( _num_steps % _prepare_interval == 0 )
+	{
+		update_parameters();
+	}
+
+	// save outputs
+	_entropy += compute_entropy(gamma, compute_labels(gamma));
+	_log_likelihood += L;
+	_num_parameters = compute_num_parameters(D);
+	_num_samples += N;
+}
+
+
+
+/**
+ * Update a Gaussian mixture model with one pass over
+ * a data iterator, in mini-batches of a given size. The
+ * mini-batches are read by a batch iterator, which loads
+ * the next mini-batch in parallel while the current one
+ * is used, optionally in a random order, so that a sorted
+ * dataset does not bias the online updates.
+ *
+ * @param iter
+ * @param batch_size
+ * @param shuffle
+ */
+void GMMLayer::partial_fit(DataIterator *iter, int batch_size, bool shuffle)
+{
+	Timer::push("Gaussian mixture model (online)");
+
+	BatchIterator batches(iter, batch_size, shuffle);
+
+	while ( batches.next() )
+	{
+		partial_fit(batches.batch());
+	}
+
+	// apply any pending parameter update
+	if ( _num_steps % _prepare_interval != 0 )
+	{
+		update_parameters();
 	}
 
 	Timer::pop();
@@ -403,7 +1287,7 @@ std::vector<int> GMMLayer::predict(const Matrix& X) const
 	const int N = X.cols();
 
 	Matrix gamma(_K, N);
-	e_step(X, gamma);
+	e_step(X, _components, gamma);
 
 	return compute_labels(gamma);
 }
@@ -418,11 +1302,20 @@ std::vector<int> GMMLayer::predict(const Matrix& X) const
 void GMMLayer::save(IODevice& file) const
 {
 	file << _K;
+	file << _n_init;
+	file << (int) _covariance_type;
+	file << _reg_covar;
+	file << _decay;
+	file << _prepare_interval;
 	file << _components;
 	file << _entropy;
 	file << _log_likelihood;
 	file << _num_parameters;
 	file << _num_samples;
+	file << _num_steps;
+	file << _s0;
+	file << _s1;
+	file << _s2;
 }
 
 
@@ -435,11 +1328,20 @@ void GMMLayer::save(IODevice& file) const
 void GMMLayer::load(IODevice& file)
 {
 	file >> _K;
+	file >> _n_init;
+	int covariance_type; file >> covariance_type; _covariance_type = (GMMCovariance) covariance_type;
+	file >> _reg_covar;
+	file >> _decay;
+	file >> _prepare_interval;
 	file >> _components;
 	file >> _entropy;
 	file >> _log_likelihood;
 	file >> _num_parameters;
 	file >> _num_samples;
+	file >> _num_steps;
+	file >> _s0;
+	file >> _s1;
+	file >> _s2;
 }
 
 
@@ -449,8 +1351,32 @@ void GMMLayer::load(IODevice& file)
  */
 void GMMLayer::print() const
 {
+	const char *covariance_name = "";
+
+	if ( _covariance_type == GMMCovariance::full )
+	{
+		covariance_name = "full";
+	}
+	else if ( _covariance_type == GMMCovariance::diag )
+	{
+		covariance_name = "diag";
+	}
+	else if ( _covariance_type == GMMCovariance::spherical )
+	{
+		covariance_name = "spherical";
+	}
+	else if ( _covariance_type == GMMCovariance::tied )
+	{
+		covariance_name = "tied";
+	}
+
 	Logger::log(LogLevel::Verbose, "Gaussian mixture model");
 	Logger::log(LogLevel::Verbose, "  %-20s  %10d", "K", _K);
+	Logger::log(LogLevel::Verbose, "  %-20s  %10d", "n_init", _n_init);
+	Logger::log(LogLevel::Verbose, "  %-20s  %10s", "covariance_type", covariance_name);
+	Logger::log(LogLevel::Verbose, "  %-20s  %10g", "reg_covar", _reg_covar);
+	Logger::log(LogLevel::Verbose, "  %-20s  %10f", "decay", _decay);
+	Logger::log(LogLevel::Verbose, "  %-20s  %10d", "prepare_interval", _prepare_interval);
 }
 
 
@@ -6,7 +6,9 @@
 #ifndef MLEARN_CLUSTERING_GMM_H
 #define MLEARN_CLUSTERING_GMM_H
 
+#include <random>
 #include "mlearn/clustering/clustering.h"
+#include "mlearn/data/dataiterator.h"
 
 
 
@@ -14,17 +16,26 @@ namespace mlearn {
 
 
 
+enum class GMMCovariance {
+	full,
+	diag,
+	spherical,
+	tied
+};
+
+
+
 class GMMLayer : public ClusteringLayer {
 public:
-	GMMLayer(int K);
+	GMMLayer(int K, int n_init=1, GMMCovariance covariance_type=GMMCovariance::full, float reg_covar=1e-6f, float decay=0.6f, int prepare_interval=1);
 
 	class Component {
 	public:
 		Component() = default;
 
-		void initialize(float pi, const Matrix& mu);
-		void prepare();
-		void compute_log_prob(const Matrix& X, Matrix& logP, int k) const;
+		void initialize(float pi, const Matrix& mu, GMMCovariance covariance_type);
+		void prepare(GMMCovariance covariance_type);
+		void compute_log_prob(const Matrix& X, Matrix& logP, int k, GMMCovariance covariance_type) const;
 
 		friend IODevice& operator<<(IODevice& file, const Component& component);
 		friend IODevice& operator>>(IODevice& file, Component& component);
@@ -34,12 +45,16 @@ public:
 		Matrix sigma;
 
 	private:
-		Matrix _sigma_inv;
+		Matrix _L;
 		float _normalizer;
 	};
 
 	void fit(const Matrix& X);
 	void fit(const Matrix& X, const std::vector<int>& y, int c) { fit(X); }
+	void fit_init(const Matrix& X, const ClusteringLayer *prev);
+	bool fit_step(const Matrix& X, int num_iter);
+	void partial_fit(const Matrix& X);
+	void partial_fit(DataIterator *iter, int batch_size, bool shuffle=false);
 	std::vector<int> predict(const Matrix& X) const;
 
 	void save(IODevice& file) const;
@@ -47,23 +62,42 @@ public:
 	void print() const;
 
 	int num_clusters() const { return _K; }
+	const std::vector<Component>& components() const { return _components; }
 	float aic() const;
 	float bic() const;
 	float icl() const;
 
 private:
-	void kmeans(const Matrix& X);
-	float e_step(const Matrix& X, Matrix& gamma) const;
-	void m_step(const Matrix& X, const Matrix& gamma);
+	void kmeans(const Matrix& X, std::vector<Component>& components) const;
+	float e_step(const Matrix& X, const std::vector<Component>& components, Matrix& gamma) const;
+	void m_step(const Matrix& X, const Matrix& gamma, std::vector<Component>& components) const;
 	std::vector<int> compute_labels(const Matrix& gamma) const;
 	float compute_entropy(const Matrix& gamma, const std::vector<int>& labels) const;
+	int compute_num_parameters(int D) const;
+	void init_statistics();
+	void update_statistics(const Matrix& X, const Matrix& gamma, float eta);
+	void update_parameters();
+	void init_components(const Matrix& X, std::default_random_engine& rng, std::vector<Component>& components) const;
+	bool em(const Matrix& X, int num_iter, std::vector<Component>& components, float& L, float& entropy) const;
+	float fit_restart(const Matrix& X, std::default_random_engine& rng, std::vector<Component>& components, float& entropy) const;
 
 	int _K;
+	int _n_init;
+	GMMCovariance _covariance_type;
+	float _reg_covar;
+	float _decay;
+	int _prepare_interval;
 	std::vector<Component> _components;
 	float _entropy {0};
 	float _log_likelihood {-INFINITY};
 	int _num_parameters {0};
 	int _num_samples {0};
+
+	// sufficient statistics for online EM
+	int _num_steps {0};
+	std::vector<float> _s0;
+	std::vector<Matrix> _s1;
+	std::vector<Matrix> _s2;
 };
 
 
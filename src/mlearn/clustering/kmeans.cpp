@@ -3,9 +3,14 @@
  *
  * Implementation of k-means clustering.
  */
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include "mlearn/clustering/kmeans.h"
+#include "mlearn/cuda/device.h"
 #include "mlearn/math/matrix_utils.h"
 #include "mlearn/math/random.h"
+#include "mlearn/util/error.h"
 #include "mlearn/util/logger.h"
 #include "mlearn/util/timer.h"
 
@@ -19,41 +24,59 @@ namespace mlearn {
  * Construct a k-means layer.
  *
  * @param K
+ * @param n_init
  */
-KMeansLayer::KMeansLayer(int K):
-	_K(K)
+KMeansLayer::KMeansLayer(int K, int n_init):
+	_K(K),
+	_n_init(n_init)
 {
+	CHECK_ERROR(n_init >= 1, "Number of initializations must be at least 1");
 }
 
 
 
 /**
- * Fit a k-means clustering model to a dataset.
+ * Initialize the means by sampling K points from X.
  *
  * @param X
+ * @param rng
+ * @param means
  */
-void KMeansLayer::fit(const Matrix& X)
+void KMeansLayer::init_means(const Matrix& X, std::default_random_engine& rng, std::vector<Matrix>& means) const
 {
-	Timer::push("K-means");
-
 	int N = X.cols();
-	int D = X.rows();
 
-	// initialize means randomly from X
-	_means.reserve(_K);
+	std::uniform_int_distribution<int> U(0, N - 1);
+
+	means.clear();
+	means.reserve(_K);
 
 	for ( int i = 0; i < _K; i++ )
 	{
-		int j = Random::uniform_int(0, X.cols());
+		int j = U(rng);
 
-		_means.push_back(X(j));
+		means.push_back(X(j));
 	}
+}
+
 
-	// iterate k means until convergence
-	std::vector<int> y(N);
+
+/**
+ * Run at most num_iter iterations of Lloyd's algorithm,
+ * starting from the given means and labels. Returns true
+ * if the labels converged.
+ *
+ * @param X
+ * @param num_iter
+ * @param means
+ * @param y
+ */
+bool KMeansLayer::lloyd(const Matrix& X, int num_iter, std::vector<Matrix>& means, std::vector<int>& y) const
+{
+	int N = X.cols();
 	std::vector<int> y_next(N);
 
-	while ( true )
+	for ( int t = 0; t < num_iter; t++ )
 	{
 		// compute new labels
 		for ( int i = 0; i < N; i++ )
@@ -64,7 +87,7 @@ void KMeansLayer::fit(const Matrix& X)
 
 			for ( int k = 0; k < _K; k++ )
 			{
-				float dist = m_dist_L2(X, i, _means[k], 0);
+				float dist = m_dist_L2(X, i, means[k], 0);
 
 				if ( dist < min_dist )
 				{
@@ -79,7 +102,7 @@ void KMeansLayer::fit(const Matrix& X)
 		// check for convergence
 		if ( y == y_next )
 		{
-			break;
+			return true;
 		}
 
 		// update labels
@@ -91,21 +114,37 @@ void KMeansLayer::fit(const Matrix& X)
 			// compute mu_k = mean of all x_i in cluster k
 			int n_k = 0;
 
-			_means[k].init_zeros();
+			means[k].init_zeros();
 
 			for ( int i = 0; i < N; i++ )
 			{
 				if ( y[i] == k )
 				{
-					_means[k] += X(i);
+					means[k] += X(i);
 					n_k++;
 				}
 			}
-			_means[k] /= n_k;
+			means[k] /= n_k;
 		}
 	}
 
-	// compute within-class scatter
+	return false;
+}
+
+
+
+/**
+ * Compute the within-class scatter of a clustering. A
+ * degenerate clustering (such as an empty cluster) has
+ * infinite scatter.
+ *
+ * @param X
+ * @param means
+ * @param y
+ */
+float KMeansLayer::compute_scatter(const Matrix& X, const std::vector<Matrix>& means, const std::vector<int>& y) const
+{
+	int N = X.cols();
 	float S = 0;
 
 	for ( int k = 0; k < _K; k++ )
@@ -114,15 +153,102 @@ void KMeansLayer::fit(const Matrix& X)
 		{
 			if ( y[i] == k )
 			{
-				float dist = m_dist_L2(X, i, _means[k], 0);
+				float dist = m_dist_L2(X, i, means[k], 0);
 
 				S += dist * dist;
 			}
 		}
 	}
 
+	if ( std::isnan(S) )
+	{
+		return INFINITY;
+	}
+
+	return S;
+}
+
+
+
+/**
+ * Run a single randomly-initialized trial of k-means.
+ *
+ * Each trial uses its own random engine and its own
+ * workspace, so that several trials can run concurrently.
+ * The within-class scatter of the final clustering is
+ * returned.
+ *
+ * @param X
+ * @param rng
+ * @param means
+ * @param y
+ */
+float KMeansLayer::fit_restart(const Matrix& X, std::default_random_engine& rng, std::vector<Matrix>& means, std::vector<int>& y) const
+{
+	y.assign(X.cols(), -1);
+
+	init_means(X, rng, means);
+	lloyd(X, std::numeric_limits<int>::max(), means, y);
+
+	return compute_scatter(X, means, y);
+}
+
+
+
+/**
+ * Fit a k-means clustering model to a dataset.
+ *
+ * The model is fit n_init times from different random
+ * initializations, and the trial with the lowest
+ * within-class scatter is kept. Trials are run in
+ * parallel on the CPU.
+ *
+ * @param X
+ */
+void KMeansLayer::fit(const Matrix& X)
+{
+	Timer::push("K-means");
+
+	int N = X.cols();
+	int D = X.rows();
+
+	// create an independent random engine for each trial
+	std::vector<std::default_random_engine> rngs;
+	rngs.reserve(_n_init);
+
+	for ( int r = 0; r < _n_init; r++ )
+	{
+		rngs.push_back(Random::fork());
+	}
+
+	// run each trial
+	std::vector<std::vector<Matrix>> means(_n_init);
+	std::vector<std::vector<int>> labels(_n_init);
+	std::vector<float> scatters(_n_init);
+
+	#pragma omp parallel for schedule(dynamic) if(!Device::instance())
+	for ( int r = 0; r < _n_init; r++ )
+	{
+		scatters[r] = fit_restart(X, rngs[r], means[r], labels[r]);
+	}
+
+	// select the trial with the lowest within-class scatter
+	int best = 0;
+
+	for ( int r = 0; r < _n_init; r++ )
+	{
+		Logger::log(LogLevel::Debug, "restart %d: %g", r + 1, scatters[r]);
+
+		if ( scatters[r] < scatters[best] )
+		{
+			best = r;
+		}
+	}
+
 	// save outputs
-	_log_likelihood = -S;
+	_means = std::move(means[best]);
+	_labels = std::move(labels[best]);
+	_log_likelihood = -scatters[best];
 	_num_parameters = _K * D;
 	_num_samples = N;
 
@@ -131,6 +257,89 @@ void KMeansLayer::fit(const Matrix& X)
 
 
 
+/**
+ * Initialize a k-means model for staged fitting.
+ *
+ * If prev is a fitted k-means model with K - 1 clusters,
+ * its means are reused and the cluster with the largest
+ * scatter is split by adding a mean at its farthest point.
+ * Otherwise the means are sampled randomly from X.
+ *
+ * @param X
+ * @param prev
+ */
+void KMeansLayer::fit_init(const Matrix& X, const ClusteringLayer *prev)
+{
+	int N = X.cols();
+	int D = X.rows();
+	const KMeansLayer *model = dynamic_cast<const KMeansLayer *>(prev);
+
+	if ( model != nullptr && model->_K == _K - 1 && (int)model->_labels.size() == N )
+	{
+		// find the cluster with the largest scatter and its farthest point
+		std::vector<float> scatters(model->_K, 0);
+		std::vector<int> farthest(model->_K, 0);
+		std::vector<float> max_dists(model->_K, -1);
+
+		for ( int i = 0; i < N; i++ )
+		{
+			int k = model->_labels[i];
+
+			if ( k < 0 )
+			{
+				continue;
+			}
+
+			float dist = m_dist_L2(X, i, model->_means[k], 0);
+
+			scatters[k] += dist * dist;
+
+			if ( dist > max_dists[k] )
+			{
+				farthest[k] = i;
+				max_dists[k] = dist;
+			}
+		}
+
+		int k_split = std::max_element(scatters.begin(), scatters.end()) - scatters.begin();
+
+		_means = model->_means;
+		_means.push_back(X(farthest[k_split]));
+	}
+	else
+	{
+		std::default_random_engine rng = Random::fork();
+
+		init_means(X, rng, _means);
+	}
+
+	_labels.assign(N, -1);
+	_log_likelihood = -INFINITY;
+	_num_parameters = _K * D;
+	_num_samples = N;
+}
+
+
+
+/**
+ * Run at most num_iter iterations of a staged fit and
+ * update the log-likelihood. Returns true if the model
+ * has converged.
+ *
+ * @param X
+ * @param num_iter
+ */
+bool KMeansLayer::fit_step(const Matrix& X, int num_iter)
+{
+	bool converged = lloyd(X, num_iter, _means, _labels);
+
+	_log_likelihood = -compute_scatter(X, _means, _labels);
+
+	return converged;
+}
+
+
+
 /**
  * Predict a set of labels for a dataset.
  *
@@ -173,6 +382,7 @@ std::vector<int> KMeansLayer::predict(const Matrix& X) const
 void KMeansLayer::save(IODevice& file) const
 {
 	file << _K;
+	file << _n_init;
 	file << _means;
 	file << _log_likelihood;
 	file << _num_parameters;
@@ -189,6 +399,7 @@ void KMeansLayer::save(IODevice& file) const
 void KMeansLayer::load(IODevice& file)
 {
 	file >> _K;
+	file >> _n_init;
 	file >> _means;
 	file >> _log_likelihood;
 	file >> _num_parameters;
@@ -204,6 +415,7 @@ void KMeansLayer::print() const
 {
 	Logger::log(LogLevel::Verbose, "K-means");
 	Logger::log(LogLevel::Verbose, "  %-20s  %10d", "K", _K);
+	Logger::log(LogLevel::Verbose, "  %-20s  %10d", "n_init", _n_init);
 }
 
 
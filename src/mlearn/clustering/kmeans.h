@@ -6,6 +6,7 @@
 #ifndef MLEARN_CLUSTERING_KMEANS_H
 #define MLEARN_CLUSTERING_KMEANS_H
 
+#include <random>
 #include "mlearn/clustering/clustering.h"
 
 
@@ -16,10 +17,12 @@ namespace mlearn {
 
 class KMeansLayer : public ClusteringLayer {
 public:
-	KMeansLayer(int K);
+	KMeansLayer(int K, int n_init=1);
 
 	void fit(const Matrix& X);
 	void fit(const Matrix& X, const std::vector<int>& y, int c) { fit(X); }
+	void fit_init(const Matrix& X, const ClusteringLayer *prev);
+	bool fit_step(const Matrix& X, int num_iter);
 	std::vector<int> predict(const Matrix& X) const;
 
 	void save(IODevice& file) const;
@@ -32,8 +35,15 @@ public:
 	float icl() const { return bic(); }
 
 private:
+	void init_means(const Matrix& X, std::default_random_engine& rng, std::vector<Matrix>& means) const;
+	bool lloyd(const Matrix& X, int num_iter, std::vector<Matrix>& means, std::vector<int>& y) const;
+	float compute_scatter(const Matrix& X, const std::vector<Matrix>& means, const std::vector<int>& y) const;
+	float fit_restart(const Matrix& X, std::default_random_engine& rng, std::vector<Matrix>& means, std::vector<int>& y) const;
+
 	int _K;
+	int _n_init;
 	std::vector<Matrix> _means;
+	std::vector<int> _labels;
 	float _log_likelihood {-INFINITY};
 	int _num_parameters {0};
 	int _num_samples {0};
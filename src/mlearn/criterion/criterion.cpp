@@ -3,8 +3,13 @@
  *
  * Implementation of the criterion layer.
  */
+#include <algorithm>
+#include <cmath>
+#include <numeric>
 #include "mlearn/criterion/criterion.h"
+#include "mlearn/math/random.h"
 #include "mlearn/util/logger.h"
+#include "mlearn/util/threadpool.h"
 
 
 
@@ -12,9 +17,21 @@ namespace mlearn {
 
 
 
-CriterionLayer::CriterionLayer(Criterion criterion, const std::vector<ClusteringLayer*>& models):
+/**
+ * Construct a criterion layer.
+ *
+ * @param criterion
+ * @param models
+ * @param n_jobs          number of models to fit in parallel (0 = one per core)
+ * @param early_stopping  drop poor models early by successive halving
+ * @param warm_start      initialize each model from the next smaller model
+ */
+CriterionLayer::CriterionLayer(Criterion criterion, const std::vector<ClusteringLayer*>& models, int n_jobs, bool early_stopping, bool warm_start):
 	_criterion(criterion),
-	_models(models)
+	_models(models),
+	_n_jobs(n_jobs),
+	_early_stopping(early_stopping),
+	_warm_start(warm_start)
 {
 }
 
@@ -88,40 +105,69 @@ void CriterionLayer::print() const
 /**
  * Fit model to a dataset.
  *
+ * The candidate models are independent, so they are fit
+ * concurrently by a pool of worker threads (see run_models()).
+ * Each model is fit with its own seed and the criterion
+ * values are reduced in model order, so the result does not
+ * depend on the number of workers or on the order in which
+ * models finish.
+ *
+ * If early stopping or warm starting is enabled, the models
+ * are fit in stages instead (see fit_staged()).
+ *
  * @param X
  */
 void CriterionLayer::fit(const Matrix& X)
 {
-	float min_value = INFINITY;
+	int num_models = _models.size();
+
+	// generate a seed for each model
+	std::default_random_engine rng = Random::fork();
+	std::vector<unsigned int> seeds(num_models);
 
-	for ( size_t i = 0; i < _models.size(); i++ )
+	for ( int i = 0; i < num_models; i++ )
 	{
-		// fit clustering model
-		_models[i]->fit(X);
+		seeds[i] = rng();
+	}
 
-		// score clustering model with a criterion
-		float value;
+	// fit clustering models
+	std::vector<int> candidates(num_models);
+	std::iota(candidates.begin(), candidates.end(), 0);
 
-		switch ( _criterion ) {
-		case Criterion::AIC:
-			value = _models[i]->aic();
-			break;
-		case Criterion::BIC:
-			value = _models[i]->bic();
-			break;
-		case Criterion::ICL:
-			value = _models[i]->icl();
-			break;
-		}
+	std::vector<float> values(num_models, INFINITY);
+
+	if ( _early_stopping || _warm_start )
+	{
+		fit_staged(X, seeds, candidates, values);
+	}
+	else
+	{
+		run_models(order_models(candidates, true), [&] (int i)
+		{
+			Random::seed(seeds[i]);
+
+			_models[i]->fit(X);
+
+			values[i] = compute_criterion(_models[i]);
+		});
+	}
 
-		// select model with lowest criterion value
-		if ( value < min_value )
+	// select remaining candidate with lowest criterion value
+	float min_value = INFINITY;
+
+	_selected_model = nullptr;
+
+	for ( int i = 0; i < num_models; i++ )
+	{
+		bool stopped = (std::find(candidates.begin(), candidates.end(), i) == candidates.end());
+
+		if ( !stopped && values[i] < min_value )
 		{
 			_selected_model = _models[i];
-			min_value = value;
+			min_value = values[i];
 		}
 
-		Logger::log(LogLevel::Verbose, "model %d: %8.3f", i + 1, value);
+		Logger::log(LogLevel::Verbose, "model %d: %8.3f%s", i + 1, values[i], stopped ? " (stopped)" : "");
 	}
 	Logger::log(LogLevel::Verbose, "");
 
@@ -133,6 +179,178 @@ void CriterionLayer::fit(const Matrix& X)
 
 
 
+/**
+ * Fit models in stages with early stopping and/or warm
+ * starting.
+ *
+ * Every model is first initialized and run for a few
+ * iterations. With warm starting, the models are initialized
+ * in order of increasing size and each model is initialized
+ * from the previous one by splitting a component. With early
+ * stopping, the worst half of the candidates by partial
+ * criterion value is then dropped and the rest are run for
+ * twice as many iterations, until one candidate remains,
+ * which is run to convergence (successive halving). Models
+ * are initialized once, regardless of n_init.
+ *
+ * @param X
+ * @param seeds
+ * @param candidates
+ * @param values
+ */
+void CriterionLayer::fit_staged(const Matrix& X, const std::vector<unsigned int>& seeds, std::vector<int>& candidates, std::vector<float>& values)
+{
+	const int MAX_ITERATIONS = 100;
+	const int MIN_ITERATIONS = 5;
+
+	int num_iter = _early_stopping ? MIN_ITERATIONS : MAX_ITERATIONS;
+	std::vector<char> converged(_models.size(), false);
+
+	auto init = [&] (int i, const ClusteringLayer *prev)
+	{
+		Random::seed(seeds[i]);
+
+		_models[i]->fit_init(X, prev);
+	};
+
+	auto step = [&] (int i)
+	{
+		converged[i] = _models[i]->fit_step(X, num_iter);
+		values[i] = compute_criterion(_models[i]);
+	};
+
+	// initialize each model and run the first stage
+	if ( _warm_start )
+	{
+		const ClusteringLayer *prev = nullptr;
+
+		for ( int i : order_models(candidates, false) )
+		{
+			run_models({ i }, [&] (int j)
+			{
+				init(j, prev);
+				step(j);
+			});
+
+			prev = _models[i];
+		}
+	}
+	else
+	{
+		run_models(order_models(candidates, true), [&] (int i)
+		{
+			init(i, nullptr);
+			step(i);
+		});
+	}
+
+	if ( !_early_stopping )
+	{
+		return;
+	}
+
+	while ( true )
+	{
+		// drop the worst half of the candidates
+		if ( candidates.size() > 1 )
+		{
+			std::stable_sort(candidates.begin(), candidates.end(), [&] (int a, int b) {
+				return values[a] < values[b];
+			});
+
+			candidates.resize((candidates.size() + 1) / 2);
+			num_iter *= 2;
+		}
+
+		// run the last candidate to convergence
+		if ( candidates.size() == 1 )
+		{
+			num_iter = MAX_ITERATIONS;
+		}
+
+		// continue the remaining candidates
+		std::vector<int> indices;
+
+		for ( int i : candidates )
+		{
+			if ( !converged[i] )
+			{
+				indices.push_back(i);
+			}
+		}
+
+		Logger::log(LogLevel::Debug, "continuing %d models for %d iterations", (int) indices.size(), num_iter);
+
+		run_models(order_models(indices, true), step);
+
+		if ( candidates.size() == 1 )
+		{
+			break;
+		}
+	}
+}
+
+
+
+/**
+ * Sort a list of model indices by model size.
+ *
+ * @param indices
+ * @param largest_first
+ */
+std::vector<int> CriterionLayer::order_models(std::vector<int> indices, bool largest_first) const
+{
+	std::stable_sort(indices.begin(), indices.end(), [&] (int a, int b) {
+		return largest_first
+			? _models[a]->num_clusters() > _models[b]->num_clusters()
+			: _models[a]->num_clusters() < _models[b]->num_clusters();
+	});
+
+	return indices;
+}
+
+
+
+/**
+ * Run a function on a list of models with a pool of worker
+ * threads. Models are started in the given order, so larger
+ * models should be listed first so that they do not end up
+ * as stragglers.
+ *
+ * @param indices
+ * @param func
+ */
+void CriterionLayer::run_models(const std::vector<int>& indices, const std::function<void(int)>& func) const
+{
+	ThreadPool::run(indices.size(), _n_jobs, [&] (int n)
+	{
+		func(indices[n]);
+	});
+}
+
+
+
+/**
+ * Score a fitted model with the criterion.
+ *
+ * @param model
+ */
+float CriterionLayer::compute_criterion(const ClusteringLayer *model) const
+{
+	switch ( _criterion ) {
+	case Criterion::AIC:
+		return model->aic();
+	case Criterion::BIC:
+		return model->bic();
+	case Criterion::ICL:
+		return model->icl();
+	}
+
+	return INFINITY;
+}
+
+
+
 /**
  * Predict labels for a dataset.
  *
@@ -6,6 +6,7 @@
 #ifndef MLEARN_CRITERION_CRITERION_H
 #define MLEARN_CRITERION_CRITERION_H
 
+#include <functional>
 #include <vector>
 #include "mlearn/clustering/clustering.h"
 #include "mlearn/layer/estimator.h"
@@ -27,7 +28,7 @@ enum class Criterion {
 
 class CriterionLayer : public EstimatorLayer {
 public:
-	CriterionLayer(Criterion criterion, const std::vector<ClusteringLayer*>& models);
+	CriterionLayer(Criterion criterion, const std::vector<ClusteringLayer*>& models, int n_jobs=0, bool early_stopping=false, bool warm_start=false);
 	virtual ~CriterionLayer() {}
 
 	void save(IODevice& file) const;
@@ -40,8 +41,16 @@ public:
 	float score(const Matrix& X, const std::vector<int>& y) const;
 
 protected:
+	void fit_staged(const Matrix& X, const std::vector<unsigned int>& seeds, std::vector<int>& candidates, std::vector<float>& values);
+	std::vector<int> order_models(std::vector<int> indices, bool largest_first) const;
+	void run_models(const std::vector<int>& indices, const std::function<void(int)>& func) const;
+	float compute_criterion(const ClusteringLayer *model) const;
+
 	Criterion _criterion;
 	std::vector<ClusteringLayer*> _models;
+	int _n_jobs;
+	bool _early_stopping;
+	bool _warm_start;
 	ClusteringLayer* _selected_model {nullptr};
 };
 
@@ -0,0 +1,342 @@
+/**
+ * @file criterion/gridsearch.cpp
+ *
+ * Implementation of the grid search.
+ *
+ * A grid search evaluates every combination of a transform
+ * configuration (such as PCA with a given n1) and an estimator
+ * configuration (such as kNN with a given k and distance) with
+ * k-fold cross-validation. The transforms are the expensive
+ * stage, so the transforms of each configuration are fit once
+ * per fold and the transformed train and test sets are shared
+ * by every estimator which is combined with them. Each pair
+ * of fold and transform configuration is a task, and the
+ * tasks are run in parallel by a thread pool.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <memory>
+#include "mlearn/criterion/gridsearch.h"
+#include "mlearn/data/dataset.h"
+#include "mlearn/math/random.h"
+#include "mlearn/util/error.h"
+#include "mlearn/util/logger.h"
+#include "mlearn/util/threadpool.h"
+
+
+
+namespace mlearn {
+
+
+
+typedef std::chrono::steady_clock search_clock_t;
+
+
+
+/**
+ * Get the number of seconds since a time point.
+ *
+ * @param start
+ */
+float elapsed_since(const search_clock_t::time_point& start)
+{
+	return std::chrono::duration<float>(search_clock_t::now() - start).count();
+}
+
+
+
+/**
+ * Construct a grid search. The cross-validator is copied,
+ * so that it may be a temporary.
+ *
+ * @param transforms
+ * @param estimators
+ * @param cv
+ * @param n_iter      number of random combinations to evaluate (0 = all)
+ * @param n_jobs      number of tasks to run in parallel (0 = one per core)
+ */
+GridSearch::GridSearch(
+	const std::vector<transform_config_t>& transforms,
+	const std::vector<estimator_config_t>& estimators,
+	const KFold& cv,
+	int n_iter,
+	int n_jobs):
+	_transforms(transforms),
+	_estimators(estimators),
+	_cv(cv.clone()),
+	_n_iter(n_iter),
+	_n_jobs(n_jobs)
+{
+}
+
+
+
+/**
+ * Get the result with the highest mean score.
+ */
+const search_result_t& GridSearch::best() const
+{
+	CHECK_ERROR(!_results.empty(), "Grid search has not been fit");
+
+	return *std::max_element(_results.begin(), _results.end(), [] (const search_result_t& a, const search_result_t& b) {
+		return a.mean < b.mean;
+	});
+}
+
+
+
+/**
+ * Evaluate each combination of transform and estimator
+ * configurations on a dataset.
+ *
+ * If n_iter is less than the number of combinations, a
+ * random subset of n_iter combinations is evaluated instead
+ * (random search). Each task is run with its own seed, so
+ * the results do not depend on the number of workers.
+ *
+ * @param X
+ * @param y
+ * @param c
+ */
+void GridSearch::fit(const Matrix& X, const std::vector<int>& y, int c)
+{
+	int num_transforms = _transforms.size();
+	int num_estimators = _estimators.size();
+
+	// select the combinations to evaluate
+	std::vector<std::pair<int, int>> combinations;
+
+	for ( int t = 0; t < num_transforms; t++ )
+	{
+		for ( int e = 0; e < num_estimators; e++ )
+		{
+			combinations.push_back(std::make_pair(t, e));
+		}
+	}
+
+	if ( 0 < _n_iter && _n_iter < (int) combinations.size() )
+	{
+		Random::shuffle(combinations);
+
+		combinations.resize(_n_iter);
+		std::sort(combinations.begin(), combinations.end());
+	}
+
+	// generate folds
+	std::vector<fold_t> folds = _cv->split(y);
+	int num_folds = folds.size();
+
+	// group the combinations by transform configuration
+	std::vector<std::vector<int>> groups(num_transforms);
+
+	_results.clear();
+
+	for ( auto& combination : combinations )
+	{
+		search_result_t result;
+		result.transform = combination.first;
+		result.estimator = combination.second;
+		result.scores.resize(num_folds);
+		result.mean = 0;
+		result.std = 0;
+		result.time = 0;
+
+		groups[result.transform].push_back(_results.size());
+		_results.push_back(result);
+	}
+
+	// create a task for each fold of each transform configuration
+	std::vector<std::pair<int, int>> tasks;
+
+	for ( int t = 0; t < num_transforms; t++ )
+	{
+		if ( groups[t].empty() )
+		{
+			continue;
+		}
+
+		for ( int f = 0; f < num_folds; f++ )
+		{
+			tasks.push_back(std::make_pair(f, t));
+		}
+	}
+
+	// generate a seed for each task
+	std::default_random_engine rng = Random::fork();
+	std::vector<unsigned int> seeds(tasks.size());
+
+	for ( size_t n = 0; n < tasks.size(); n++ )
+	{
+		seeds[n] = rng();
+	}
+
+	// run tasks
+	std::vector<std::vector<float>> times(_results.size(), std::vector<float>(num_folds));
+
+	Logger::log(LogLevel::Verbose, "Evaluating %d combinations with %d folds (%d tasks)",
+		(int) _results.size(),
+		num_folds,
+		(int) tasks.size());
+
+	ThreadPool::run(tasks.size(), _n_jobs, [&] (int n)
+	{
+		int f = tasks[n].first;
+		int t = tasks[n].second;
+		const std::vector<int>& group = groups[t];
+
+		Random::seed(seeds[n]);
+
+		// gather train set and test set
+		Matrix X_train;
+		Matrix X_test;
+
+		Dataset::gather(X, folds[f].train, X_train);
+		Dataset::gather(X, folds[f].test, X_test);
+
+		std::vector<int> y_train = Dataset::gather(y, folds[f].train);
+		std::vector<int> y_test = Dataset::gather(y, folds[f].test);
+
+		// fit transforms once for every estimator
+		auto start = search_clock_t::now();
+
+		std::vector<std::unique_ptr<TransformerLayer>> layers;
+
+		for ( TransformerLayer *layer : _transforms[t].create() )
+		{
+			layers.emplace_back(layer);
+		}
+
+		for ( auto& layer : layers )
+		{
+			layer->fit(X_train, y_train, c);
+			layer->transform_inplace(X_train);
+			layer->transform_inplace(X_test);
+		}
+
+		float prefix_time = elapsed_since(start) / group.size();
+
+		// fit and score each estimator on the transformed data
+		for ( int r : group )
+		{
+			auto start = search_clock_t::now();
+
+			std::unique_ptr<EstimatorLayer> estimator(_estimators[_results[r].estimator].create());
+
+			estimator->fit(X_train, y_train, c);
+
+			_results[r].scores[f] = estimator->score(X_test, y_test);
+			times[r][f] = prefix_time + elapsed_since(start);
+
+			Logger::log(LogLevel::Debug, "debug: fold %d: %s %s: %.3f",
+				f + 1,
+				_transforms[t].name.c_str(),
+				_estimators[_results[r].estimator].name.c_str(),
+				_results[r].scores[f]);
+		}
+	});
+
+	// compute the mean and standard deviation of each result
+	for ( size_t r = 0; r < _results.size(); r++ )
+	{
+		search_result_t& result = _results[r];
+
+		for ( int f = 0; f < num_folds; f++ )
+		{
+			result.mean += result.scores[f] / num_folds;
+			result.time += times[r][f];
+		}
+
+		for ( int f = 0; f < num_folds; f++ )
+		{
+			result.std += (result.scores[f] - result.mean) * (result.scores[f] - result.mean) / num_folds;
+		}
+
+		result.std = sqrtf(result.std);
+	}
+}
+
+
+
+/**
+ * Print the results of a grid search, with the rank of
+ * each combination by mean score.
+ */
+void GridSearch::print() const
+{
+	// rank results by mean score
+	std::vector<int> ranks(_results.size());
+
+	for ( size_t r = 0; r < _results.size(); r++ )
+	{
+		ranks[r] = 1 + std::count_if(_results.begin(), _results.end(), [&] (const search_result_t& other) {
+			return other.mean > _results[r].mean;
+		});
+	}
+
+	Logger::log(LogLevel::Verbose, "Results");
+	Logger::log(LogLevel::Verbose, "%4s  %-20s  %-20s  %6s  %6s  %8s", "rank", "transform", "estimator", "mean", "std", "time");
+
+	for ( size_t r = 0; r < _results.size(); r++ )
+	{
+		const search_result_t& result = _results[r];
+
+		Logger::log(LogLevel::Verbose, "%4d  %-20s  %-20s  %6.3f  %6.3f  %8.3f",
+			ranks[r],
+			_transforms[result.transform].name.c_str(),
+			_estimators[result.estimator].name.c_str(),
+			result.mean,
+			result.std,
+			result.time);
+	}
+
+	Logger::log(LogLevel::Verbose, "");
+}
+
+
+
+/**
+ * Save the results of a grid search to a tab-separated
+ * file, with one row per combination and the score of
+ * each fold.
+ *
+ * @param path
+ */
+void GridSearch::save(const std::string& path) const
+{
+	std::ofstream file(path);
+
+	CHECK_ERROR(file.is_open(), "Failed to open results file");
+
+	int num_folds = _results.empty() ? 0 : _results[0].scores.size();
+
+	file << "transform\testimator\tmean\tstd\ttime";
+
+	for ( int f = 0; f < num_folds; f++ )
+	{
+		file << "\tfold" << f + 1;
+	}
+	file << "\n";
+
+	for ( const search_result_t& result : _results )
+	{
+		file << _transforms[result.transform].name
+			<< "\t" << _estimators[result.estimator].name
+			<< "\t" << result.mean
+			<< "\t" << result.std
+			<< "\t" << result.time;
+
+		for ( float score : result.scores )
+		{
+			file << "\t" << score;
+		}
+		file << "\n";
+	}
+
+	CHECK_ERROR(!file.fail(), "Failed to write results file");
+}
+
+
+
+}
@@ -0,0 +1,78 @@
+/**
+ * @file criterion/gridsearch.h
+ *
+ * Interface definitions for the grid search.
+ */
+#ifndef MLEARN_CRITERION_GRIDSEARCH_H
+#define MLEARN_CRITERION_GRIDSEARCH_H
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "mlearn/data/kfold.h"
+#include "mlearn/layer/estimator.h"
+#include "mlearn/layer/transformer.h"
+
+
+
+namespace mlearn {
+
+
+
+typedef struct {
+	std::string name;
+	std::function<std::vector<TransformerLayer *>()> create;
+} transform_config_t;
+
+
+
+typedef struct {
+	std::string name;
+	std::function<EstimatorLayer *()> create;
+} estimator_config_t;
+
+
+
+typedef struct {
+	int transform;
+	int estimator;
+	std::vector<float> scores;
+	float mean;
+	float std;
+	float time;
+} search_result_t;
+
+
+
+class GridSearch {
+public:
+	GridSearch(
+		const std::vector<transform_config_t>& transforms,
+		const std::vector<estimator_config_t>& estimators,
+		const KFold& cv,
+		int n_iter=0,
+		int n_jobs=0
+	);
+
+	const std::vector<search_result_t>& results() const { return _results; }
+	const search_result_t& best() const;
+
+	void fit(const Matrix& X, const std::vector<int>& y, int c);
+	void print() const;
+	void save(const std::string& path) const;
+
+private:
+	std::vector<transform_config_t> _transforms;
+	std::vector<estimator_config_t> _estimators;
+	std::shared_ptr<const KFold> _cv;
+	int _n_iter;
+	int _n_jobs;
+	std::vector<search_result_t> _results;
+};
+
+
+
+}
+
+#endif
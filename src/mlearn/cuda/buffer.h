@@ -6,6 +6,7 @@
 #ifndef MLEARN_CUDA_BUFFER_H
 #define MLEARN_CUDA_BUFFER_H
 
+#include <memory>
 #include <cuda_runtime.h>
 #include "mlearn/cuda/device.h"
 
@@ -21,9 +22,11 @@ private:
 	size_t _size {0};
 	T *_host {nullptr};
 	T *_dev {nullptr};
+	std::shared_ptr<void> _owner;
 
 public:
 	Buffer(size_t size, bool alloc_host=true);
+	Buffer(size_t size, T *host, const std::shared_ptr<void>& owner);
 	Buffer(const Buffer<T>& copy) = delete;
 	Buffer(Buffer<T>&& move);
 	Buffer() {}
@@ -32,6 +35,7 @@ public:
 	size_t size() const { return _size; }
 	T * host_data() const { return _host; }
 	T * device_data() const { return _dev; }
+	bool has_owner() const { return _owner != nullptr; }
 
 	void read();
 	void read(size_t size, size_t offset=0);
@@ -68,6 +72,31 @@ Buffer<T>::Buffer(size_t size, bool alloc_host)
 
 
 
+/**
+ * Construct a buffer on host memory which is owned by
+ * another object, such as a memory-mapped file. The owner
+ * is kept alive for the lifetime of the buffer, and the host
+ * memory is not freed by the buffer.
+ *
+ * @param size
+ * @param host
+ * @param owner
+ */
+template <class T>
+Buffer<T>::Buffer(size_t size, T *host, const std::shared_ptr<void>& owner)
+{
+	_size = size;
+	_host = host;
+	_owner = owner;
+
+	if ( Device::instance() )
+	{
+		CHECK_CUDA(cudaMalloc(&_dev, size * sizeof(T)));
+	}
+}
+
+
+
 template <class T>
 Buffer<T>::Buffer(Buffer&& move)
 	: Buffer()
@@ -80,6 +109,11 @@ Buffer<T>::Buffer(Buffer&& move)
 template <class T>
 Buffer<T>::~Buffer()
 {
+	if ( _owner )
+	{
+		_host = nullptr;
+	}
+
 	if ( Device::instance() )
 	{
 		CHECK_CUDA(cudaFreeHost(_host));
@@ -151,6 +185,7 @@ void swap(Buffer<T>& lhs, Buffer<T>& rhs)
 	std::swap(lhs._size, rhs._size);
 	std::swap(lhs._host, rhs._host);
 	std::swap(lhs._dev, rhs._dev);
+	std::swap(lhs._owner, rhs._owner);
 }
 
 
@@ -32,18 +32,54 @@ Device * Device::instance()
 
 
 
+/**
+ * Construct the device. The handles of the calling thread
+ * are created here so that any errors are reported early.
+ */
 Device::Device()
 {
-	CHECK_CUBLAS(cublasCreate(&_cublas_handle));
-	CHECK_CUSOLVER(cusolverDnCreate(&_cusolver_handle));
+	handles();
+}
+
+
+
+/**
+ * Get the handles of the calling thread.
+ *
+ * cuBLAS and cuSOLVER handles are not safe to share between
+ * threads, so each thread has its own handles, which are
+ * created on first use and destroyed when the thread exits.
+ * The handles of each thread are bound to their own stream,
+ * so that work from different threads can run concurrently.
+ * The stream is a blocking stream, so it is still ordered
+ * with the memory transfers in Buffer, which use the default
+ * stream.
+ */
+Device::Handles& Device::handles()
+{
+	static thread_local Handles handles;
+
+	return handles;
+}
+
+
+
+Device::Handles::Handles()
+{
+	CHECK_CUDA(cudaStreamCreate(&stream));
+	CHECK_CUBLAS(cublasCreate(&cublas_handle));
+	CHECK_CUBLAS(cublasSetStream(cublas_handle, stream));
+	CHECK_CUSOLVER(cusolverDnCreate(&cusolver_handle));
+	CHECK_CUSOLVER(cusolverDnSetStream(cusolver_handle, stream));
 }
 
 
 
-Device::~Device()
+Device::Handles::~Handles()
 {
-	CHECK_CUBLAS(cublasDestroy(_cublas_handle));
-	CHECK_CUSOLVER(cusolverDnDestroy(_cusolver_handle));
+	cusolverDnDestroy(cusolver_handle);
+	cublasDestroy(cublas_handle);
+	cudaStreamDestroy(stream);
 }
 
 
@@ -36,20 +36,30 @@ namespace mlearn {
 
 class Device {
 private:
+	class Handles {
+	public:
+		Handles();
+		~Handles();
+
+		cudaStream_t stream;
+		cublasHandle_t cublas_handle;
+		cusolverDnHandle_t cusolver_handle;
+	};
+
 	static std::unique_ptr<Device> _instance;
 
-	cublasHandle_t _cublas_handle;
-	cusolverDnHandle_t _cusolver_handle;
+	static Handles& handles();
 
 public:
 	static void initialize();
 	static Device * instance();
 
 	Device();
-	~Device();
+	~Device() {}
 
-	cublasHandle_t cublas_handle() const { return _cublas_handle; }
-	cusolverDnHandle_t cusolver_handle() const { return _cusolver_handle; }
+	cudaStream_t stream() const { return handles().stream; }
+	cublasHandle_t cublas_handle() const { return handles().cublas_handle; }
+	cusolverDnHandle_t cusolver_handle() const { return handles().cusolver_handle; }
 };
 
 
@@ -0,0 +1,165 @@
+/**
+ * @file data/batchiterator.cpp
+ *
+ * Implementation of the mini-batch iterator.
+ *
+ * The batch iterator divides a dataset into batches of
+ * columns, optionally in a new random order for each epoch.
+ * Shuffling permutes only the sample indices, and each batch
+ * is gathered from the data iterator by a data loader, so
+ * the dataset is never copied as a whole. Two batch buffers
+ * are reused for every epoch: the next batch is loaded while
+ * the current batch is in use.
+ */
+#include <algorithm>
+#include "mlearn/data/batchiterator.h"
+#include "mlearn/math/random.h"
+
+
+
+namespace mlearn {
+
+
+
+/**
+ * Construct a batch iterator on a data iterator.
+ *
+ * @param iter
+ * @param batch_size
+ * @param shuffle
+ * @param num_workers
+ */
+BatchIterator::BatchIterator(DataIterator *iter, int batch_size, bool shuffle, int num_workers):
+	_iter(iter),
+	_batch_size(std::max(1, batch_size)),
+	_shuffle(shuffle),
+	_loader(iter, num_workers),
+	_order(iter->num_samples())
+{
+	for ( size_t i = 0; i < _order.size(); i++ )
+	{
+		_order[i] = i;
+	}
+}
+
+
+
+/**
+ * Construct a batch iterator on a dataset.
+ *
+ * @param dataset
+ * @param batch_size
+ * @param shuffle
+ * @param num_workers
+ */
+BatchIterator::BatchIterator(const Dataset& dataset, int batch_size, bool shuffle, int num_workers):
+	BatchIterator(dataset.iterator(), batch_size, shuffle, num_workers)
+{
+}
+
+
+
+/**
+ * Destruct a batch iterator after the pending batch
+ * is loaded.
+ */
+BatchIterator::~BatchIterator()
+{
+	reset();
+}
+
+
+
+/**
+ * Advance to the next batch of the current epoch, and
+ * return false at the end of the epoch. The following call
+ * starts the next epoch, in a new order if shuffling is
+ * enabled.
+ *
+ * The current batch and its sample indices are valid until
+ * the next call.
+ */
+bool BatchIterator::next()
+{
+	// start a new epoch
+	if ( _batch == -1 )
+	{
+		if ( _shuffle )
+		{
+			Random::shuffle(_order);
+		}
+
+		if ( num_batches() > 0 )
+		{
+			start(0, 0);
+		}
+	}
+
+	_batch++;
+
+	// end the current epoch
+	if ( _batch == num_batches() )
+	{
+		_batch = -1;
+		_epoch++;
+
+		return false;
+	}
+
+	// wait for the current batch
+	_current = _batch % 2;
+	_next.get();
+
+	// start loading the next batch
+	if ( _batch + 1 < num_batches() )
+	{
+		start(_batch + 1, 1 - _current);
+	}
+
+	return true;
+}
+
+
+
+/**
+ * Abandon the current epoch, so that the next call to
+ * next() starts a new epoch.
+ */
+void BatchIterator::reset()
+{
+	if ( _next.valid() )
+	{
+		_next.wait();
+	}
+
+	_next = std::future<void>();
+	_batch = -1;
+}
+
+
+
+/**
+ * Start loading a batch into a batch buffer.
+ *
+ * @param b
+ * @param slot
+ */
+void BatchIterator::start(int b, int slot)
+{
+	int begin = b * _batch_size;
+	int end = std::min(begin + _batch_size, (int)_order.size());
+
+	_indices[slot].assign(_order.begin() + begin, _order.begin() + end);
+
+	// allocate the buffer, which is resized only for the last batch
+	if ( _buffers[slot].cols() != end - begin )
+	{
+		_buffers[slot] = Matrix(_iter->sample_size(), end - begin);
+	}
+
+	_next = _loader.load_async(_buffers[slot], _indices[slot]);
+}
+
+
+
+}
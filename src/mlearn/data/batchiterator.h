@@ -0,0 +1,56 @@
+/**
+ * @file data/batchiterator.h
+ *
+ * Interface definitions for the mini-batch iterator.
+ */
+#ifndef MLEARN_DATA_BATCHITERATOR_H
+#define MLEARN_DATA_BATCHITERATOR_H
+
+#include "mlearn/data/dataloader.h"
+#include "mlearn/data/dataset.h"
+
+
+
+namespace mlearn {
+
+
+
+class BatchIterator {
+public:
+	BatchIterator(DataIterator *iter, int batch_size, bool shuffle=false, int num_workers=0);
+	BatchIterator(const Dataset& dataset, int batch_size, bool shuffle=false, int num_workers=0);
+	~BatchIterator();
+
+	int batch_size() const { return _batch_size; }
+	int num_batches() const { return (_order.size() + _batch_size - 1) / _batch_size; }
+	int epoch() const { return _epoch; }
+
+	bool next();
+	void reset();
+
+	const Matrix& batch() const { return _buffers[_current]; }
+	const std::vector<int>& indices() const { return _indices[_current]; }
+	int offset() const { return _batch * _batch_size; }
+
+private:
+	void start(int b, int slot);
+
+	DataIterator *_iter;
+	int _batch_size;
+	bool _shuffle;
+	DataLoader _loader;
+
+	std::vector<int> _order;
+	int _epoch {0};
+	int _batch {-1};
+	int _current {0};
+	Matrix _buffers[2];
+	std::vector<int> _indices[2];
+	std::future<void> _next;
+};
+
+
+
+}
+
+#endif
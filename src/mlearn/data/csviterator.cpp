@@ -2,10 +2,25 @@
  * @file data/csviterator.cpp
  *
  * Implementation of the CSV iterator.
+ *
+ * The file is memory-mapped and parsed in parallel: it is
+ * split into one chunk per thread at line boundaries, the
+ * lines of each chunk are counted to determine the first
+ * sample of each chunk, and then each chunk is parsed
+ * directly into the columns of the data matrix.
  */
+#include <algorithm>
 #include <cassert>
-#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <fcntl.h>
+#include <omp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "mlearn/data/csviterator.h"
+#include "mlearn/util/logger.h"
 
 
 
@@ -13,45 +28,490 @@ namespace mlearn {
 
 
 
+const double POWERS_OF_10[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+	1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+	1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+
+/**
+ * Helper function to skip spaces and tabs.
+ *
+ * @param s
+ * @param end
+ */
+inline const char * skip_blanks(const char *s, const char *end)
+{
+	while ( s < end && (*s == ' ' || *s == '\t' || *s == '\r') ) {
+		s++;
+	}
+
+	return s;
+}
+
+
+
+/**
+ * Helper function to find the end of a field.
+ *
+ * @param s
+ * @param end
+ * @param delim
+ */
+inline const char * find_field_end(const char *s, const char *end, char delim)
+{
+	while ( s < end && *s != delim && *s != '\n' && !(delim == ' ' && (*s == '\t' || *s == '\r')) ) {
+		s++;
+	}
+
+	return s;
+}
+
+
+
+/**
+ * Parse a float with strtof, which handles every format
+ * but requires a null-terminated copy of the field.
+ *
+ * @param s
+ * @param end
+ * @param value
+ */
+const char * parse_float_slow(const char *s, const char *end, float& value)
+{
+	char buffer[64];
+	size_t n = std::min((size_t)(end - s), sizeof(buffer) - 1);
+
+	memcpy(buffer, s, n);
+	buffer[n] = '\0';
+
+	char *p;
+	value = strtof(buffer, &p);
+
+	return (p == buffer)
+		? nullptr
+		: s + (p - buffer);
+}
+
+
+
+/**
+ * Parse a float from a field. Decimal numbers with up to
+ * 15 significant digits and small exponents are computed
+ * exactly in double precision and rounded to float, which
+ * gives the correctly rounded result unless the double
+ * lies exactly halfway between two floats. All other
+ * numbers, and halfway cases, are parsed by strtof.
+ *
+ * Returns a pointer to the end of the number, or nullptr
+ * if the field does not begin with a number.
+ *
+ * @param s
+ * @param end
+ * @param value
+ */
+inline const char * parse_float(const char *s, const char *end, float& value)
+{
+	const char *p = s;
+
+	// parse sign
+	bool negative = false;
+
+	if ( p < end && (*p == '-' || *p == '+') ) {
+		negative = (*p == '-');
+		p++;
+	}
+
+	// parse digits
+	uint64_t mantissa = 0;
+	int num_digits = 0;
+	bool has_digits = false;
+	int exponent = 0;
+
+	for ( ; p < end && '0' <= *p && *p <= '9'; p++ ) {
+		mantissa = mantissa * 10 + (*p - '0');
+		num_digits += (mantissa != 0);
+		has_digits = true;
+	}
+
+	if ( p < end && *p == '.' ) {
+		for ( p++; p < end && '0' <= *p && *p <= '9'; p++ ) {
+			mantissa = mantissa * 10 + (*p - '0');
+			num_digits += (mantissa != 0);
+			has_digits = true;
+			exponent--;
+		}
+	}
+
+	if ( !has_digits ) {
+		return parse_float_slow(s, end, value);
+	}
+
+	// parse exponent
+	if ( p < end && (*p == 'e' || *p == 'E') ) {
+		const char *q = p + 1;
+		bool exp_negative = false;
+
+		if ( q < end && (*q == '-' || *q == '+') ) {
+			exp_negative = (*q == '-');
+			q++;
+		}
+
+		int exp = 0;
+		const char *exp_begin = q;
+
+		for ( ; q < end && '0' <= *q && *q <= '9'; q++ ) {
+			exp = std::min(exp * 10 + (*q - '0'), 1000);
+		}
+
+		if ( q == exp_begin ) {
+			return parse_float_slow(s, end, value);
+		}
+
+		exponent += exp_negative ? -exp : exp;
+		p = q;
+	}
+
+	// use strtof if the number cannot be computed exactly
+	if ( num_digits > 15 || exponent < -22 || 22 < exponent ) {
+		return parse_float_slow(s, end, value);
+	}
+
+	double d = (exponent < 0)
+		? mantissa / POWERS_OF_10[-exponent]
+		: mantissa * POWERS_OF_10[exponent];
+
+	// use strtof if rounding to float may be ambiguous
+	uint64_t bits;
+	memcpy(&bits, &d, sizeof(double));
+
+	if ( (bits & 0x1fffffff) == 0x10000000 || (d != 0 && d < 1.2e-38) ) {
+		return parse_float_slow(s, end, value);
+	}
+
+	value = negative ? -(float)d : (float)d;
+
+	return p;
+}
+
+
+
+/**
+ * Split a line into fields, returning the number of fields.
+ *
+ * @param s
+ * @param end
+ * @param delim
+ * @param fields
+ */
+int split_line(const char *s, const char *end, char delim, std::vector<std::string>& fields)
+{
+	fields.clear();
+
+	while ( true ) {
+		s = skip_blanks(s, end);
+
+		if ( s == end || *s == '\n' ) {
+			break;
+		}
+
+		const char *field_end = find_field_end(s, end, delim);
+
+		fields.push_back(std::string(s, field_end - s));
+
+		s = field_end;
+
+		if ( s < end && *s == delim && delim != ' ' ) {
+			s++;
+		}
+	}
+
+	// trim trailing whitespace from each field
+	for ( std::string& field : fields ) {
+		field.erase(field.find_last_not_of(" \t\r") + 1);
+	}
+
+	return fields.size();
+}
+
+
+
+/**
+ * Determine whether a field is a number.
+ *
+ * @param field
+ */
+bool is_number(const std::string& field)
+{
+	float value;
+	const char *end = field.c_str() + field.size();
+	const char *p = parse_float(field.c_str(), end, value);
+
+	return (p == end);
+}
+
+
+
+/**
+ * Determine whether a field is a non-negative integer.
+ *
+ * @param field
+ */
+bool is_integer(const std::string& field)
+{
+	return !field.empty() && std::all_of(field.begin(), field.end(), [] (char c) {
+		return '0' <= c && c <= '9';
+	});
+}
+
+
+
 /**
  * Construct a CSV iterator from a file.
  *
  * Each line in the file should be an observation
- * with the features followed by the label.
+ * with the features followed by the label. Fields are
+ * separated by commas, or by whitespace if the first line
+ * has no commas. The first line is skipped if it is a
+ * header, which is either a line of column names or the
+ * line "<num_samples> <num_features>". The latter is only
+ * a header if both fields are integers, the next line has
+ * num_features + 1 fields, and the file has exactly
+ * num_samples samples after it; otherwise it is a sample.
+ *
+ * If the file has a packed float32 cache which is up to
+ * date with the file, the samples are loaded from the cache
+ * instead of the file, unless use_cache is false.
  *
  * @param filename
+ * @param use_cache
  */
-CSVIterator::CSVIterator(const std::string& filename)
+CSVIterator::CSVIterator(const std::string& filename, bool use_cache)
 {
-	// open file
-	std::ifstream file(filename, std::ifstream::in);
+	// use packed cache if it is up to date
+	if ( use_cache ) {
+		_cache = PackedIterator::open_cache(filename);
+	}
+
+	if ( _cache ) {
+		_entries = _cache->entries();
+		return;
+	}
 
-	int m;
-	int n;
-	file >> n >> m;
+	// map file into memory
+	int fd = open(filename.c_str(), O_RDONLY);
+	struct stat st;
 
-	_size = m;
-	_data.reset(new float[m * n]);
+	if ( fd == -1 || fstat(fd, &st) != 0 ) {
+		Logger::log(LogLevel::Error, "error: cannot read file \'%s\'\n", filename.c_str());
+		exit(1);
+	}
 
-	// construct entries
-	_entries.reserve(n);
+	size_t length = st.st_size;
+	void *addr = (length > 0)
+		? mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0)
+		: nullptr;
+
+	close(fd);
+
+	if ( addr == MAP_FAILED ) {
+		Logger::log(LogLevel::Error, "error: cannot read file \'%s\'\n", filename.c_str());
+		exit(1);
+	}
+
+	if ( length > 0 ) {
+		madvise(addr, length, MADV_SEQUENTIAL);
+	}
+
+	const char *begin = (const char *)addr;
+	const char *end = begin + length;
 
-	for ( int i = 0; i < n; i++ ) {
-		// read data
-		for ( int j = 0; j < m; j++ ) {
-			file >> _data[i * m + j];
+	// read first line
+	const char *s = begin;
+
+	while ( s < end && skip_blanks(s, end) < end && *skip_blanks(s, end) == '\n' ) {
+		s = skip_blanks(s, end) + 1;
+	}
+
+	const char *line_end = std::find(s, end, '\n');
+	char delim = (std::find(s, line_end, ',') != line_end) ? ',' : ' ';
+
+	std::vector<std::string> fields;
+	int num_fields = split_line(s, line_end, delim, fields);
+
+	// determine whether the first line is a header
+	const char *first_line = s;
+	int num_header_samples = -1;
+	int num_header_fields = 0;
+
+	bool is_header = false;
+
+	for ( int k = 0; k < num_fields - 1; k++ ) {
+		is_header |= !is_number(fields[k]);
+	}
+
+	if ( is_header ) {
+		s = line_end;
+	}
+	else if ( delim == ' ' && num_fields == 2 ) {
+		// check for "<num_samples> <num_features>" header
+		const char *next = std::min(line_end + 1, end);
+		std::vector<std::string> next_fields;
+
+		if ( is_integer(fields[0]) && is_integer(fields[1]) ) {
+			int n = atoi(fields[0].c_str());
+			int m = atoi(fields[1].c_str());
+
+			if ( split_line(next, std::find(next, end, '\n'), delim, next_fields) == m + 1 ) {
+				num_header_samples = n;
+				num_header_fields = m + 1;
+				s = line_end;
+			}
 		}
+	}
+
+	// split data into chunks at line boundaries
+	int num_chunks = omp_get_max_threads();
+	std::vector<const char *> bounds(num_chunks + 1);
+
+	bounds[0] = s;
+	bounds[num_chunks] = end;
+
+	for ( int c = 1; c < num_chunks; c++ ) {
+		const char *p = s + (end - s) * c / num_chunks;
+
+		bounds[c] = std::max(bounds[c - 1], std::min(std::find(p, end, '\n'), end));
+	}
 
-		// construct entry
-		std::string name = std::to_string(i);
+	// count the samples in each chunk
+	std::vector<int> offsets(num_chunks + 1, 0);
 
-		std::string label;
-		file >> label;
+	#pragma omp parallel for schedule(static, 1)
+	for ( int c = 0; c < num_chunks; c++ ) {
+		int count = 0;
+
+		for ( const char *p = bounds[c]; p < bounds[c + 1]; ) {
+			const char *q = skip_blanks(p, bounds[c + 1]);
+
+			if ( q < bounds[c + 1] && *q != '\n' ) {
+				count++;
+			}
+
+			p = std::find(q, bounds[c + 1], '\n') + 1;
+		}
+
+		offsets[c + 1] = count;
+	}
 
-		// append entry
+	// if the sample count does not match the legacy header,
+	// the first line is a sample
+	int total = std::accumulate(offsets.begin(), offsets.end(), 0);
+
+	if ( num_header_samples >= 0 && num_header_samples == total ) {
+		num_fields = num_header_fields;
+	}
+	else if ( num_header_samples >= 0 ) {
+		bounds[0] = first_line;
+		offsets[1]++;
+	}
+
+	_size = std::max(0, num_fields - 1);
+
+	for ( int c = 0; c < num_chunks; c++ ) {
+		offsets[c + 1] += offsets[c];
+	}
+
+	int num_samples = offsets[num_chunks];
+
+	// parse each chunk into the data matrix
+	_data = std::make_shared<Buffer<float>>((size_t)_size * num_samples);
+
+	std::vector<std::string> labels(num_samples);
+	std::vector<int> bad_lines(num_chunks, -1);
+
+	float *data = _data->host_data();
+
+	#pragma omp parallel for schedule(static, 1)
+	for ( int c = 0; c < num_chunks; c++ ) {
+		int i = offsets[c];
+
+		for ( const char *p = bounds[c]; p < bounds[c + 1] && i < num_samples; ) {
+			const char *q = skip_blanks(p, bounds[c + 1]);
+			const char *line_end = std::find(q, end, '\n');
+
+			p = line_end + 1;
+
+			if ( q == line_end || q == bounds[c + 1] ) {
+				continue;
+			}
+
+			// parse features
+			float *x = &data[(size_t)i * _size];
+			bool valid = true;
+
+			for ( int k = 0; k < _size && valid; k++ ) {
+				q = skip_blanks(q, line_end);
+				q = parse_float(q, line_end, x[k]);
+				valid = (q != nullptr);
+
+				if ( valid ) {
+					const char *r = skip_blanks(q, line_end);
+
+					valid = (delim == ' ')
+						? (r > q)
+						: (r < line_end && *r == delim);
+					q = r + (delim != ' ');
+				}
+			}
+
+			// parse label
+			if ( valid ) {
+				q = skip_blanks(q, line_end);
+
+				const char *label_end = find_field_end(q, line_end, delim);
+
+				while ( label_end > q && (*(label_end - 1) == ' ' || *(label_end - 1) == '\t' || *(label_end - 1) == '\r') ) {
+					label_end--;
+				}
+
+				if ( label_end - q >= 2 && *q == '"' && *(label_end - 1) == '"' ) {
+					labels[i].assign(q + 1, label_end - q - 2);
+				}
+				else {
+					labels[i].assign(q, label_end - q);
+				}
+
+				valid = (label_end > q && skip_blanks(label_end, line_end) == line_end);
+			}
+
+			if ( !valid && bad_lines[c] == -1 ) {
+				bad_lines[c] = i;
+			}
+
+			i++;
+		}
+	}
+
+	if ( length > 0 ) {
+		munmap(addr, length);
+	}
+
+	for ( int c = 0; c < num_chunks; c++ ) {
+		if ( bad_lines[c] != -1 ) {
+			Logger::log(LogLevel::Error, "error: cannot parse sample %d of \'%s\'\n", bad_lines[c], filename.c_str());
+			exit(1);
+		}
+	}
+
+	// construct entries
+	_entries.reserve(num_samples);
+
+	for ( int i = 0; i < num_samples; i++ ) {
 		_entries.push_back(DataEntry {
-			label,
-			name
+			std::move(labels[i]),
+			std::to_string(i)
 		});
 	}
 }
@@ -59,18 +519,45 @@ CSVIterator::CSVIterator(const std::string& filename)
 
 
 /**
- * Load a sample into a column of a data matrix.
+ * Load sample i into column j of a data matrix.
  *
  * @param X
  * @param i
+ * @param j
  */
-void CSVIterator::sample(Matrix& X, int i)
+void CSVIterator::sample(Matrix& X, int i, int j)
 {
 	assert(X.rows() == sample_size());
 
-	for ( int j = 0; j < X.rows(); j++ ) {
-		X.elem(j, i) = (float) _data[i * _size + j];
+	if ( _cache ) {
+		_cache->sample(X, i, j);
+		return;
+	}
+
+	memcpy(&X.elem(0, j), &_data->host_data()[(size_t)i * _size], _size * sizeof(float));
+}
+
+
+
+/**
+ * Construct a data matrix directly on the parsed data,
+ * without copying any samples. All views of a CSV iterator
+ * share the same memory with the iterator, so a view is
+ * read-only: a consumer which modifies a matrix in place
+ * must copy it first if Matrix::is_shared() is true.
+ *
+ * @param X
+ */
+bool CSVIterator::view(Matrix& X)
+{
+	if ( _cache ) {
+		return _cache->view(X);
 	}
+
+	X = Matrix(_size, num_samples(), _data);
+	X.gpu_write();
+
+	return true;
 }
 
 
@@ -7,7 +7,7 @@
 #define MLEARN_DATA_CSVITERATOR_H
 
 #include <memory>
-#include "mlearn/data/dataiterator.h"
+#include "mlearn/data/packediterator.h"
 
 
 
@@ -17,20 +17,23 @@ namespace mlearn {
 
 class CSVIterator : public DataIterator {
 public:
-	CSVIterator(const std::string& filename);
+	CSVIterator(const std::string& filename, bool use_cache=true);
 	~CSVIterator() {}
 
 	int num_samples() const { return _entries.size(); }
-	int sample_size() const { return _size; }
+	int sample_size() const { return _cache ? _cache->sample_size() : _size; }
 	const std::vector<DataEntry>& entries() const { return _entries; }
 
-	void sample(Matrix& X, int i);
+	using DataIterator::sample;
+	void sample(Matrix& X, int i, int j);
+	bool view(Matrix& X);
 
 private:
 	std::vector<DataEntry> _entries;
+	std::unique_ptr<PackedIterator> _cache;
 
 	int _size;
-	std::unique_ptr<float[]> _data;
+	std::shared_ptr<Buffer<float>> _data;
 };
 
 
@@ -31,7 +31,12 @@ public:
 	virtual int sample_size() const = 0;
 	virtual const std::vector<DataEntry>& entries() const = 0;
 
-	virtual void sample(Matrix& X, int i) = 0;
+	// sample() must allow concurrent calls for different columns
+	void sample(Matrix& X, int i) { sample(X, i, i); }
+	virtual void sample(Matrix& X, int i, int j) = 0;
+
+	// view() shares the data with the iterator, so a view is read-only
+	virtual bool view(Matrix& X) { return false; }
 };
 
 
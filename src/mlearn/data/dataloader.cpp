@@ -0,0 +1,266 @@
+/**
+ * @file data/dataloader.cpp
+ *
+ * Implementation of the parallel data loader.
+ *
+ * The data loader keeps a pool of worker threads which
+ * load samples from a data iterator directly into their
+ * target columns of a data matrix. Each request to load a
+ * set of samples is a job, and the samples of the oldest
+ * job are loaded first, so that the workers keep many reads
+ * in flight while the jobs complete in order. The number of
+ * pending jobs is bounded, so that a consumer which loads
+ * the next chunk while processing the current chunk never
+ * runs more than a fixed number of chunks ahead.
+ */
+#include <algorithm>
+#include "mlearn/data/dataloader.h"
+
+
+
+namespace mlearn {
+
+
+
+/**
+ * Construct a data loader.
+ *
+ * The data iterator must allow sample() to be called
+ * concurrently for different columns.
+ *
+ * @param iter
+ * @param num_workers
+ * @param max_pending
+ */
+DataLoader::DataLoader(DataIterator *iter, int num_workers, int max_pending):
+	_iter(iter),
+	_max_pending(std::max(1, max_pending))
+{
+	if ( num_workers <= 0 )
+	{
+		num_workers = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	for ( int i = 0; i < num_workers; i++ )
+	{
+		_workers.emplace_back(&DataLoader::work, this);
+	}
+}
+
+
+
+/**
+ * Destruct a data loader after all pending jobs
+ * are complete.
+ */
+DataLoader::~DataLoader()
+{
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+
+		_job_done.wait(lock, [this] { return _jobs.empty(); });
+		_running = false;
+	}
+
+	_job_ready.notify_all();
+
+	for ( auto& worker : _workers )
+	{
+		worker.join();
+	}
+}
+
+
+
+/**
+ * Load a range of samples into the first columns of a
+ * data matrix, and wait for them to be loaded.
+ *
+ * @param X
+ * @param begin
+ * @param end
+ */
+void DataLoader::load(Matrix& X, int begin, int end)
+{
+	load_async(X, begin, end).get();
+}
+
+
+
+/**
+ * Load a set of samples into the first columns of a
+ * data matrix, and wait for them to be loaded.
+ *
+ * @param X
+ * @param indices
+ */
+void DataLoader::load(Matrix& X, const std::vector<int>& indices)
+{
+	load_async(X, indices).get();
+}
+
+
+
+/**
+ * Start loading a range of samples into the first
+ * columns of a data matrix.
+ *
+ * @param X
+ * @param begin
+ * @param end
+ */
+std::future<void> DataLoader::load_async(Matrix& X, int begin, int end)
+{
+	std::vector<int> indices(end - begin);
+
+	for ( int i = begin; i < end; i++ )
+	{
+		indices[i - begin] = i;
+	}
+
+	return load_async(X, indices);
+}
+
+
+
+/**
+ * Start loading a set of samples into the first columns
+ * of a data matrix. The future is ready when the samples
+ * have been loaded and written to the GPU. If the maximum
+ * number of jobs are pending, this function waits for the
+ * oldest job to complete.
+ *
+ * @param X
+ * @param indices
+ */
+std::future<void> DataLoader::load_async(Matrix& X, const std::vector<int>& indices)
+{
+	std::unique_ptr<load_job_t> job(new load_job_t);
+
+	job->X = &X;
+	job->indices = indices;
+	job->grain = std::max(1, std::min(16, (int)indices.size() / (4 * num_workers())));
+	job->next = 0;
+	job->remaining = indices.size();
+
+	std::future<void> done = job->done.get_future();
+
+	if ( indices.empty() )
+	{
+		X.gpu_write();
+		job->done.set_value();
+		return done;
+	}
+
+	// wait for space in the job queue
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+
+		_job_done.wait(lock, [this] { return (int)_jobs.size() < _max_pending; });
+		_jobs.push_back(std::move(job));
+	}
+
+	_job_ready.notify_all();
+
+	return done;
+}
+
+
+
+/**
+ * Load samples from pending jobs until the data loader
+ * is destroyed.
+ */
+void DataLoader::work()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	while ( true )
+	{
+		// find the oldest job with unclaimed samples
+		load_job_t *job = nullptr;
+
+		_job_ready.wait(lock, [this, &job] {
+			for ( auto& j : _jobs )
+			{
+				if ( j->next < (int)j->indices.size() )
+				{
+					job = j.get();
+					return true;
+				}
+			}
+
+			return !_running;
+		});
+
+		if ( job == nullptr )
+		{
+			break;
+		}
+
+		// claim a block of samples
+		int begin = job->next;
+		int end = std::min(begin + job->grain, (int)job->indices.size());
+
+		job->next = end;
+
+		// load samples without holding the lock
+		lock.unlock();
+
+		std::exception_ptr error;
+
+		try
+		{
+			for ( int k = begin; k < end; k++ )
+			{
+				_iter->sample(*job->X, job->indices[k], k);
+			}
+		}
+		catch ( ... )
+		{
+			error = std::current_exception();
+		}
+
+		lock.lock();
+
+		if ( error && !job->error )
+		{
+			job->error = error;
+		}
+
+		job->remaining -= (end - begin);
+
+		if ( job->remaining > 0 )
+		{
+			continue;
+		}
+
+		// complete the job
+		auto it = std::find_if(_jobs.begin(), _jobs.end(), [job] (const std::unique_ptr<load_job_t>& j) {
+			return j.get() == job;
+		});
+
+		std::unique_ptr<load_job_t> finished(std::move(*it));
+		_jobs.erase(it);
+
+		lock.unlock();
+
+		if ( finished->error )
+		{
+			finished->done.set_exception(finished->error);
+		}
+		else
+		{
+			finished->X->gpu_write();
+			finished->done.set_value();
+		}
+
+		_job_done.notify_all();
+
+		lock.lock();
+	}
+}
+
+
+
+}
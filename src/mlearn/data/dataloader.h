@@ -0,0 +1,65 @@
+/**
+ * @file data/dataloader.h
+ *
+ * Interface definitions for the parallel data loader.
+ */
+#ifndef MLEARN_DATA_DATALOADER_H
+#define MLEARN_DATA_DATALOADER_H
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "mlearn/data/dataiterator.h"
+
+
+
+namespace mlearn {
+
+
+
+typedef struct {
+	Matrix *X;
+	std::vector<int> indices;
+	int grain;
+	int next;
+	int remaining;
+	std::promise<void> done;
+	std::exception_ptr error;
+} load_job_t;
+
+
+
+class DataLoader {
+public:
+	DataLoader(DataIterator *iter, int num_workers=0, int max_pending=2);
+	~DataLoader();
+
+	int num_workers() const { return _workers.size(); }
+
+	void load(Matrix& X, int begin, int end);
+	void load(Matrix& X, const std::vector<int>& indices);
+	std::future<void> load_async(Matrix& X, int begin, int end);
+	std::future<void> load_async(Matrix& X, const std::vector<int>& indices);
+
+private:
+	void work();
+
+	DataIterator *_iter;
+	int _max_pending;
+	std::vector<std::thread> _workers;
+
+	std::mutex _mutex;
+	std::condition_variable _job_ready;
+	std::condition_variable _job_done;
+	std::deque<std::unique_ptr<load_job_t>> _jobs;
+	bool _running {true};
+};
+
+
+
+}
+
+#endif
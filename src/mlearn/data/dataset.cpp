@@ -3,6 +3,10 @@
  *
  * Implementation of the dataset type.
  */
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include "mlearn/data/dataloader.h"
 #include "mlearn/data/dataset.h"
 #include "mlearn/math/random.h"
 #include "mlearn/util/logger.h"
@@ -31,44 +35,196 @@ IODevice& operator>>(IODevice& file, DataEntry& entry)
 
 
 
+/**
+ * Group the sample indices of a dataset by class label.
+ *
+ * @param y
+ */
+std::vector<std::vector<int>> Dataset::group_by_class(const std::vector<int>& y)
+{
+	int c = (y.size() > 0)
+		? *std::max_element(y.begin(), y.end()) + 1
+		: 0;
+
+	std::vector<std::vector<int>> classes(c);
+
+	for ( size_t i = 0; i < y.size(); i++ )
+	{
+		classes[y[i]].push_back(i);
+	}
+
+	return classes;
+}
+
+
+
+/**
+ * Split a dataset into a train set and a test set by
+ * sample indices, without copying any data. If stratify
+ * is true, each class is split in the same proportion,
+ * so that the class balance of both sets matches the
+ * class balance of the dataset.
+ *
+ * @param y
+ * @param test_size
+ * @param stratify
+ * @param train_indices
+ * @param test_indices
+ */
 void Dataset::train_test_split(
-	const Matrix& X, const std::vector<int>& y,
+	const std::vector<int>& y,
 	float test_size,
-	Matrix& X_train, std::vector<int>& y_train,
-	Matrix& X_test, std::vector<int>& y_test)
+	bool stratify,
+	std::vector<int>& train_indices,
+	std::vector<int>& test_indices)
 {
-	// generate a random shuffle
-	std::vector<int> indices(X.cols());
+	int N = y.size();
+	int num_train = N * (1 - test_size);
+	int num_test = N - num_train;
+
+	train_indices.clear();
+	test_indices.clear();
 
-	for ( int i = 0; i < X.cols(); i++ )
+	if ( !stratify )
 	{
-		indices[i] = i;
+		// generate a random shuffle
+		std::vector<int> indices(N);
+
+		for ( int i = 0; i < N; i++ )
+		{
+			indices[i] = i;
+		}
+
+		Random::shuffle(indices);
+
+		train_indices.assign(indices.begin(), indices.begin() + num_train);
+		test_indices.assign(indices.begin() + num_train, indices.end());
+		return;
 	}
 
-	Random::shuffle(indices);
+	// group samples by class
+	std::vector<std::vector<int>> classes = group_by_class(y);
+	int c = classes.size();
+
+	// allocate test samples to each class by largest remainder
+	std::vector<int> quotas(c);
+	std::vector<std::pair<float, int>> remainders(c);
+	int num_allocated = 0;
 
-	// create train set and test set
-	int num_train = X.cols() * (1 - test_size);
-	int num_test = X.cols() - num_train;
+	for ( int k = 0; k < c; k++ )
+	{
+		float quota = (float) classes[k].size() * num_test / N;
+
+		quotas[k] = (int) quota;
+		remainders[k] = std::make_pair(quota - quotas[k], k);
+		num_allocated += quotas[k];
+	}
 
-	X_train = Matrix(X.rows(), num_train);
-	y_train = std::vector<int>(num_train);
-	X_test = Matrix(X.rows(), num_test);
-	y_test = std::vector<int>(num_test);
+	std::sort(remainders.begin(), remainders.end(), std::greater<std::pair<float, int>>());
 
-	for ( int i = 0; i < num_train; i++ )
+	for ( int k = 0; k < num_test - num_allocated; k++ )
 	{
-		X_train.assign_column(i, X, indices[i]);
-		y_train[i] = y[indices[i]];
+		quotas[remainders[k].second]++;
 	}
 
-	for ( int i = num_train; i < X.cols(); i++ )
+	// split each class
+	for ( int k = 0; k < c; k++ )
 	{
-		int j = i - num_train;
+		Random::shuffle(classes[k]);
 
-		X_test.assign_column(j, X, indices[i]);
-		y_test[j] = y[indices[i]];
+		test_indices.insert(test_indices.end(), classes[k].begin(), classes[k].begin() + quotas[k]);
+		train_indices.insert(train_indices.end(), classes[k].begin() + quotas[k], classes[k].end());
 	}
+
+	Random::shuffle(train_indices);
+	Random::shuffle(test_indices);
+}
+
+
+
+/**
+ * Split a data matrix into a train set and a test set.
+ *
+ * @param X
+ * @param y
+ * @param test_size
+ * @param X_train
+ * @param y_train
+ * @param X_test
+ * @param y_test
+ * @param stratify
+ */
+void Dataset::train_test_split(
+	const Matrix& X, const std::vector<int>& y,
+	float test_size,
+	Matrix& X_train, std::vector<int>& y_train,
+	Matrix& X_test, std::vector<int>& y_test,
+	bool stratify)
+{
+	std::vector<int> train_indices;
+	std::vector<int> test_indices;
+
+	train_test_split(y, test_size, stratify, train_indices, test_indices);
+
+	gather(X, train_indices, X_train);
+	gather(X, test_indices, X_test);
+
+	y_train = gather(y, train_indices);
+	y_test = gather(y, test_indices);
+}
+
+
+
+/**
+ * Gather a set of columns from a data matrix. The output
+ * matrix is reused if it already has the right size, so
+ * that the same buffer can hold each fold of a dataset.
+ * If the output matrix is the input matrix or shares its
+ * memory, such as a view of a dataset, a new matrix is
+ * allocated instead, so that the gather never overwrites
+ * its own input or the memory of another matrix.
+ *
+ * @param X
+ * @param indices
+ * @param X_out
+ */
+void Dataset::gather(const Matrix& X, const std::vector<int>& indices, Matrix& X_out)
+{
+	int n = indices.size();
+	bool reuse = (X_out.rows() == X.rows() && X_out.cols() == n && &X_out != &X && !X_out.is_shared());
+
+	Matrix Y = reuse
+		? std::move(X_out)
+		: Matrix(X.rows(), n);
+
+	for ( int j = 0; j < n; j++ )
+	{
+		memcpy(&Y.elem(0, j), &X.elem(0, indices[j]), X.rows() * sizeof(float));
+	}
+
+	Y.gpu_write();
+
+	X_out = std::move(Y);
+}
+
+
+
+/**
+ * Gather a set of labels.
+ *
+ * @param y
+ * @param indices
+ */
+std::vector<int> Dataset::gather(const std::vector<int>& y, const std::vector<int>& indices)
+{
+	std::vector<int> y_out(indices.size());
+
+	for ( size_t j = 0; j < indices.size(); j++ )
+	{
+		y_out[j] = y[indices[j]];
+	}
+
+	return y_out;
 }
 
 
@@ -108,18 +264,32 @@ Dataset::Dataset(DataIterator *iter)
 /**
  * Load the data matrix X for a dataset, where each column
  * in X is a sample. Each sample must have the same size.
+ *
+ * If the data iterator can provide the entire data matrix
+ * as a view, such as a memory-mapped packed dataset, the
+ * view is returned without copying any samples. A view is
+ * shared with the iterator and must not be modified in
+ * place (see Matrix::is_shared()). Otherwise the samples
+ * are loaded in parallel.
  */
 Matrix Dataset::load_data() const
 {
+	// use a view of the data if possible
+	Matrix X;
+
+	if ( _iter->view(X) ) {
+		return X;
+	}
+
 	// construct data matrix
 	int m = _iter->sample_size();
 	int n = _iter->num_samples();
-	Matrix X = Matrix(m, n);
+	X = Matrix(m, n);
 
 	// map each sample to a column in X
-	for ( int i = 0; i < n; i++ ) {
-		_iter->sample(X, i);
-	}
+	DataLoader loader(_iter);
+
+	loader.load(X, 0, n);
 
 	return X;
 }
@@ -21,16 +21,28 @@ namespace mlearn {
 
 class Dataset {
 public:
+	static void train_test_split(
+		const std::vector<int>& y,
+		float test_size,
+		bool stratify,
+		std::vector<int>& train_indices,
+		std::vector<int>& test_indices
+	);
 	static void train_test_split(
 		const Matrix& X, const std::vector<int>& y,
 		float test_size,
 		Matrix& X_train, std::vector<int>& y_train,
-		Matrix& X_test, std::vector<int>& y_test
+		Matrix& X_test, std::vector<int>& y_test,
+		bool stratify=false
 	);
+	static std::vector<std::vector<int>> group_by_class(const std::vector<int>& y);
+	static void gather(const Matrix& X, const std::vector<int>& indices, Matrix& X_out);
+	static std::vector<int> gather(const std::vector<int>& y, const std::vector<int>& indices);
 
 	Dataset(DataIterator *iter);
 	Dataset() {}
 
+	DataIterator * iterator() const { return _iter; }
 	const std::string& path() const { return _path; }
 	const std::vector<std::string>& classes() const { return _classes; }
 	const std::vector<DataEntry>& entries() const { return _entries; }
@@ -43,7 +55,7 @@ public:
 	friend IODevice& operator>>(IODevice& file, Dataset& dataset);
 
 private:
-	DataIterator *_iter;
+	DataIterator *_iter {nullptr};
 	std::string _path;
 	std::vector<std::string> _classes;
 	std::vector<DataEntry> _entries;
@@ -31,13 +31,28 @@ namespace mlearn {
  * file without separate label data, and to group the
  * entries by label.
  *
+ * If the directory has a packed cache which is up to date
+ * with the files, the samples are loaded from the cache
+ * instead of the files, unless use_cache is false.
+ *
  * @param path
+ * @param use_cache
  */
-GenomeIterator::GenomeIterator(const std::string& path)
+GenomeIterator::GenomeIterator(const std::string& path, bool use_cache)
 {
-	// get list of files
 	_path = path;
 
+	// use packed cache if it is up to date
+	if ( use_cache ) {
+		_cache = PackedIterator::open_cache(path);
+	}
+
+	if ( _cache ) {
+		_entries = _cache->entries();
+		return;
+	}
+
+	// get list of files
 	Directory dir(path);
 
 	// construct entries
@@ -54,66 +69,74 @@ GenomeIterator::GenomeIterator(const std::string& path)
 		});
 	}
 
-	_num_genes = 0;
-	_genes.reset();
+	// determine sample size from the first sample
+	std::ifstream file(_path + "/" + _entries[0].name, std::ifstream::in | std::ifstream::binary);
 
-	// load first sample to get size
-	load(0);
+	_num_genes = read_size(file);
 }
 
 
 
 /**
- * Load a sample into a column of a data matrix.
+ * Load sample i into column j of a data matrix. The genome
+ * data is read directly into the column, so this function
+ * can be called concurrently for different columns.
  *
  * @param X
  * @param i
+ * @param j
  */
-void GenomeIterator::sample(Matrix& X, int i)
+void GenomeIterator::sample(Matrix& X, int i, int j)
 {
 	assert(X.rows() == sample_size());
 
-	load(i);
-
-	for ( int j = 0; j < X.rows(); j++ ) {
-		X.elem(j, i) = (float) _genes[j];
+	if ( _cache ) {
+		_cache->sample(X, i, j);
+		return;
 	}
+
+	load(i, &X.elem(0, j));
 }
 
 
 
 /**
- * Load a genome sample from a binary file.
+ * Determine the number of genes in a genome file.
  *
- * @param i
+ * @param file
  */
-void GenomeIterator::load(int i)
+int GenomeIterator::read_size(std::ifstream& file)
 {
-	// open file
-	std::string path = _path + "/" + _entries[i].name;
-	std::ifstream file(path, std::ifstream::in);
-
-	// determine the size of the genome sample
 	std::streampos fsize = file.tellg();
 	file.seekg(0, std::ios::end);
 	fsize = file.tellg() - fsize;
 	file.seekg(0);
 
-	// verify that the genome sizes are equal (if reloading)
-	int num = (int)fsize / sizeof(float);
+	return (int)fsize / sizeof(float);
+}
 
-	if ( _genes == nullptr ) {
-		_genes.reset(new float[num]);
-	}
-	else if ( num != sample_size() ) {
+
+
+/**
+ * Load a genome sample from a binary file.
+ *
+ * @param i
+ * @param genes
+ */
+void GenomeIterator::load(int i, float *genes) const
+{
+	// open file
+	std::string path = _path + "/" + _entries[i].name;
+	std::ifstream file(path, std::ifstream::in | std::ifstream::binary);
+
+	// verify that the genome sizes are equal
+	if ( read_size(file) != sample_size() ) {
 		Logger::log(LogLevel::Error, "error: genome \'%s\' has unequal size\n", path.c_str());
 		exit(1);
 	}
 
-	_num_genes = num;
-
 	// read genome data
-	file.read(reinterpret_cast<char *>(_genes.get()), _num_genes * sizeof(float));
+	file.read(reinterpret_cast<char *>(genes), _num_genes * sizeof(float));
 
 	file.close();
 }
@@ -6,8 +6,9 @@
 #ifndef MLEARN_DATA_GENOMEITERATOR_H
 #define MLEARN_DATA_GENOMEITERATOR_H
 
+#include <fstream>
 #include <memory>
-#include "mlearn/data/dataiterator.h"
+#include "mlearn/data/packediterator.h"
 
 
 
@@ -17,23 +18,26 @@ namespace mlearn {
 
 class GenomeIterator : public DataIterator {
 public:
-	GenomeIterator(const std::string& path);
+	GenomeIterator(const std::string& path, bool use_cache=true);
 	~GenomeIterator() {}
 
 	int num_samples() const { return _entries.size(); }
-	int sample_size() const { return _num_genes; }
+	int sample_size() const { return _cache ? _cache->sample_size() : _num_genes; }
 	const std::vector<DataEntry>& entries() const { return _entries; }
 
-	void sample(Matrix& X, int i);
+	using DataIterator::sample;
+	void sample(Matrix& X, int i, int j);
+	bool view(Matrix& X) { return _cache && _cache->view(X); }
 
 private:
-	void load(int i);
+	static int read_size(std::ifstream& file);
+	void load(int i, float *genes) const;
 
 	std::string _path;
 	std::vector<DataEntry> _entries;
+	std::unique_ptr<PackedIterator> _cache;
 
 	int _num_genes;
-	std::unique_ptr<float[]> _genes;
 };
 
 
@@ -33,13 +33,30 @@ namespace mlearn {
  * file without separate label data, and to group the
  * entries by label.
  *
+ * If the directory has a packed cache which is up to date
+ * with the files, the samples are loaded from the cache
+ * instead of the files, unless use_cache is false.
+ * A uint8 cache is accepted, since it can only be packed
+ * from integer-valued data such as 8-bit images.
+ *
  * @param path
+ * @param use_cache
  */
-ImageIterator::ImageIterator(const std::string& path)
+ImageIterator::ImageIterator(const std::string& path, bool use_cache)
 {
-	// get list of files
 	_path = path;
 
+	// use packed cache if it is up to date
+	if ( use_cache ) {
+		_cache = PackedIterator::open_cache(path, true);
+	}
+
+	if ( _cache ) {
+		_entries = _cache->entries();
+		return;
+	}
+
+	// get list of files
 	Directory dir(path);
 
 	// construct entries
@@ -56,32 +73,43 @@ ImageIterator::ImageIterator(const std::string& path)
 		});
 	}
 
-	_channels = 0;
-	_width = 0;
-	_height = 0;
-	_max_value = 0;
-	_pixels.reset();
+	// determine sample size from the first sample
+	std::string filename = _path + "/" + _entries[0].name;
+	std::ifstream file(filename, std::ifstream::in | std::ifstream::binary);
 
-	// load first sample to get size
-	load(0);
+	if ( !read_header(file, _channels, _width, _height, _max_value) ) {
+		Logger::log(LogLevel::Error, "error: cannot read image \'%s\'\n", filename.c_str());
+		exit(1);
+	}
 }
 
 
 
 /**
- * Load a sample into a column of a data matrix.
+ * Load sample i into column j of a data matrix. Each
+ * thread decodes images into its own buffer, so this
+ * function can be called concurrently for different
+ * columns.
  *
  * @param X
  * @param i
+ * @param j
  */
-void ImageIterator::sample(Matrix& X, int i)
+void ImageIterator::sample(Matrix& X, int i, int j)
 {
 	assert(X.rows() == sample_size());
 
-	load(i);
+	if ( _cache ) {
+		_cache->sample(X, i, j);
+		return;
+	}
+
+	static thread_local std::vector<unsigned char> pixels;
+
+	load(i, pixels);
 
-	for ( int j = 0; j < X.rows(); j++ ) {
-		X.elem(j, i) = (float) _pixels[j];
+	for ( int k = 0; k < X.rows(); k++ ) {
+		X.elem(k, j) = (float) pixels[k];
 	}
 }
 
@@ -114,23 +142,22 @@ void skip_to_next_value(std::ifstream& file)
 
 
 /**
- * Load an image from a PGM/PPM file.
+ * Read the header of a PGM/PPM image, leaving the file
+ * at the start of the pixel data.
  *
- * @param i
+ * @param file
+ * @param channels
+ * @param width
+ * @param height
+ * @param max_value
  */
-void ImageIterator::load(int i)
+bool ImageIterator::read_header(std::ifstream& file, int& channels, int& width, int& height, int& max_value)
 {
-	// open file
-	std::string path = _path + "/" + _entries[i].name;
-	std::ifstream file(path, std::ifstream::in);
-
 	// read image header
 	std::string header;
 	file >> header;
 
 	// determine image channels
-	int channels;
-
 	if ( header == "P5" ) {
 		channels = 1;
 	}
@@ -138,17 +165,12 @@ void ImageIterator::load(int i)
 		channels = 3;
 	}
 	else {
-		Logger::log(LogLevel::Error, "error: cannot read image \'%s\'\n", path.c_str());
-		exit(1);
+		return false;
 	}
 
 	skip_to_next_value(file);
 
 	// read image metadata
-	int width;
-	int height;
-	int max_value;
-
 	file >> width;
 	skip_to_next_value(file);
 
@@ -158,24 +180,46 @@ void ImageIterator::load(int i)
 	file >> max_value;
 	file.get();
 
-	// verify that image sizes are equal (if reloading)
-	int num = channels * width * height;
+	return !file.fail();
+}
+
+
+
+/**
+ * Load an image from a PGM/PPM file.
+ *
+ * @param i
+ * @param pixels
+ */
+void ImageIterator::load(int i, std::vector<unsigned char>& pixels) const
+{
+	// open file
+	std::string path = _path + "/" + _entries[i].name;
+	std::ifstream file(path, std::ifstream::in | std::ifstream::binary);
 
-	if ( _pixels == nullptr ) {
-		_pixels.reset(new unsigned char[num]);
+	// read image header
+	int channels;
+	int width;
+	int height;
+	int max_value;
+
+	if ( !read_header(file, channels, width, height, max_value) ) {
+		Logger::log(LogLevel::Error, "error: cannot read image \'%s\'\n", path.c_str());
+		exit(1);
 	}
-	else if ( num != sample_size() ) {
+
+	// verify that image sizes are equal
+	int num = channels * width * height;
+
+	if ( num != sample_size() ) {
 		Logger::log(LogLevel::Error, "error: image \'%s\' has unequal size\n", path.c_str());
 		exit(1);
 	}
 
-	_channels = channels;
-	_width = width;
-	_height = height;
-	_max_value = max_value;
-
 	// read pixel data
-	file.read(reinterpret_cast<char *>(_pixels.get()), num);
+	pixels.resize(num);
+
+	file.read(reinterpret_cast<char *>(pixels.data()), num);
 
 	file.close();
 }
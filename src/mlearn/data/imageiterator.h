@@ -6,8 +6,9 @@
 #ifndef MLEARN_DATA_IMAGEITERATOR_H
 #define MLEARN_DATA_IMAGEITERATOR_H
 
+#include <fstream>
 #include <memory>
-#include "mlearn/data/dataiterator.h"
+#include "mlearn/data/packediterator.h"
 
 
 
@@ -17,26 +18,29 @@ namespace mlearn {
 
 class ImageIterator : public DataIterator {
 public:
-	ImageIterator(const std::string& path);
+	ImageIterator(const std::string& path, bool use_cache=true);
 	~ImageIterator() {}
 
 	int num_samples() const { return _entries.size(); }
-	int sample_size() const { return _channels * _width * _height; }
+	int sample_size() const { return _cache ? _cache->sample_size() : _channels * _width * _height; }
 	const std::vector<DataEntry>& entries() const { return _entries; }
 
-	void sample(Matrix& X, int i);
+	using DataIterator::sample;
+	void sample(Matrix& X, int i, int j);
+	bool view(Matrix& X) { return _cache && _cache->view(X); }
 
 private:
-	void load(int i);
+	static bool read_header(std::ifstream& file, int& channels, int& width, int& height, int& max_value);
+	void load(int i, std::vector<unsigned char>& pixels) const;
 
 	std::string _path;
 	std::vector<DataEntry> _entries;
+	std::unique_ptr<PackedIterator> _cache;
 
 	int _channels;
 	int _width;
 	int _height;
 	int _max_value;
-	std::unique_ptr<unsigned char[]> _pixels;
 };
 
 
@@ -0,0 +1,178 @@
+/**
+ * @file data/kfold.cpp
+ *
+ * Implementation of the k-fold cross-validators.
+ *
+ * A cross-validator only partitions the sample indices of
+ * a dataset into folds. The train and test sets of each fold
+ * can be gathered from a data matrix with Dataset::gather(),
+ * which reuses the same buffers for every fold, or loaded
+ * from a data iterator with a data loader, so that the data
+ * is never copied for each fold as a whole.
+ */
+#include <algorithm>
+#include "mlearn/data/dataset.h"
+#include "mlearn/data/kfold.h"
+#include "mlearn/math/random.h"
+#include "mlearn/util/error.h"
+
+
+
+namespace mlearn {
+
+
+
+/**
+ * Construct a k-fold cross-validator.
+ *
+ * @param n_splits
+ * @param shuffle
+ */
+KFold::KFold(int n_splits, bool shuffle):
+	_n_splits(n_splits),
+	_shuffle(shuffle)
+{
+	CHECK_ERROR(n_splits >= 2, "Number of splits must be at least 2");
+}
+
+
+
+/**
+ * Split a dataset into k consecutive folds, optionally
+ * after shuffling. Each fold is used once as the test set
+ * while the remaining folds form the train set. The first
+ * N % k folds have one more sample than the others.
+ *
+ * @param y
+ */
+std::vector<fold_t> KFold::split(const std::vector<int>& y) const
+{
+	int N = y.size();
+
+	CHECK_ERROR(_n_splits <= N, "Number of splits must not exceed number of samples");
+
+	std::vector<int> order(N);
+
+	for ( int i = 0; i < N; i++ )
+	{
+		order[i] = i;
+	}
+
+	if ( _shuffle )
+	{
+		Random::shuffle(order);
+	}
+
+	// assign each sample to a fold in contiguous blocks
+	std::vector<int> folds(N);
+	int i = 0;
+
+	for ( int k = 0; k < _n_splits; k++ )
+	{
+		int fold_size = N / _n_splits + (k < N % _n_splits);
+
+		for ( int t = 0; t < fold_size; t++, i++ )
+		{
+			folds[order[i]] = k;
+		}
+	}
+
+	return make_folds(folds, N);
+}
+
+
+
+/**
+ * Construct the train and test indices of each fold from
+ * the fold assignment of each sample. The indices of each
+ * set are sorted, so that gathering a fold reads the data
+ * in order.
+ *
+ * @param folds
+ * @param N
+ */
+std::vector<fold_t> KFold::make_folds(const std::vector<int>& folds, int N) const
+{
+	std::vector<fold_t> result(_n_splits);
+
+	for ( int k = 0; k < _n_splits; k++ )
+	{
+		int num_test = std::count(folds.begin(), folds.end(), k);
+
+		result[k].train.reserve(N - num_test);
+		result[k].test.reserve(num_test);
+	}
+
+	for ( int i = 0; i < N; i++ )
+	{
+		for ( int k = 0; k < _n_splits; k++ )
+		{
+			if ( folds[i] == k )
+			{
+				result[k].test.push_back(i);
+			}
+			else
+			{
+				result[k].train.push_back(i);
+			}
+		}
+	}
+
+	return result;
+}
+
+
+
+/**
+ * Construct a stratified k-fold cross-validator.
+ *
+ * @param n_splits
+ * @param shuffle
+ */
+StratifiedKFold::StratifiedKFold(int n_splits, bool shuffle):
+	KFold(n_splits, shuffle)
+{
+}
+
+
+
+/**
+ * Split a dataset into k folds which preserve the class
+ * balance of the dataset. The samples of each class are
+ * dealt to the folds in turn, continuing from one class to
+ * the next, so that the number of samples of each class
+ * differs by at most one between folds and the fold sizes
+ * differ by at most one overall.
+ *
+ * @param y
+ */
+std::vector<fold_t> StratifiedKFold::split(const std::vector<int>& y) const
+{
+	int N = y.size();
+
+	CHECK_ERROR(_n_splits <= N, "Number of splits must not exceed number of samples");
+
+	std::vector<std::vector<int>> classes = Dataset::group_by_class(y);
+	std::vector<int> folds(N);
+	int t = 0;
+
+	for ( auto& indices : classes )
+	{
+		if ( _shuffle )
+		{
+			Random::shuffle(indices);
+		}
+
+		for ( int i : indices )
+		{
+			folds[i] = t % _n_splits;
+			t++;
+		}
+	}
+
+	return make_folds(folds, N);
+}
+
+
+
+}
@@ -0,0 +1,55 @@
+/**
+ * @file data/kfold.h
+ *
+ * Interface definitions for the k-fold cross-validators.
+ */
+#ifndef MLEARN_DATA_KFOLD_H
+#define MLEARN_DATA_KFOLD_H
+
+#include <vector>
+
+
+
+namespace mlearn {
+
+
+
+typedef struct {
+	std::vector<int> train;
+	std::vector<int> test;
+} fold_t;
+
+
+
+class KFold {
+public:
+	KFold(int n_splits=5, bool shuffle=false);
+	virtual ~KFold() {}
+
+	int n_splits() const { return _n_splits; }
+
+	virtual KFold * clone() const { return new KFold(*this); }
+	virtual std::vector<fold_t> split(const std::vector<int>& y) const;
+
+protected:
+	std::vector<fold_t> make_folds(const std::vector<int>& folds, int N) const;
+
+	int _n_splits;
+	bool _shuffle;
+};
+
+
+
+class StratifiedKFold : public KFold {
+public:
+	StratifiedKFold(int n_splits=5, bool shuffle=false);
+
+	KFold * clone() const { return new StratifiedKFold(*this); }
+	std::vector<fold_t> split(const std::vector<int>& y) const;
+};
+
+
+
+}
+
+#endif
@@ -0,0 +1,424 @@
+/**
+ * @file data/packediterator.cpp
+ *
+ * Implementation of the packed dataset iterator.
+ *
+ * A packed dataset is a single binary file with the
+ * following layout:
+ * - header: magic, version, data type, sample size, number of samples,
+ *   modification time and size of the source
+ * - class table, label of each sample, name of each sample
+ * - padding to a 64-byte boundary
+ * - data block: samples in column-major order, as float32 or uint8
+ *
+ * The file is memory-mapped rather than read, so loading
+ * a packed dataset only touches the pages that are used,
+ * and the pages are shared by all processes which load the
+ * same dataset.
+ */
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mlearn/data/dataset.h"
+#include "mlearn/data/directory.h"
+#include "mlearn/data/packediterator.h"
+#include "mlearn/util/error.h"
+#include "mlearn/util/logger.h"
+
+
+
+namespace mlearn {
+
+
+
+const int PACKED_MAGIC = 0x4b41504d;
+const int PACKED_VERSION = 2;
+const size_t PACKED_ALIGNMENT = 64;
+
+
+
+/**
+ * Round an offset up to the alignment of the data block.
+ *
+ * @param offset
+ */
+inline size_t align_offset(size_t offset)
+{
+	return (offset + PACKED_ALIGNMENT - 1) / PACKED_ALIGNMENT * PACKED_ALIGNMENT;
+}
+
+
+
+/**
+ * Get the modification time and total size of a data
+ * source. For a directory, the latest modification time of
+ * the directory and of each file in it is used, so that
+ * adding, removing or rewriting any file changes the stamp.
+ *
+ * @param path
+ * @param stamp
+ */
+bool get_source_stamp(const std::string& path, packed_stamp_t& stamp)
+{
+	struct stat st;
+
+	if ( stat(path.c_str(), &st) != 0 ) {
+		return false;
+	}
+
+	stamp.mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+	stamp.size = S_ISDIR(st.st_mode) ? 0 : st.st_size;
+
+	if ( !S_ISDIR(st.st_mode) ) {
+		return true;
+	}
+
+	Directory dir(path);
+
+	for ( const std::string& name : dir.entries() ) {
+		if ( stat((path + "/" + name).c_str(), &st) != 0 ) {
+			return false;
+		}
+
+		long long mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+
+		stamp.mtime = std::max(stamp.mtime, mtime);
+		stamp.size += st.st_size;
+	}
+
+	return true;
+}
+
+
+
+void write_stamp(IODevice& file, const packed_stamp_t& stamp)
+{
+	file.write(reinterpret_cast<const char *>(&stamp.mtime), sizeof(long long));
+	file.write(reinterpret_cast<const char *>(&stamp.size), sizeof(long long));
+}
+
+
+
+void read_stamp(IODevice& file, packed_stamp_t& stamp)
+{
+	file.read(reinterpret_cast<char *>(&stamp.mtime), sizeof(long long));
+	file.read(reinterpret_cast<char *>(&stamp.size), sizeof(long long));
+}
+
+
+
+/**
+ * Save the samples of a data iterator to a packed dataset.
+ *
+ * When the data type is uint8, each feature must be an
+ * integer in [0, 255], as in 8-bit images, so that the data
+ * is stored without loss. If the source path of the data is
+ * given, its modification time and size are stored, so that
+ * the packed dataset can be used as a cache of the source.
+ * The file is written to a temporary path and then renamed,
+ * so that a reader never sees a partially written file.
+ *
+ * @param iter
+ * @param path
+ * @param type
+ * @param source
+ */
+void PackedIterator::save(DataIterator *iter, const std::string& path, PackedType type, const std::string& source)
+{
+	packed_stamp_t stamp { 0, 0 };
+
+	CHECK_ERROR(source.empty() || get_source_stamp(source, stamp), "Failed to read data source");
+
+	int m = iter->sample_size();
+	int n = iter->num_samples();
+
+	// construct class table and labels
+	Dataset dataset(iter);
+
+	std::vector<std::string> names;
+	names.reserve(n);
+
+	for ( const DataEntry& entry : dataset.entries() ) {
+		names.push_back(entry.name);
+	}
+
+	// write header
+	std::string temp_path = path + ".tmp";
+	IODevice file(temp_path, std::ios_base::out | std::ios_base::binary);
+
+	CHECK_ERROR(file.is_open(), "Failed to open packed dataset for writing");
+
+	file << PACKED_MAGIC;
+	file << PACKED_VERSION;
+	file << (int) type;
+	file << m;
+	file << n;
+	write_stamp(file, stamp);
+	file << dataset.classes();
+	file << dataset.labels();
+	file << names;
+
+	// pad header to the alignment of the data block
+	size_t offset = file.tellp();
+	std::vector<char> padding(align_offset(offset) - offset);
+
+	file.write(padding.data(), padding.size());
+
+	// write data block
+	Matrix x(m, 1);
+	std::unique_ptr<unsigned char[]> bytes(new unsigned char[m]);
+
+	bool is_lossless = true;
+
+	for ( int i = 0; i < n && is_lossless; i++ ) {
+		iter->sample(x, i, 0);
+
+		if ( type == PackedType::float32 ) {
+			file.write(reinterpret_cast<const char *>(&x.elem(0)), m * sizeof(float));
+		}
+		else {
+			for ( int k = 0; k < m; k++ ) {
+				float value = x.elem(k);
+
+				is_lossless = is_lossless && (0 <= value && value <= 255 && value == roundf(value));
+				bytes[k] = (unsigned char) fminf(fmaxf(roundf(value), 0), 255);
+			}
+
+			file.write(reinterpret_cast<const char *>(bytes.get()), m);
+		}
+	}
+
+	file.close();
+
+	if ( !is_lossless ) {
+		remove(temp_path.c_str());
+	}
+
+	CHECK_ERROR(is_lossless, "Data cannot be packed as uint8 without loss");
+
+	CHECK_ERROR(!file.fail(), "Failed to write packed dataset");
+	CHECK_ERROR(rename(temp_path.c_str(), path.c_str()) == 0, "Failed to write packed dataset");
+}
+
+
+
+/**
+ * Get the path of the packed cache of a data source, which
+ * is the source path with the extension ".pack".
+ *
+ * @param path
+ */
+std::string PackedIterator::cache_path(const std::string& path)
+{
+	size_t end = path.find_last_not_of('/');
+
+	return path.substr(0, end + 1) + ".pack";
+}
+
+
+
+/**
+ * Open the packed cache of a data source, if the cache
+ * exists and was packed from the current version of the
+ * source, which is determined by the modification time and
+ * size of the source file or of every file in the source
+ * directory.
+ *
+ * A uint8 cache is only used if allow_uint8 is true, so that
+ * a caller whose data is not 8-bit never gets quantized data.
+ * A cache which cannot be read is ignored, so that the
+ * caller falls back to the source.
+ *
+ * @param path
+ * @param allow_uint8
+ */
+std::unique_ptr<PackedIterator> PackedIterator::open_cache(const std::string& path, bool allow_uint8)
+{
+	std::string cache = cache_path(path);
+
+	struct stat cache_st;
+	packed_stamp_t stamp;
+
+	if ( stat(cache.c_str(), &cache_st) != 0 || !get_source_stamp(path, stamp) ) {
+		return nullptr;
+	}
+
+	try {
+		std::unique_ptr<PackedIterator> iter(new PackedIterator(cache));
+
+		if ( iter->_stamp.mtime != stamp.mtime || iter->_stamp.size != stamp.size ) {
+			Logger::log(LogLevel::Verbose, "Packed cache %s is out of date", cache.c_str());
+
+			return nullptr;
+		}
+
+		if ( iter->_type == PackedType::uint8 && !allow_uint8 ) {
+			Logger::log(LogLevel::Warn, "warning: ignoring uint8 packed cache %s", cache.c_str());
+
+			return nullptr;
+		}
+
+		Logger::log(LogLevel::Verbose, "Using packed cache %s", cache.c_str());
+
+		return iter;
+	}
+	catch ( std::runtime_error& e ) {
+		Logger::log(LogLevel::Warn, "warning: ignoring packed cache %s: %s", cache.c_str(), e.what());
+
+		return nullptr;
+	}
+}
+
+
+
+/**
+ * Construct a packed iterator from a packed dataset.
+ *
+ * @param path
+ */
+PackedIterator::PackedIterator(const std::string& path)
+{
+	// read header
+	IODevice file(path, std::ios_base::in | std::ios_base::binary);
+
+	CHECK_ERROR(file.is_open(), "Failed to open packed dataset");
+
+	int magic = 0;
+	int version = 0;
+	int type;
+	int n;
+
+	file >> magic;
+	file >> version;
+
+	CHECK_ERROR(magic == PACKED_MAGIC && version == PACKED_VERSION, "Invalid packed dataset");
+
+	file >> type;
+	file >> _size;
+	file >> n;
+	read_stamp(file, _stamp);
+
+	std::vector<std::string> classes;
+	std::vector<int> labels;
+	std::vector<std::string> names;
+
+	file >> classes;
+	file >> labels;
+	file >> names;
+
+	CHECK_ERROR(!file.fail() && labels.size() == (size_t)n && names.size() == (size_t)n, "Invalid packed dataset");
+
+	size_t offset = align_offset(file.tellg());
+
+	file.close();
+
+	CHECK_ERROR(type == (int)PackedType::float32 || type == (int)PackedType::uint8, "Invalid packed dataset");
+
+	_type = (PackedType) type;
+
+	// construct entries
+	_entries.reserve(n);
+
+	for ( int i = 0; i < n; i++ ) {
+		CHECK_ERROR(0 <= labels[i] && labels[i] < (int)classes.size(), "Invalid packed dataset");
+
+		_entries.push_back(DataEntry {
+			classes[labels[i]],
+			names[i]
+		});
+	}
+
+	// map data block into memory
+	size_t elem_size = (_type == PackedType::float32)
+		? sizeof(float)
+		: sizeof(unsigned char);
+	size_t length = offset + (size_t)_size * n * elem_size;
+
+	int fd = open(path.c_str(), O_RDONLY);
+
+	CHECK_ERROR(fd != -1, "Failed to open packed dataset");
+
+	struct stat st;
+	bool valid = (fstat(fd, &st) == 0 && (size_t)st.st_size >= length);
+
+	// map privately so that views can be modified without
+	// changing the file; unmodified pages remain shared
+	void *addr = valid
+		? mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)
+		: MAP_FAILED;
+
+	close(fd);
+
+	CHECK_ERROR(valid, "Packed dataset is truncated");
+	CHECK_ERROR(addr != MAP_FAILED, "Failed to map packed dataset");
+
+	_mapping = std::shared_ptr<char>((char *)addr, [length] (char *p) {
+		munmap(p, length);
+	});
+	_data = _mapping.get() + offset;
+}
+
+
+
+/**
+ * Load sample i into column j of a data matrix.
+ *
+ * @param X
+ * @param i
+ * @param j
+ */
+void PackedIterator::sample(Matrix& X, int i, int j)
+{
+	assert(X.rows() == sample_size());
+
+	if ( _type == PackedType::float32 ) {
+		const float *x = reinterpret_cast<const float *>(_data) + (size_t)i * _size;
+
+		memcpy(&X.elem(0, j), x, _size * sizeof(float));
+	}
+	else {
+		const unsigned char *x = reinterpret_cast<const unsigned char *>(_data) + (size_t)i * _size;
+
+		for ( int k = 0; k < _size; k++ ) {
+			X.elem(k, j) = (float) x[k];
+		}
+	}
+}
+
+
+
+/**
+ * Construct a data matrix directly on the memory-mapped
+ * data block, without copying any samples. Only float32
+ * datasets can be viewed.
+ *
+ * All views of a packed iterator share the same memory,
+ * so a view is read-only, as with CSVIterator::view(). The
+ * file itself is never modified.
+ *
+ * @param X
+ */
+bool PackedIterator::view(Matrix& X)
+{
+	if ( _type != PackedType::float32 ) {
+		return false;
+	}
+
+	size_t size = (size_t)_size * num_samples();
+	auto buffer = std::make_shared<Buffer<float>>(size, reinterpret_cast<float *>(_data), _mapping);
+
+	X = Matrix(_size, num_samples(), buffer);
+	X.gpu_write();
+
+	return true;
+}
+
+
+
+}
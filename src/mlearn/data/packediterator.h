@@ -0,0 +1,64 @@
+/**
+ * @file data/packediterator.h
+ *
+ * Interface definitions for the packed dataset iterator.
+ */
+#ifndef MLEARN_DATA_PACKEDITERATOR_H
+#define MLEARN_DATA_PACKEDITERATOR_H
+
+#include <memory>
+#include "mlearn/data/dataiterator.h"
+
+
+
+namespace mlearn {
+
+
+
+enum class PackedType {
+	float32,
+	uint8
+};
+
+
+
+typedef struct {
+	long long mtime;
+	long long size;
+} packed_stamp_t;
+
+
+
+class PackedIterator : public DataIterator {
+public:
+	static void save(DataIterator *iter, const std::string& path, PackedType type=PackedType::float32, const std::string& source="");
+	static std::string cache_path(const std::string& path);
+	static std::unique_ptr<PackedIterator> open_cache(const std::string& path, bool allow_uint8=false);
+
+	PackedIterator(const std::string& path);
+	~PackedIterator() {}
+
+	int num_samples() const { return _entries.size(); }
+	int sample_size() const { return _size; }
+	const std::vector<DataEntry>& entries() const { return _entries; }
+	PackedType type() const { return _type; }
+
+	using DataIterator::sample;
+	void sample(Matrix& X, int i, int j);
+	bool view(Matrix& X);
+
+private:
+	std::vector<DataEntry> _entries;
+
+	int _size;
+	PackedType _type;
+	packed_stamp_t _stamp;
+	std::shared_ptr<char> _mapping;
+	char *_data;
+};
+
+
+
+}
+
+#endif
@@ -1,9 +1,11 @@
 /**
- * @file feature/ica.cpp
+ * @file feature/ica.cu
  *
  * Implementation of ICA (Hyvarinen, 1999).
  */
+#include <cfloat>
 #include <cmath>
+#include "mlearn/cuda/device.h"
 #include "mlearn/feature/ica.h"
 #include "mlearn/feature/pca.h"
 #include "mlearn/util/logger.h"
@@ -27,14 +29,16 @@ typedef Matrix (*fpica_func_t)(const Matrix&, const Matrix&);
  * @param nonl
  * @param max_iter
  * @param eps
+ * @param approach
  */
-ICALayer::ICALayer(int n1, int n2, ICANonl nonl, int max_iter, float eps)
+ICALayer::ICALayer(int n1, int n2, ICANonl nonl, int max_iter, float eps, ICAApproach approach)
 {
 	_n1 = n1;
 	_n2 = n2;
 	_nonl = nonl;
 	_max_iter = max_iter;
 	_eps = eps;
+	_approach = approach;
 }
 
 
@@ -61,7 +65,9 @@ void ICALayer::fit(const Matrix& X)
 
 	Timer::push("compute whitening matrix and whitened input matrix");
 
-	// compute whitening matrix W_z = inv(sqrt(D)) * W_pca'
+	// compute whitening matrix W_z = sqrt(M) * inv(sqrt(D)) * W_pca',
+	// where M is the number of observations, so that the whitened
+	// input has unit variance
 	PCALayer pca(_n1);
 
 	pca.fit(mixedsig);
@@ -71,6 +77,7 @@ void ICALayer::fit(const Matrix& X)
 	D = D.inverse();
 
 	Matrix W_z = D * pca.W().T();
+	W_z *= sqrtf(mixedsig.cols());
 
 	// compute whitened input U = W_z * mixedsig
 	Matrix U = W_z * mixedsig;
@@ -80,7 +87,9 @@ void ICALayer::fit(const Matrix& X)
 	Timer::push("compute mixing matrix");
 
 	// compute mixing matrix
-	Matrix W_mix = fpica(U, W_z);
+	Matrix W_mix = (_approach == ICAApproach::symmetric)
+		? fpica_symmetric(U, W_z)
+		: fpica_deflation(U, W_z);
 
 	Timer::pop();
 
@@ -115,6 +124,25 @@ Matrix ICALayer::transform(const Matrix& X) const
 
 
 
+/**
+ * Get the affine map of an ICA layer, which is a
+ * projection with no bias:
+ *
+ *   transform(X) = W' * X
+ *
+ * @param A
+ * @param b
+ */
+bool ICALayer::affine(Matrix& A, Matrix& b) const
+{
+	A = _W.transpose();
+	b = Matrix::zeros(_W.cols(), 1);
+
+	return true;
+}
+
+
+
 /**
  * Save an ICA layer to a file.
  *
@@ -127,6 +155,7 @@ void ICALayer::save(IODevice& file) const
 	file << (int) _nonl;
 	file << _max_iter;
 	file << _eps;
+	file << (int) _approach;
 	file << _W;
 }
 
@@ -144,6 +173,7 @@ void ICALayer::load(IODevice& file)
 	int nonl; file >> nonl; _nonl = (ICANonl) nonl;
 	file >> _max_iter;
 	file >> _eps;
+	int approach; file >> approach; _approach = (ICAApproach) approach;
 	file >> _W;
 }
 
@@ -166,12 +196,22 @@ void ICALayer::print() const
 		nonl_name = "gauss";
 	}
 
+	const char *approach_name = "";
+
+	if ( _approach == ICAApproach::deflation ) {
+		approach_name = "deflation";
+	}
+	else if ( _approach == ICAApproach::symmetric ) {
+		approach_name = "symmetric";
+	}
+
 	Logger::log(LogLevel::Verbose, "ICA");
 	Logger::log(LogLevel::Verbose, "  %-20s  %10d", "n1", _n1);
 	Logger::log(LogLevel::Verbose, "  %-20s  %10d", "n2", _n2);
 	Logger::log(LogLevel::Verbose, "  %-20s  %10s", "nonl", nonl_name);
 	Logger::log(LogLevel::Verbose, "  %-20s  %10d", "max_iter", _max_iter);
 	Logger::log(LogLevel::Verbose, "  %-20s  %10f", "eps", _eps);
+	Logger::log(LogLevel::Verbose, "  %-20s  %10s", "approach", approach_name);
 }
 
 
@@ -323,7 +363,7 @@ Matrix fpica_gauss(const Matrix& w0, const Matrix& X)
  * @param X
  * @param W_z
  */
-Matrix ICALayer::fpica(const Matrix& X, const Matrix& W_z)
+Matrix ICALayer::fpica_deflation(const Matrix& X, const Matrix& W_z)
 {
 	// if n2 is -1, use default value
 	int n2 = (_n2 == -1)
@@ -400,4 +440,215 @@ Matrix ICALayer::fpica(const Matrix& X, const Matrix& W_z)
 
 
 
+/**
+ * Evaluate a nonlinearity and its derivative at a single
+ * point, for the symmetric approach:
+ *
+ *   pow3:  g(u) = u^3,                  g'(u) = 3 * u^2
+ *   tanh:  g(u) = tanh(u),              g'(u) = 1 - tanh(u)^2
+ *   gauss: g(u) = u * exp(-u^2 / 2),    g'(u) = (1 - u^2) * exp(-u^2 / 2)
+ *
+ * @param nonl
+ * @param u
+ * @param g
+ * @param g_deriv
+ */
+__host__ __device__
+inline void fpica_nonl(ICANonl nonl, float u, float& g, float& g_deriv)
+{
+	if ( nonl == ICANonl::pow3 ) {
+		g = u * u * u;
+		g_deriv = 3 * u * u;
+	}
+	else if ( nonl == ICANonl::tanh ) {
+		float t = tanhf(u);
+
+		g = t;
+		g_deriv = 1 - t * t;
+	}
+	else if ( nonl == ICANonl::gauss ) {
+		float e = expf(-(u * u) / 2.0f);
+
+		g = u * e;
+		g_deriv = (1 - u * u) * e;
+	}
+}
+
+
+
+__global__
+void fpica_nonl_kernel(ICANonl nonl, float *Y, float *G_deriv, int n)
+{
+	int i = blockDim.x * blockIdx.x + threadIdx.x;
+
+	if ( i >= n ) {
+		return;
+	}
+
+	fpica_nonl(nonl, Y[i], Y[i], G_deriv[i]);
+}
+
+
+
+/**
+ * Apply a nonlinearity to every element of a matrix Y in a
+ * single pass, replacing Y with g(Y) and storing g'(Y) in
+ * G_deriv.
+ *
+ * @param nonl
+ * @param Y
+ * @param G_deriv
+ */
+void fpica_nonl(ICANonl nonl, Matrix& Y, Matrix& G_deriv)
+{
+	int n = Y.rows() * Y.cols();
+
+	if ( Device::instance() ) {
+		const int BLOCK_SIZE = 256;
+		const int GRID_SIZE = (n + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		fpica_nonl_kernel<<<GRID_SIZE, BLOCK_SIZE>>>(
+			nonl,
+			Y.buffer().device_data(),
+			G_deriv.buffer().device_data(),
+			n
+		);
+		CHECK_CUDA(cudaGetLastError());
+
+		Y.gpu_read();
+		G_deriv.gpu_read();
+	}
+	else {
+		float *y = Y.buffer().host_data();
+		float *g_deriv = G_deriv.buffer().host_data();
+
+		#pragma omp parallel for simd
+		for ( int i = 0; i < n; i++ ) {
+			fpica_nonl(nonl, y[i], y[i], g_deriv[i]);
+		}
+	}
+}
+
+
+
+/**
+ * Orthogonalize the rows of a matrix W with symmetric
+ * decorrelation:
+ *
+ *   W = (W * W')^(-1/2) * W
+ *
+ * where (W * W')^(-1/2) = E * D^(-1/2) * E' is computed
+ * from the eigendecomposition W * W' = E * D * E'. The
+ * eigenvalues are clipped to be positive so that rounding
+ * errors in a nearly singular W do not produce NaNs.
+ *
+ * @param W
+ */
+void fpica_decorrelate(Matrix& W)
+{
+	int n = W.rows();
+
+	// compute eigendecomposition of W * W'
+	Matrix E = W * W.T();
+	Matrix D(1, n);
+
+	E.syev(E, D);
+
+	E.gpu_read();
+	D.gpu_read();
+
+	// compute E * D^(-1/2)
+	Matrix E_scaled = E;
+
+	for ( int j = 0; j < n; j++ ) {
+		float d = 1 / sqrtf(std::max(D.elem(0, j), FLT_MIN));
+
+		for ( int i = 0; i < n; i++ ) {
+			E_scaled.elem(i, j) *= d;
+		}
+	}
+
+	E_scaled.gpu_write();
+
+	// compute W = E * D^(-1/2) * E' * W
+	W = E_scaled * (E.T() * W);
+}
+
+
+
+/**
+ * Compute the mixing matrix W_mix for an input matrix X using
+ * the symmetric approach, which estimates all components at
+ * once. Each iteration updates the whole unmixing matrix with
+ * matrix products:
+ *
+ *   Y = W * X
+ *   W+ = g(Y) * X' / X.cols() - diag(mean(g'(Y), 2)) * W
+ *
+ * and then decorrelates the rows of W+. The input matrix
+ * should already be whitened.
+ *
+ * @param X
+ * @param W_z
+ */
+Matrix ICALayer::fpica_symmetric(const Matrix& X, const Matrix& W_z)
+{
+	// if n2 is -1, use default value
+	int n2 = (_n2 == -1)
+		? X.rows()
+		: std::min(X.rows(), _n2);
+	int N = X.cols();
+
+	// initialize W as a random orthogonal matrix
+	Matrix W = Matrix::random(n2, X.rows());
+
+	fpica_decorrelate(W);
+
+	// initialize workspace
+	Matrix G_deriv(n2, N);
+	Matrix ones = Matrix::ones(N, 1);
+
+	int j;
+	for ( j = 0; j < _max_iter; j++ ) {
+		// compute Y = W * X, G = g(Y), G' = g'(Y)
+		Matrix Y = W * X;
+
+		fpica_nonl(_nonl, Y, G_deriv);
+
+		// compute beta = mean(g'(Y), 2)
+		Matrix beta = G_deriv * ones;
+		beta /= N;
+		beta.gpu_read();
+
+		// compute W+ = G * X' / N - diag(beta) * W
+		Matrix W_next = Y * X.T();
+		W_next /= N;
+		W_next -= beta.diagonalize() * W;
+
+		fpica_decorrelate(W_next);
+
+		// terminate if the directions of all components have converged
+		Matrix C = W_next * W.T();
+		C.gpu_read();
+
+		float delta = 0;
+
+		for ( int i = 0; i < n2; i++ ) {
+			delta = std::max(delta, 1 - fabsf(C.elem(i, i)));
+		}
+
+		W = std::move(W_next);
+
+		if ( delta < _eps ) {
+			break;
+		}
+	}
+
+	Logger::log(LogLevel::Verbose, "      iterations: %d", j);
+
+	// compute W_mix = W * W_z
+	return W * W_z;
+}
+
+
+
 }
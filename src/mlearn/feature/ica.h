@@ -23,27 +23,38 @@ enum class ICANonl {
 
 
 
+enum class ICAApproach {
+	deflation,
+	symmetric
+};
+
+
+
 class ICALayer : public TransformerLayer {
 public:
-	ICALayer(int n1, int n2, ICANonl nonl, int max_iter, float eps);
+	ICALayer(int n1, int n2, ICANonl nonl, int max_iter, float eps, ICAApproach approach=ICAApproach::deflation);
 	ICALayer() : ICALayer(-1, -1, ICANonl::pow3, 1000, 0.0001f) {}
 
+	TransformerLayer * clone() const { return new ICALayer(*this); }
 	void fit(const Matrix& X);
 	void fit(const Matrix& X, const std::vector<int>& y, int c) { fit(X); }
 	Matrix transform(const Matrix& X) const;
+	bool affine(Matrix& A, Matrix& b) const;
 
 	void save(IODevice& file) const;
 	void load(IODevice& file);
 	void print() const;
 
 private:
-	Matrix fpica(const Matrix& X, const Matrix& W_z);
+	Matrix fpica_deflation(const Matrix& X, const Matrix& W_z);
+	Matrix fpica_symmetric(const Matrix& X, const Matrix& W_z);
 
 	int _n1;
 	int _n2;
 	ICANonl _nonl;
 	int _max_iter;
 	float _eps;
+	ICAApproach _approach;
 	Matrix _W;
 };
 
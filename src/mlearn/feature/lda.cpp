@@ -74,12 +74,10 @@ void LDALayer::fit(const Matrix& X, const std::vector<int>& y, int c)
 
 	Timer::push("compute eigendecomposition of S_b and S_w");
 
-	Matrix S_w_inv = S_w.inverse();
-	Matrix J = S_w_inv * S_b;
-
+	// solve S_b * w = lambda * S_w * w
 	Matrix W_fld;
 	Matrix J_eval;
-	J.eigen(n2, W_fld, J_eval);
+	S_b.eigen(S_w, n2, W_fld, J_eval);
 
 	Timer::pop();
 
@@ -106,6 +104,25 @@ Matrix LDALayer::transform(const Matrix& X) const
 
 
 
+/**
+ * Get the affine map of an LDA layer, which is a
+ * projection with no bias:
+ *
+ *   transform(X) = W' * X
+ *
+ * @param A
+ * @param b
+ */
+bool LDALayer::affine(Matrix& A, Matrix& b) const
+{
+	A = _W.transpose();
+	b = Matrix::zeros(_W.cols(), 1);
+
+	return true;
+}
+
+
+
 /**
  * Save an LDA layer to a file.
  *
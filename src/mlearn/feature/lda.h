@@ -19,9 +19,11 @@ public:
 	LDALayer(int n1, int n2);
 	LDALayer() : LDALayer(-1, -1) {}
 
+	TransformerLayer * clone() const { return new LDALayer(*this); }
 	void fit(const Matrix& X) {}
 	void fit(const Matrix& X, const std::vector<int>& y, int c);
 	Matrix transform(const Matrix& X) const;
+	bool affine(Matrix& A, Matrix& b) const;
 
 	void save(IODevice& file) const;
 	void load(IODevice& file);
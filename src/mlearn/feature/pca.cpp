@@ -95,6 +95,25 @@ Matrix PCALayer::transform(const Matrix& X) const
 
 
 
+/**
+ * Get the affine map of a PCA layer, which is a
+ * projection with no bias:
+ *
+ *   transform(X) = W' * X
+ *
+ * @param A
+ * @param b
+ */
+bool PCALayer::affine(Matrix& A, Matrix& b) const
+{
+	A = _W.transpose();
+	b = Matrix::zeros(_W.cols(), 1);
+
+	return true;
+}
+
+
+
 /**
  * Save a PCA layer to a file.
  *
@@ -22,9 +22,11 @@ public:
 	const Matrix& W() const { return _W; }
 	const Matrix& D() const { return _D; }
 
+	TransformerLayer * clone() const { return new PCALayer(*this); }
 	void fit(const Matrix& X);
 	void fit(const Matrix& X, const std::vector<int>& y, int c) { fit(X); }
 	Matrix transform(const Matrix& X) const;
+	bool affine(Matrix& A, Matrix& b) const;
 
 	void save(IODevice& file) const;
 	void load(IODevice& file);
@@ -0,0 +1,464 @@
+/**
+ * @file layer/modelfile.cpp
+ *
+ * Implementation of the model file container.
+ *
+ * A model file stores each layer of a model as a separate
+ * section, so that sections can be verified and loaded on
+ * their own. The file has the following layout:
+ *
+ *   header (64 bytes):
+ *     magic, version, byte order marker, number of sections,
+ *     offset, size and checksum of the section table
+ *   sections, each aligned to 64 bytes:
+ *     the saved state of a layer, optionally compressed
+ *   section table:
+ *     name, offset, size, uncompressed size, compression
+ *     and checksum of each section
+ *
+ * Each section and the table have a CRC-32 checksum, so that
+ * a corrupt file is rejected when it is loaded. Compressed
+ * sections are byte-shuffled by 4-byte lanes before they are
+ * deflated, which groups the exponent bytes of float data
+ * and improves the compression of matrices. Uncompressed
+ * sections are read in place from a memory-mapped file, so
+ * that aligned matrices are not copied.
+ */
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+#include <zlib.h>
+#include "mlearn/layer/modelfile.h"
+#include "mlearn/util/error.h"
+
+
+
+namespace mlearn {
+
+
+
+const int MODEL_MAGIC = 0x4c444f4d;
+const int MODEL_VERSION = 1;
+const int MODEL_BYTE_ORDER = 0x01020304;
+const size_t MODEL_ALIGNMENT = 64;
+
+
+
+/**
+ * Compute the CRC-32 checksum of a block of memory.
+ *
+ * @param data
+ * @param size
+ */
+uint32_t compute_checksum(const char *data, uint64_t size)
+{
+	const uint64_t CHUNK_SIZE = 1 << 30;
+
+	uLong crc = crc32(0L, Z_NULL, 0);
+
+	while ( size > 0 )
+	{
+		uInt n = std::min(size, CHUNK_SIZE);
+
+		crc = crc32(crc, reinterpret_cast<const Bytef *>(data), n);
+		data += n;
+		size -= n;
+	}
+
+	return crc;
+}
+
+
+
+/**
+ * Shuffle the bytes of a block of memory by 4-byte lanes, so
+ * that the k-th byte of each word is stored in the k-th lane.
+ * Trailing bytes are copied as they are.
+ *
+ * @param src
+ * @param dst
+ * @param size
+ * @param inverse
+ */
+void shuffle_bytes(const char *src, char *dst, uint64_t size, bool inverse)
+{
+	uint64_t n = size / 4;
+
+	for ( uint64_t i = 0; i < n; i++ )
+	{
+		for ( int k = 0; k < 4; k++ )
+		{
+			if ( inverse )
+			{
+				dst[4 * i + k] = src[k * n + i];
+			}
+			else
+			{
+				dst[k * n + i] = src[4 * i + k];
+			}
+		}
+	}
+
+	std::copy(src + 4 * n, src + size, dst + 4 * n);
+}
+
+
+
+void write_u64(IODevice& file, uint64_t val)
+{
+	file.write(reinterpret_cast<const char *>(&val), sizeof(uint64_t));
+}
+
+
+
+void read_u64(IODevice& file, uint64_t& val)
+{
+	file.read(reinterpret_cast<char *>(&val), sizeof(uint64_t));
+}
+
+
+
+/**
+ * Pad a file with zeros to the next aligned offset.
+ *
+ * @param file
+ */
+void write_padding(IODevice& file)
+{
+	size_t offset = file.tellp();
+	size_t padding = (MODEL_ALIGNMENT - offset % MODEL_ALIGNMENT) % MODEL_ALIGNMENT;
+	std::vector<char> zeros(padding, 0);
+
+	file.write(zeros.data(), zeros.size());
+}
+
+
+
+/**
+ * Create a model file. The file is written to a temporary
+ * path and renamed by close(), so that a reader never sees a
+ * partially written model. If close() is not called, the
+ * model file is discarded.
+ *
+ * @param path
+ * @param compression
+ */
+ModelWriter::ModelWriter(const std::string& path, ModelCompression compression):
+	_path(path),
+	_temp_path(path + ".tmp"),
+	_compression(compression),
+	_file(new IODevice(_temp_path, std::ios_base::out | std::ios_base::binary))
+{
+	CHECK_ERROR(_file->is_open(), "Failed to open model file for writing");
+
+	// reserve space for the header
+	std::vector<char> header(MODEL_ALIGNMENT, 0);
+
+	_file->write(header.data(), header.size());
+}
+
+
+
+/**
+ * Discard a model file which was not closed.
+ */
+ModelWriter::~ModelWriter()
+{
+	if ( _file )
+	{
+		_file.reset();
+		remove(_temp_path.c_str());
+	}
+}
+
+
+
+/**
+ * Add the saved state of a layer to a model file as a new
+ * section. If compression is enabled, the section is stored
+ * compressed unless compression does not make it smaller.
+ *
+ * @param name
+ * @param layer
+ */
+void ModelWriter::add(const std::string& name, const Layer& layer)
+{
+	CHECK_ERROR(_file, "Model file is closed");
+
+	// save layer to memory
+	std::stringbuf buffer;
+	IODevice state(&buffer);
+
+	state << layer;
+
+	std::string raw = buffer.str();
+
+	model_section_t section;
+	section.name = name;
+	section.raw_size = raw.size();
+	section.compression = ModelCompression::none;
+
+	// compress section
+	std::vector<char> compressed;
+
+	if ( _compression == ModelCompression::deflate && !raw.empty() )
+	{
+		std::vector<char> shuffled(raw.size());
+
+		shuffle_bytes(raw.data(), shuffled.data(), raw.size(), false);
+
+		uLongf size = compressBound(raw.size());
+		compressed.resize(size);
+
+		int status = compress2(
+			reinterpret_cast<Bytef *>(compressed.data()), &size,
+			reinterpret_cast<const Bytef *>(shuffled.data()), shuffled.size(),
+			Z_BEST_SPEED);
+
+		CHECK_ERROR(status == Z_OK, "Failed to compress model section");
+
+		compressed.resize(size);
+
+		if ( compressed.size() < raw.size() )
+		{
+			section.compression = ModelCompression::deflate;
+		}
+	}
+
+	const char *data = (section.compression == ModelCompression::deflate)
+		? compressed.data()
+		: raw.data();
+
+	section.size = (section.compression == ModelCompression::deflate)
+		? compressed.size()
+		: raw.size();
+	section.checksum = compute_checksum(data, section.size);
+
+	// write section
+	write_padding(*_file);
+
+	section.offset = _file->tellp();
+
+	_file->write(data, section.size);
+
+	CHECK_ERROR(!_file->fail(), "Failed to write model file");
+
+	_sections.push_back(section);
+}
+
+
+
+/**
+ * Write the section table and header of a model file and
+ * move the file into place.
+ */
+void ModelWriter::close()
+{
+	CHECK_ERROR(_file, "Model file is closed");
+
+	IODevice& file = *_file;
+
+	// write section table
+	std::stringbuf buffer;
+	IODevice table(&buffer);
+
+	for ( const model_section_t& section : _sections )
+	{
+		table << section.name;
+		write_u64(table, section.offset);
+		write_u64(table, section.size);
+		write_u64(table, section.raw_size);
+		table << (int) section.compression;
+		table << (int) section.checksum;
+	}
+
+	std::string table_data = buffer.str();
+
+	write_padding(file);
+
+	uint64_t table_offset = file.tellp();
+
+	file.write(table_data.data(), table_data.size());
+
+	// write header
+	file.seekp(0);
+	file << MODEL_MAGIC;
+	file << MODEL_VERSION;
+	file << MODEL_BYTE_ORDER;
+	file << (int) _sections.size();
+	write_u64(file, table_offset);
+	write_u64(file, table_data.size());
+	file << (int) compute_checksum(table_data.data(), table_data.size());
+
+	file.close();
+
+	bool success = !file.fail();
+
+	_file.reset();
+
+	CHECK_ERROR(success, "Failed to write model file");
+	CHECK_ERROR(rename(_temp_path.c_str(), _path.c_str()) == 0, "Failed to write model file");
+}
+
+
+
+/**
+ * Determine whether a file is a model file, as opposed to a
+ * model saved directly with Layer::save().
+ *
+ * @param path
+ */
+bool ModelReader::is_model_file(const std::string& path)
+{
+	IODevice file(path, std::ios_base::in | std::ios_base::binary);
+	int magic = 0;
+
+	file >> magic;
+
+	return !file.fail() && magic == MODEL_MAGIC;
+}
+
+
+
+/**
+ * Open a model file. The header and section table are read
+ * and verified, and the file is mapped into memory, but no
+ * section is read until it is loaded.
+ *
+ * @param path
+ */
+ModelReader::ModelReader(const std::string& path)
+{
+	IODevice file(path, std::ios_base::in | std::ios_base::binary, true);
+
+	CHECK_ERROR(file.is_open(), "Failed to open model file");
+
+	// read header
+	int magic = 0;
+	int version = 0;
+	int byte_order = 0;
+	int num_sections = 0;
+	uint64_t table_offset = 0;
+	uint64_t table_size = 0;
+	int table_checksum = 0;
+
+	file >> magic;
+	file >> version;
+	file >> byte_order;
+
+	CHECK_ERROR(!file.fail() && magic == MODEL_MAGIC, "Invalid model file");
+	CHECK_ERROR(byte_order == MODEL_BYTE_ORDER, "Model file has a different byte order");
+	CHECK_ERROR(1 <= version && version <= MODEL_VERSION, "Unsupported model file version");
+
+	file >> num_sections;
+	read_u64(file, table_offset);
+	read_u64(file, table_size);
+	file >> table_checksum;
+
+	file.seekg(0, std::ios_base::end);
+
+	_mapping = file.mapping();
+	_length = file.tellg();
+
+	CHECK_ERROR(!file.fail() && table_offset <= _length && table_size <= _length - table_offset, "Model file is truncated");
+
+	// read section table
+	char *table_data = _mapping.get() + table_offset;
+
+	CHECK_ERROR(compute_checksum(table_data, table_size) == (uint32_t) table_checksum, "Model file is corrupt");
+
+	IODevice table(_mapping, table_data, table_size);
+
+	for ( int i = 0; i < num_sections; i++ )
+	{
+		model_section_t section;
+		int compression;
+		int checksum;
+
+		table >> section.name;
+		read_u64(table, section.offset);
+		read_u64(table, section.size);
+		read_u64(table, section.raw_size);
+		table >> compression;
+		table >> checksum;
+
+		section.compression = (ModelCompression) compression;
+		section.checksum = checksum;
+
+		CHECK_ERROR(!table.fail(), "Model file is corrupt");
+		CHECK_ERROR(section.offset <= _length && section.size <= _length - section.offset, "Model file is truncated");
+		CHECK_ERROR(section.compression == ModelCompression::none || section.compression == ModelCompression::deflate, "Unsupported model file compression");
+
+		_sections.push_back(section);
+	}
+}
+
+
+
+/**
+ * Determine whether a model file has a section.
+ *
+ * @param name
+ */
+bool ModelReader::contains(const std::string& name) const
+{
+	return std::any_of(_sections.begin(), _sections.end(), [&] (const model_section_t& section) {
+		return section.name == name;
+	});
+}
+
+
+
+/**
+ * Load a layer from a section of a model file. The section
+ * is verified against its checksum and decompressed if
+ * necessary. Matrices in an uncompressed section are used in
+ * place if they are aligned.
+ *
+ * @param name
+ * @param layer
+ */
+void ModelReader::load(const std::string& name, Layer& layer) const
+{
+	auto it = std::find_if(_sections.begin(), _sections.end(), [&] (const model_section_t& section) {
+		return section.name == name;
+	});
+
+	CHECK_ERROR(it != _sections.end(), "Model file has no section '" + name + "'");
+
+	const model_section_t& section = *it;
+	char *data = _mapping.get() + section.offset;
+
+	CHECK_ERROR(compute_checksum(data, section.size) == section.checksum, "Model section '" + name + "' is corrupt");
+
+	// decompress section
+	std::shared_ptr<char> owner = _mapping;
+
+	if ( section.compression == ModelCompression::deflate )
+	{
+		std::vector<char> shuffled(section.raw_size);
+		uLongf size = section.raw_size;
+
+		int status = uncompress(
+			reinterpret_cast<Bytef *>(shuffled.data()), &size,
+			reinterpret_cast<const Bytef *>(data), section.size);
+
+		CHECK_ERROR(status == Z_OK && size == section.raw_size, "Model section '" + name + "' is corrupt");
+
+		owner = std::shared_ptr<char>(new char[section.raw_size], std::default_delete<char[]>());
+		data = owner.get();
+
+		shuffle_bytes(shuffled.data(), data, section.raw_size, true);
+	}
+
+	// load layer
+	IODevice file(owner, data, section.raw_size);
+
+	file >> layer;
+
+	CHECK_ERROR(!file.fail() && (uint64_t)file.tellg() == section.raw_size, "Model section '" + name + "' is invalid");
+}
+
+
+
+}
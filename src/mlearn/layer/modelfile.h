@@ -0,0 +1,79 @@
+/**
+ * @file layer/modelfile.h
+ *
+ * Interface definitions for the model file container.
+ */
+#ifndef MLEARN_LAYER_MODELFILE_H
+#define MLEARN_LAYER_MODELFILE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "mlearn/layer/layer.h"
+#include "mlearn/util/iodevice.h"
+
+
+
+namespace mlearn {
+
+
+
+enum class ModelCompression {
+	none,
+	deflate
+};
+
+
+
+typedef struct {
+	std::string name;
+	uint64_t offset;
+	uint64_t size;
+	uint64_t raw_size;
+	ModelCompression compression;
+	uint32_t checksum;
+} model_section_t;
+
+
+
+class ModelWriter {
+public:
+	ModelWriter(const std::string& path, ModelCompression compression=ModelCompression::none);
+	~ModelWriter();
+
+	void add(const std::string& name, const Layer& layer);
+	void close();
+
+private:
+	std::string _path;
+	std::string _temp_path;
+	ModelCompression _compression;
+	std::unique_ptr<IODevice> _file;
+	std::vector<model_section_t> _sections;
+};
+
+
+
+class ModelReader {
+public:
+	static bool is_model_file(const std::string& path);
+
+	ModelReader(const std::string& path);
+
+	const std::vector<model_section_t>& sections() const { return _sections; }
+	bool contains(const std::string& name) const;
+
+	void load(const std::string& name, Layer& layer) const;
+
+private:
+	std::shared_ptr<char> _mapping;
+	uint64_t _length;
+	std::vector<model_section_t> _sections;
+};
+
+
+
+}
+
+#endif
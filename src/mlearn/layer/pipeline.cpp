@@ -3,8 +3,15 @@
  *
  * Implementation of the pipeline.
  */
+#include <algorithm>
+#include <cstdio>
 #include <iomanip>
+#include <memory>
+#include <sstream>
+#include <unistd.h>
+#include "mlearn/data/batchiterator.h"
 #include "mlearn/layer/pipeline.h"
+#include "mlearn/util/error.h"
 #include "mlearn/util/iodevice.h"
 #include "mlearn/util/logger.h"
 #include "mlearn/util/timer.h"
@@ -57,6 +64,63 @@ void Pipeline::load(IODevice& file)
 		file >> *transform;
 	}
 	file >> *_estimator;
+
+	fuse_transforms();
+}
+
+
+
+/**
+ * Save a pipeline to a model file. Each layer is stored in a
+ * separate section, with an optional compression.
+ *
+ * @param path
+ * @param compression
+ */
+void Pipeline::save(const std::string& path, ModelCompression compression) const
+{
+	ModelWriter writer(path, compression);
+
+	for ( size_t i = 0; i < _transforms.size(); i++ )
+	{
+		writer.add("transform." + std::to_string(i), *_transforms[i]);
+	}
+	writer.add("estimator", *_estimator);
+
+	writer.close();
+}
+
+
+
+/**
+ * Load a pipeline from a model file. A pipeline saved
+ * directly to an I/O device is also accepted.
+ *
+ * @param path
+ */
+void Pipeline::load(const std::string& path)
+{
+	if ( !ModelReader::is_model_file(path) )
+	{
+		IODevice file(path, std::ios_base::in | std::ios_base::binary, true);
+
+		CHECK_ERROR(file.is_open(), "Failed to open model file");
+
+		load(file);
+
+		CHECK_ERROR(!file.fail(), "Failed to load model file");
+		return;
+	}
+
+	ModelReader reader(path);
+
+	for ( size_t i = 0; i < _transforms.size(); i++ )
+	{
+		reader.load("transform." + std::to_string(i), *_transforms[i]);
+	}
+	reader.load("estimator", *_estimator);
+
+	fuse_transforms();
 }
 
 
@@ -79,6 +143,54 @@ void Pipeline::print() const
 
 
 
+/**
+ * Enable the fitted-transform cache of a pipeline.
+ *
+ * When the cache is enabled, the state of each transform
+ * is saved to the cache directory after it is fit, keyed on
+ * a hash of the training data and the state of the transform
+ * and all previous transforms before fitting, which includes
+ * their hyperparameters. On the next fit with the same data
+ * and hyperparameters, the transform is loaded from the cache
+ * instead of being fit. If cache_output is true, the output
+ * of each transform on the training data is also cached, so
+ * that the transform does not have to be applied either.
+ *
+ * The cache directory must exist. Entries are never removed,
+ * so the directory can be cleared at any time.
+ *
+ * @param path
+ * @param cache_output
+ */
+void Pipeline::set_cache(const std::string& path, bool cache_output)
+{
+	_cache_path = path;
+	_cache_output = cache_output;
+}
+
+
+
+/**
+ * Compute the FNV-1a hash of a block of memory.
+ *
+ * @param key
+ * @param data
+ * @param size
+ */
+uint64_t hash_bytes(uint64_t key, const void *data, size_t size)
+{
+	const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+
+	for ( size_t i = 0; i < size; i++ )
+	{
+		key = (key ^ bytes[i]) * 0x100000001b3ULL;
+	}
+
+	return key;
+}
+
+
+
 /**
  * Fit the pipeline to a dataset.
  *
@@ -89,18 +201,48 @@ void Pipeline::fit(const Matrix& X_)
 	Timer::push("Training");
 
 	// fit each transformer
-	Matrix X(std::move(X_));
+	Matrix X;
+	const Matrix& X_fit = fit_transforms(&X_, X, {}, 0, false);
 
-	for ( auto transform : _transforms )
-	{
-		transform->fit(X);
-		X = transform->transform(X);
+	// fit estimator
+	_estimator->fit(X_fit);
 
+	fuse_transforms();
+
+	Timer::pop();
+}
+
+
+
+/**
+ * Fit the pipeline to a dataset which is no longer needed,
+ * so that the transforms can reuse its memory.
+ * If the dataset shares its memory, such as a view of a
+ * dataset, it is not modified and the overload for a const
+ * dataset is used instead.
+ *
+ * @param X
+ */
+void Pipeline::fit(Matrix&& X_)
+{
+	if ( X_.is_shared() )
+	{
+		fit(static_cast<const Matrix&>(X_));
+		return;
 	}
 
+	Timer::push("Training");
+
+	// fit each transformer
+	Matrix X(std::move(X_));
+
+	fit_transforms(nullptr, X, {}, 0, false);
+
 	// fit estimator
 	_estimator->fit(X);
 
+	fuse_transforms();
+
 	Timer::pop();
 }
 
@@ -118,26 +260,277 @@ void Pipeline::fit(const Matrix& X_, const std::vector<int>& y, int c)
 	Timer::push("Training");
 
 	// fit each transformer
-	Matrix X(std::move(X_));
+	Matrix X;
+	const Matrix& X_fit = fit_transforms(&X_, X, y, c, true);
+
+	// fit estimator
+	_estimator->fit(X_fit, y, c);
+
+	fuse_transforms();
+
+	Timer::pop();
+}
 
-	for ( auto transform : _transforms )
-	{
-		transform->fit(X, y, c);
-		X = transform->transform(X);
 
+
+/**
+ * Fit the pipeline to a dataset which is no longer needed,
+ * so that the transforms can reuse its memory.
+ * If the dataset shares its memory, such as a view of a
+ * dataset, it is not modified and the overload for a const
+ * dataset is used instead.
+ *
+ * @param X
+ * @param y
+ * @param c
+ */
+void Pipeline::fit(Matrix&& X_, const std::vector<int>& y, int c)
+{
+	if ( X_.is_shared() )
+	{
+		fit(static_cast<const Matrix&>(X_), y, c);
+		return;
 	}
 
+	Timer::push("Training");
+
+	// fit each transformer
+	Matrix X(std::move(X_));
+
+	fit_transforms(nullptr, X, y, c, true);
+
 	// fit estimator
 	_estimator->fit(X, y, c);
 
+	fuse_transforms();
+
 	Timer::pop();
 }
 
 
 
+/**
+ * Fit each transform to a dataset, using the fitted-transform
+ * cache if it is enabled, and return the output of the last
+ * transform.
+ *
+ * If input is given, the first transform reads it directly
+ * and writes its output to X. Otherwise the dataset is X, and
+ * each transform is applied in place, so that the memory of
+ * the dataset is reused or released as soon as possible.
+ *
+ * @param input
+ * @param X
+ * @param y
+ * @param c
+ * @param supervised
+ */
+const Matrix& Pipeline::fit_transforms(const Matrix *input, Matrix& X, const std::vector<int>& y, int c, bool supervised)
+{
+	bool use_cache = !_cache_path.empty();
+	uint64_t key = 0xcbf29ce484222325ULL;
+
+	// hash the training data
+	if ( use_cache )
+	{
+		const Matrix& X_in = input ? *input : X;
+		int rows = X_in.rows();
+		int cols = X_in.cols();
+
+		key = hash_bytes(key, &rows, sizeof(int));
+		key = hash_bytes(key, &cols, sizeof(int));
+
+		if ( rows * cols != 0 )
+		{
+			key = hash_bytes(key, &X_in.elem(0, 0), (size_t)rows * cols * sizeof(float));
+		}
+
+		if ( supervised )
+		{
+			key = hash_bytes(key, y.data(), y.size() * sizeof(int));
+			key = hash_bytes(key, &c, sizeof(int));
+		}
+	}
+
+	for ( auto transform : _transforms )
+	{
+		if ( use_cache )
+		{
+			// add the state of the transform before fitting to the key
+			std::stringbuf buffer;
+			IODevice state(&buffer);
+
+			state << *transform;
+
+			std::string bytes = buffer.str();
+			key = hash_bytes(key, bytes.data(), bytes.size());
+
+			if ( load_cached(transform, key, input, X) )
+			{
+				input = nullptr;
+				continue;
+			}
+		}
+
+		const Matrix& X_in = input ? *input : X;
+
+		if ( supervised )
+		{
+			transform->fit(X_in, y, c);
+		}
+		else
+		{
+			transform->fit(X_in);
+		}
+
+		if ( input )
+		{
+			X = transform->transform(*input);
+			input = nullptr;
+		}
+		else
+		{
+			transform->transform_inplace(X);
+		}
+
+		if ( use_cache )
+		{
+			save_cached(transform, key, X);
+		}
+	}
+
+	return input ? *input : X;
+}
+
+
+
+/**
+ * Load a fitted transform from the cache and apply it to
+ * a dataset, or load its output if it was cached. The dataset
+ * is read from input if it is given, or else from X.
+ *
+ * The entry is first read into a copy of the transform, so
+ * that a corrupt entry is ignored without changing the
+ * transform, which is then fit as usual.
+ *
+ * @param transform
+ * @param key
+ * @param input
+ * @param X
+ */
+bool Pipeline::load_cached(TransformerLayer *transform, uint64_t key, const Matrix *input, Matrix& X) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.layer", (unsigned long long) key);
+
+	std::string path = _cache_path + name;
+	IODevice file(path, std::ios_base::in | std::ios_base::binary, true);
+
+	if ( !file.is_open() )
+	{
+		return false;
+	}
+
+	// read fitted transform and cached output into a copy
+	std::unique_ptr<TransformerLayer> scratch(transform->clone());
+	Matrix X_out;
+	bool has_output;
+
+	file >> *scratch;
+	file >> has_output;
+
+	if ( has_output )
+	{
+		file >> X_out;
+	}
+
+	if ( file.fail() )
+	{
+		Logger::log(LogLevel::Warn, "warning: ignoring corrupt cache entry \'%s\'", path.c_str());
+		return false;
+	}
+
+	// load fitted transform from the valid entry
+	file.seekg(0);
+	file >> *transform;
+
+	Logger::log(LogLevel::Debug, "debug: loaded cached transform %s", path.c_str());
+
+	if ( has_output )
+	{
+		X_out.gpu_write();
+		X = std::move(X_out);
+	}
+	else if ( input )
+	{
+		X = transform->transform(*input);
+	}
+	else
+	{
+		transform->transform_inplace(X);
+	}
+
+	return true;
+}
+
+
+
+/**
+ * Save a fitted transform and optionally its output to the
+ * cache. The output is read back from the GPU first. The
+ * entry is written to a temporary file and then renamed, so
+ * that a concurrent fit never reads a partial entry.
+ *
+ * @param transform
+ * @param key
+ * @param X
+ */
+void Pipeline::save_cached(const TransformerLayer *transform, uint64_t key, Matrix& X) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.layer", (unsigned long long) key);
+
+	std::string path = _cache_path + name;
+	std::string temp_path = path + ".tmp." + std::to_string(getpid());
+	IODevice file(temp_path, std::ios_base::out | std::ios_base::binary);
+
+	if ( !file.is_open() )
+	{
+		Logger::log(LogLevel::Warn, "warning: cannot write cache entry \'%s\'", path.c_str());
+		return;
+	}
+
+	file << *transform;
+	file << _cache_output;
+
+	if ( _cache_output )
+	{
+		X.gpu_read();
+		file << X;
+	}
+
+	file.close();
+
+	if ( file.fail() || rename(temp_path.c_str(), path.c_str()) != 0 )
+	{
+		Logger::log(LogLevel::Warn, "warning: cannot write cache entry \'%s\'", path.c_str());
+		remove(temp_path.c_str());
+	}
+}
+
+
+
 /**
  * Use the pipeline to predict on a dataset.
  *
+ * Prediction is reentrant: a fitted pipeline can be used by
+ * several threads at once without locking, since predict()
+ * does not modify the pipeline and all other state on the
+ * prediction path is per thread (timer items, random engine,
+ * GPU handles and streams). A thread which serves many
+ * requests should call Timer::enable(false), since timer
+ * items otherwise accumulate for the life of the thread.
+ *
  * @param X
  */
 std::vector<int> Pipeline::predict(const Matrix& X_) const
@@ -145,13 +538,42 @@ std::vector<int> Pipeline::predict(const Matrix& X_) const
 	Timer::push("Prediction");
 
 	// perform feature extraction
-	Matrix X(std::move(X_));
+	Matrix X;
+	const Matrix& X_out = transform(&X_, X);
 
-	for ( auto transform : _transforms )
+	// compute predicted labels
+	std::vector<int> y_pred = _estimator->predict(X_out);
+
+	Timer::pop();
+
+	return y_pred;
+}
+
+
+
+/**
+ * Use the pipeline to predict on a dataset which is no
+ * longer needed, so that the transforms can reuse its memory.
+ * If the dataset shares its memory, such as a view of a
+ * dataset, it is not modified and the overload for a const
+ * dataset is used instead.
+ *
+ * @param X
+ */
+std::vector<int> Pipeline::predict(Matrix&& X_) const
+{
+	if ( X_.is_shared() )
 	{
-		X = transform->transform(X);
+		return predict(static_cast<const Matrix&>(X_));
 	}
 
+	Timer::push("Prediction");
+
+	// perform feature extraction
+	Matrix X(std::move(X_));
+
+	transform(nullptr, X);
+
 	// compute predicted labels
 	std::vector<int> y_pred = _estimator->predict(X);
 
@@ -162,6 +584,50 @@ std::vector<int> Pipeline::predict(const Matrix& X_) const
 
 
 
+/**
+ * Use the pipeline to predict on a dataset which is read
+ * from a data iterator in chunks of columns, so that the
+ * dataset never has to fit in memory. The chunks are read
+ * by a batch iterator, which loads the next chunk while the
+ * current chunk is transformed and classified. The labels
+ * of each chunk are passed to the callback, if given, along
+ * with the index of the first sample in the chunk.
+ *
+ * @param iter
+ * @param chunk_size
+ * @param callback
+ */
+std::vector<int> Pipeline::predict(DataIterator *iter, int chunk_size, const std::function<void(int, const std::vector<int>&)>& callback) const
+{
+	Timer::push("Prediction");
+
+	BatchIterator batches(iter, chunk_size);
+
+	std::vector<int> y_pred;
+	y_pred.reserve(iter->num_samples());
+
+	Matrix X;
+
+	while ( batches.next() )
+	{
+		// compute predicted labels for the current chunk
+		std::vector<int> y_chunk = _estimator->predict(transform(&batches.batch(), X));
+
+		if ( callback )
+		{
+			callback(batches.offset(), y_chunk);
+		}
+
+		y_pred.insert(y_pred.end(), y_chunk.begin(), y_chunk.end());
+	}
+
+	Timer::pop();
+
+	return y_pred;
+}
+
+
+
 /**
  * Score a pipeline against ground truth labels.
  *
@@ -171,17 +637,277 @@ std::vector<int> Pipeline::predict(const Matrix& X_) const
 float Pipeline::score(const Matrix& X_, const std::vector<int>& y) const
 {
 	// perform feature extraction
-	Matrix X(std::move(X_));
+	Matrix X;
+	const Matrix& X_out = transform(&X_, X);
 
-	for ( auto transform : _transforms )
+	// score estimator
+	return _estimator->score(X_out, y);
+}
+
+
+
+/**
+ * Score a pipeline against ground truth labels on a dataset
+ * which is no longer needed.
+ * If the dataset shares its memory, such as a view of a
+ * dataset, it is not modified and the overload for a const
+ * dataset is used instead.
+ *
+ * @param X
+ * @param y
+ */
+float Pipeline::score(Matrix&& X_, const std::vector<int>& y) const
+{
+	if ( X_.is_shared() )
 	{
-		X = transform->transform(X);
+		return score(static_cast<const Matrix&>(X_), y);
 	}
 
+	// perform feature extraction
+	Matrix X(std::move(X_));
+
+	transform(nullptr, X);
+
 	// score estimator
 	return _estimator->score(X, y);
 }
 
 
 
+/**
+ * Get the affine map of a transform. A diagonal map, such
+ * as that of a scaler, is returned as the vector of its
+ * diagonal, so that it is never stored as a dense matrix.
+ *
+ * @param transform
+ * @param A
+ * @param b
+ * @param diagonal
+ */
+bool get_affine(const TransformerLayer *transform, Matrix& A, Matrix& b, bool& diagonal)
+{
+	diagonal = false;
+
+	if ( transform->affine(A, b) )
+	{
+		return true;
+	}
+
+	diagonal = true;
+
+	return transform->diagonal_affine(A, b);
+}
+
+
+
+/**
+ * Scale each row i of a matrix by a_i, which computes
+ * diag(a) * A.
+ *
+ * @param A
+ * @param a
+ */
+void scale_rows(Matrix& A, const Matrix& a)
+{
+	for ( int j = 0; j < A.cols(); j++ )
+	{
+		for ( int i = 0; i < A.rows(); i++ )
+		{
+			A.elem(i, j) *= a.elem(i);
+		}
+	}
+
+	A.gpu_write();
+}
+
+
+
+/**
+ * Scale each column j of a matrix by a_j, which computes
+ * A * diag(a).
+ *
+ * @param A
+ * @param a
+ */
+void scale_columns(Matrix& A, const Matrix& a)
+{
+	for ( int j = 0; j < A.cols(); j++ )
+	{
+		float a_j = a.elem(j);
+
+		for ( int i = 0; i < A.rows(); i++ )
+		{
+			A.elem(i, j) *= a_j;
+		}
+	}
+
+	A.gpu_write();
+}
+
+
+
+/**
+ * Fold each run of two or more consecutive affine transforms
+ * into a single affine map, so that the run can be applied
+ * with one matrix product at prediction time:
+ *
+ *   A = A_j * ... * A_i
+ *   b = A_j * (... (A_i+1 * b_i + b_i+1) ...) + b_j
+ *
+ * Diagonal maps are folded without forming a dense matrix:
+ * a diagonal map after A scales the rows of A and b, and a
+ * diagonal map before A scales the columns of A. A run of
+ * diagonal maps remains diagonal.
+ */
+void Pipeline::fuse_transforms()
+{
+	_fused.clear();
+
+	int num_transforms = _transforms.size();
+	int i = 0;
+
+	while ( i < num_transforms )
+	{
+		fused_transform_t fused;
+
+		if ( !get_affine(_transforms[i], fused.A, fused.b, fused.diagonal) )
+		{
+			i++;
+			continue;
+		}
+
+		// compose the following affine transforms
+		int j = i + 1;
+		Matrix A;
+		Matrix b;
+		bool diagonal;
+
+		while ( j < num_transforms && get_affine(_transforms[j], A, b, diagonal) )
+		{
+			if ( diagonal )
+			{
+				// compute A = diag(a_j) * A, b = diag(a_j) * b + b_j
+				scale_rows(fused.A, A);
+				scale_rows(fused.b, A);
+				fused.b += b;
+			}
+			else
+			{
+				// compute A = A_j * A, b = A_j * b + b_j
+				b.gemm(1.0f, A, fused.b, 1.0f);
+
+				if ( fused.diagonal )
+				{
+					scale_columns(A, fused.A);
+					fused.A = std::move(A);
+					fused.diagonal = false;
+				}
+				else
+				{
+					fused.A = A * fused.A;
+				}
+
+				fused.b = std::move(b);
+			}
+
+			j++;
+		}
+
+		// save runs of at least two transforms
+		if ( j - i >= 2 )
+		{
+			Logger::log(LogLevel::Debug, "debug: fused transforms %d-%d into [%d,%d]%s",
+				i + 1, j, fused.A.rows(), fused.A.cols(),
+				fused.diagonal ? " (diagonal)" : "");
+
+			fused.begin = i;
+			fused.end = j;
+			_fused.push_back(std::move(fused));
+		}
+
+		i = j;
+	}
+}
+
+
+
+/**
+ * Apply the transforms of a pipeline to a dataset, using
+ * the fused affine maps where available, and return the
+ * output of the last transform.
+ *
+ * If input is given, the first stage reads it directly and
+ * writes its output to X. Otherwise the dataset is X, and the
+ * transforms which are not fused are applied in place. In
+ * either case at most one intermediate result is held at a
+ * time in addition to the dataset.
+ *
+ * @param input
+ * @param X
+ */
+const Matrix& Pipeline::transform(const Matrix *input, Matrix& X) const
+{
+	int num_transforms = _transforms.size();
+	size_t f = 0;
+	int i = 0;
+
+	while ( i < num_transforms )
+	{
+		const Matrix& X_in = input ? *input : X;
+
+		if ( f < _fused.size() && _fused[f].begin == i && _fused[f].diagonal )
+		{
+			// compute X = diag(a) * X + b * 1_N'
+			const fused_transform_t& fused = _fused[f];
+
+			if ( input )
+			{
+				X = Matrix(*input);
+			}
+
+			#pragma omp parallel for
+			for ( int j = 0; j < X.cols(); j++ )
+			{
+				for ( int k = 0; k < X.rows(); k++ )
+				{
+					X.elem(k, j) = fused.A.elem(k) * X.elem(k, j) + fused.b.elem(k);
+				}
+			}
+
+			X.gpu_write();
+
+			i = fused.end;
+			f++;
+		}
+		else if ( f < _fused.size() && _fused[f].begin == i )
+		{
+			// compute X = A * X + b * 1_N'
+			const fused_transform_t& fused = _fused[f];
+			Matrix Y = fused.b * Matrix::ones(1, X_in.cols());
+
+			Y.gemm(1.0f, fused.A, X_in, 1.0f);
+
+			X = std::move(Y);
+			i = fused.end;
+			f++;
+		}
+		else if ( input )
+		{
+			X = _transforms[i]->transform(*input);
+			i++;
+		}
+		else
+		{
+			_transforms[i]->transform_inplace(X);
+			i++;
+		}
+
+		input = nullptr;
+	}
+
+	return input ? *input : X;
+}
+
+
+
 }
@@ -6,7 +6,12 @@
 #ifndef MLEARN_LAYER_PIPELINE_H
 #define MLEARN_LAYER_PIPELINE_H
 
+#include <cstdint>
+#include <functional>
+#include <string>
+#include "mlearn/data/dataiterator.h"
 #include "mlearn/layer/estimator.h"
+#include "mlearn/layer/modelfile.h"
 #include "mlearn/layer/transformer.h"
 
 
@@ -15,23 +20,51 @@ namespace mlearn {
 
 
 
+typedef struct {
+	int begin;
+	int end;
+	bool diagonal;
+	Matrix A;
+	Matrix b;
+} fused_transform_t;
+
+
+
 class Pipeline : public EstimatorLayer {
 public:
 	Pipeline(std::vector<TransformerLayer *> transforms, EstimatorLayer *estimator);
 	~Pipeline() {}
 
+	void set_cache(const std::string& path, bool cache_output=false);
+
 	void save(IODevice& file) const;
 	void load(IODevice& file);
+	void save(const std::string& path, ModelCompression compression=ModelCompression::none) const;
+	void load(const std::string& path);
 	void print() const;
 
 	void fit(const Matrix& X);
+	void fit(Matrix&& X);
 	void fit(const Matrix& X, const std::vector<int>& y, int c);
+	void fit(Matrix&& X, const std::vector<int>& y, int c);
 	std::vector<int> predict(const Matrix& X) const;
+	std::vector<int> predict(Matrix&& X) const;
+	std::vector<int> predict(DataIterator *iter, int chunk_size, const std::function<void(int, const std::vector<int>&)>& callback=nullptr) const;
 	float score(const Matrix& X, const std::vector<int>& y) const;
+	float score(Matrix&& X, const std::vector<int>& y) const;
 
 private:
+	const Matrix& fit_transforms(const Matrix *input, Matrix& X, const std::vector<int>& y, int c, bool supervised);
+	bool load_cached(TransformerLayer *transform, uint64_t key, const Matrix *input, Matrix& X) const;
+	void save_cached(const TransformerLayer *transform, uint64_t key, Matrix& X) const;
+	void fuse_transforms();
+	const Matrix& transform(const Matrix *input, Matrix& X) const;
+
 	std::vector<TransformerLayer *> _transforms;
 	EstimatorLayer *_estimator;
+	std::vector<fused_transform_t> _fused;
+	std::string _cache_path;
+	bool _cache_output {false};
 };
 
 
@@ -19,9 +19,13 @@ class TransformerLayer : public Layer {
 public:
 	virtual ~TransformerLayer() {}
 
+	virtual TransformerLayer * clone() const = 0;
 	virtual void fit(const Matrix& X) = 0;
 	virtual void fit(const Matrix& X, const std::vector<int>& y, int c) = 0;
 	virtual Matrix transform(const Matrix& X) const = 0;
+	virtual void transform_inplace(Matrix& X) const { X = transform(X); }
+	virtual bool affine(Matrix& A, Matrix& b) const { return false; }
+	virtual bool diagonal_affine(Matrix& a, Matrix& b) const { return false; }
 };
 
 
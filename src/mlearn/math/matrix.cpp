@@ -3,6 +3,7 @@
  *
  * Implementation of the matrix type.
  */
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <cstring>
@@ -70,13 +71,32 @@ inline int length(const Matrix& v)
  * @param cols
  */
 Matrix::Matrix(int rows, int cols)
+	: Matrix(rows, cols, std::make_shared<Buffer<float>>(rows * cols))
+{
+}
+
+
+
+/**
+ * Construct a matrix on an existing buffer. The buffer
+ * is shared rather than copied, so that a matrix can be
+ * constructed on memory which is owned by another object,
+ * such as a memory-mapped dataset.
+ *
+ * @param rows
+ * @param cols
+ * @param buffer
+ */
+Matrix::Matrix(int rows, int cols, const std::shared_ptr<Buffer<float>>& buffer)
 {
 	Logger::log(LogLevel::Debug, "debug: new Matrix(%d, %d)",
 		rows, cols);
 
+	assert(buffer->size() == (size_t)rows * cols);
+
 	_rows = rows;
 	_cols = cols;
-	_buffer.reset(new Buffer<float>(rows * cols));
+	_buffer = buffer;
 	_transposed = false;
 	_T = new Matrix();
 
@@ -112,7 +132,8 @@ Matrix::Matrix(int rows, int cols, float *data)
 
 
 /**
- * Copy a range of columns in a matrix.
+ * Copy a range of columns in a matrix. The range may be
+ * empty, so that an empty matrix can be copied.
  *
  * @param M
  * @param i
@@ -125,7 +146,11 @@ Matrix::Matrix(const Matrix& M, int i, int j)
 		_rows, _cols,
 		i + 1, j, M._rows, j - i);
 
-	assert(0 <= i && i < j && j <= M._cols);
+	assert(0 <= i && i <= j && j <= M._cols);
+
+	if ( _rows * _cols == 0 ) {
+		return;
+	}
 
 	memcpy(_buffer->host_data(), &M.elem(0, i), _rows * _cols * sizeof(float));
 
@@ -344,28 +369,52 @@ IODevice& operator<<(IODevice& file, const Matrix& M)
 {
 	file << M._rows;
 	file << M._cols;
-	file.write(reinterpret_cast<const char *>(M._buffer->host_data()), M._rows * M._cols * sizeof(float));
+
+	if ( M._rows * M._cols != 0 ) {
+		file.write(reinterpret_cast<const char *>(M._buffer->host_data()), M._rows * M._cols * sizeof(float));
+	}
 	return file;
 }
 
 
 
 /**
- * Load a matrix from a file.
+ * Load a matrix from a file, replacing its contents. If the
+ * file is memory-mapped, the matrix uses the mapped data in
+ * place instead of copying it. The size is checked against
+ * the remaining length of the file before the matrix is
+ * allocated, so that a corrupt size fails the read instead
+ * of exhausting memory.
  */
 IODevice& operator>>(IODevice& file, Matrix& M)
 {
-	if ( M._rows * M._cols != 0 ) {
-		Logger::log(LogLevel::Error, "error: cannot load into non-empty matrix");
-		exit(1);
-	}
-
 	int rows, cols;
 	file >> rows;
 	file >> cols;
 
-	M = Matrix(rows, cols);
-	file.read(reinterpret_cast<char *>(M._buffer->host_data()), M._rows * M._cols * sizeof(float));
+	size_t size = (size_t)std::max(0, rows) * std::max(0, cols);
+
+	if ( file.fail() || rows < 0 || cols < 0 || !file.can_read(size * sizeof(float)) ) {
+		file.setstate(std::ios_base::failbit);
+		M = Matrix();
+		return file;
+	}
+
+	const char *data = (size > 0)
+		? file.map(size * sizeof(float), alignof(float))
+		: nullptr;
+
+	if ( data != nullptr ) {
+		float *host = reinterpret_cast<float *>(const_cast<char *>(data));
+
+		M = Matrix(rows, cols, std::make_shared<Buffer<float>>(size, host, file.mapping()));
+	}
+	else {
+		M = Matrix(rows, cols);
+		file.read(reinterpret_cast<char *>(M._buffer->host_data()), size * sizeof(float));
+	}
+
+	M.gpu_write();
 	return file;
 }
 
@@ -388,6 +437,65 @@ void Matrix::print() const
 
 
 
+/**
+ * Determine whether the memory of a matrix is shared with
+ * another object, such as a view of a dataset or a mapped
+ * file. A shared matrix must not be modified in place,
+ * because the changes would be visible to the other object.
+ * The buffer is always shared with the transpose.
+ */
+bool Matrix::is_shared() const
+{
+	if ( !_buffer ) {
+		return false;
+	}
+
+	long num_users = (_T != nullptr) ? 2 : 1;
+
+	return _buffer.use_count() > num_users || _buffer->has_owner();
+}
+
+
+
+/**
+ * Compute the Cholesky decomposition of a symmetric
+ * positive-definite matrix:
+ *
+ *   M = L * L'
+ *
+ * The lower-triangular factor L is returned.
+ */
+Matrix Matrix::cholesky() const
+{
+	const Matrix& M = *this;
+
+	Logger::log(LogLevel::Debug, "debug: L [%d,%d] <- chol(M [%d,%d])",
+		M._rows, M._cols, M._rows, M._cols);
+
+	assert(is_square(M));
+
+	// compute Cholesky decomposition
+	Matrix L = M;
+	bool success = potrf(L);
+
+	CHECK_ERROR(success, "Failed to compute Cholesky decomposition");
+
+	L.gpu_read();
+
+	// zero the upper triangle, which is not referenced by potrf
+	for ( int j = 1; j < L._cols; j++ ) {
+		for ( int i = 0; i < j; i++ ) {
+			L.elem(i, j) = 0;
+		}
+	}
+
+	L.gpu_write();
+
+	return L;
+}
+
+
+
 /**
  * Compute the determinant of a matrix using LU decomposition:
  *
@@ -499,6 +607,60 @@ void Matrix::eigen(int n1, Matrix& V, Matrix& D) const
 
 
 
+/**
+ * Compute the eigenvalues and eigenvectors of the generalized
+ * symmetric-definite eigenproblem:
+ *
+ *   M * v = lambda * B * v
+ *
+ * where M is symmetric and B is symmetric positive definite.
+ * The problem is reduced to a standard eigenproblem with the
+ * Cholesky factor of B, so B is never inverted explicitly.
+ *
+ * The eigenvalues and eigenvectors are returned as in eigen().
+ * The eigenvectors are normalized so that V' * B * V = I.
+ *
+ * @param B
+ * @param n1
+ * @param V
+ * @param D
+ */
+void Matrix::eigen(const Matrix& B, int n1, Matrix& V, Matrix& D) const
+{
+	const Matrix& M = *this;
+
+	Logger::log(LogLevel::Debug, "debug: V [%d,%d], D [%d,%d] <- eig(M [%d,%d], B [%d,%d], %d)",
+		M._rows, n1,
+		n1, n1,
+		M._rows, M._cols,
+		B._rows, B._cols, n1);
+
+	V = M;
+	D = Matrix(1, M._cols);
+
+	// compute eigenvalues and eigenvectors
+	bool success = sygv(B, V, D);
+
+	CHECK_ERROR(success, "Failed to compute generalized eigendecomposition");
+
+	V.gpu_read();
+	D.gpu_read();
+
+	// take only positive eigenvalues
+	int i = 0;
+	while ( i < D._cols && D.elem(0, i) < EPSILON ) {
+		i++;
+	}
+
+	// take only the n1 largest eigenvalues
+	i = std::max(i, D._cols - n1);
+
+	V = V(i, V._cols);
+	D = D(i, D._cols).diagonalize();
+}
+
+
+
 /**
  * Compute the inverse of a square matrix using LU decomposition.
  */
@@ -1157,6 +1319,57 @@ void Matrix::syrk(bool trans, float alpha, const Matrix& A, float beta)
 
 
 
+/**
+ * Wrapper function for BLAS trsm:
+ *
+ *   B <- alpha * A^-1 * B
+ *   B <- alpha * A'^-1 * B
+ *
+ * where A is lower triangular.
+ *
+ * @param alpha
+ * @param A
+ */
+void Matrix::trsm(float alpha, const Matrix& A)
+{
+	Matrix& B = *this;
+
+	Logger::log(LogLevel::Debug, "debug: B [%d,%d] <- %g * inv(A%s [%d,%d]) * B",
+		B._rows, B._cols,
+		alpha, A._transposed ? "'" : "", A._rows, A._cols);
+
+	assert(is_square(A) && A._rows == B._rows);
+
+	int m = B._rows;
+	int n = B._cols;
+
+	if ( Device::instance() ) {
+		cublasOperation_t TransA = A._transposed ? CUBLAS_OP_T : CUBLAS_OP_N;
+
+		CHECK_CUBLAS(cublasStrsm(
+			Device::instance()->cublas_handle(),
+			CUBLAS_SIDE_LEFT, CUBLAS_FILL_MODE_LOWER, TransA, CUBLAS_DIAG_NON_UNIT,
+			m, n, &alpha,
+			A._buffer->device_data(), A._rows,
+			B._buffer->device_data(), B._rows
+		));
+
+		B.gpu_read();
+	}
+	else {
+		CBLAS_TRANSPOSE TransA = A._transposed ? CblasTrans : CblasNoTrans;
+
+		cblas_strsm(
+			CblasColMajor, CblasLeft, CblasLower, TransA, CblasNonUnit,
+			m, n, alpha,
+			A._buffer->host_data(), A._rows,
+			B._buffer->host_data(), B._rows
+		);
+	}
+}
+
+
+
 /**
  * Wrapper function for LAPACK gesvd:
  *
@@ -1315,6 +1528,58 @@ bool Matrix::getrs(const Matrix& A, Matrix& B, Buffer<int>& ipiv) const
 
 
 
+/**
+ * Wrapper function for LAPACK potrf:
+ *
+ *   A = L * L'
+ *
+ * @param L
+ */
+bool Matrix::potrf(Matrix& L) const
+{
+	const Matrix& A = *this;
+
+	assert(is_square(A));
+
+	int n = A._cols;
+	int lda = A._rows;
+
+	if ( Device::instance() ) {
+		int lwork;
+
+		CHECK_CUSOLVER(cusolverDnSpotrf_bufferSize(
+			Device::instance()->cusolver_handle(),
+			CUBLAS_FILL_MODE_LOWER,
+			n, L._buffer->device_data(), lda,
+			&lwork
+		));
+
+		Buffer<float> work(lwork, false);
+		Buffer<int> info(1);
+
+		CHECK_CUSOLVER(cusolverDnSpotrf(
+			Device::instance()->cusolver_handle(),
+			CUBLAS_FILL_MODE_LOWER,
+			n, L._buffer->device_data(), lda,
+			work.device_data(), lwork,
+			info.device_data()
+		));
+
+		info.read();
+		return (info.host_data()[0] == 0);
+	}
+	else {
+		int info = LAPACKE_spotrf_work(
+			LAPACK_COL_MAJOR, 'L',
+			n, L._buffer->host_data(), lda
+		);
+
+		return (info == 0);
+	}
+}
+
+
+
 /**
  * Wrapper function for LAPACK syev:
  *
@@ -1376,6 +1641,86 @@ void Matrix::syev(Matrix& V, Matrix& D) const
 
 
 
+/**
+ * Wrapper function for LAPACK sygv:
+ *
+ *   A * V = B * V * D
+ *
+ * V should contain a copy of A, which is overwritten with
+ * the eigenvectors. Returns false if B is not positive
+ * definite or the eigenvalues did not converge.
+ *
+ * @param B
+ * @param V
+ * @param D
+ */
+bool Matrix::sygv(const Matrix& B, Matrix& V, Matrix& D) const
+{
+	const Matrix& A = *this;
+
+	assert(is_square(A));
+	assert(A._rows == B._rows && A._cols == B._cols);
+
+	int n = A._cols;
+	int lda = A._rows;
+	int ldb = B._rows;
+
+	// sygv overwrites B with its Cholesky factor
+	Matrix B_work = B;
+
+	if ( Device::instance() ) {
+		int lwork;
+
+		CHECK_CUSOLVER(cusolverDnSsygvd_bufferSize(
+			Device::instance()->cusolver_handle(),
+			CUSOLVER_EIG_TYPE_1,
+			CUSOLVER_EIG_MODE_VECTOR,
+			CUBLAS_FILL_MODE_UPPER,
+			n, V._buffer->device_data(), lda,
+			B_work._buffer->device_data(), ldb,
+			D._buffer->device_data(),
+			&lwork
+		));
+
+		Buffer<float> work(lwork, false);
+		Buffer<int> info(1);
+
+		CHECK_CUSOLVER(cusolverDnSsygvd(
+			Device::instance()->cusolver_handle(),
+			CUSOLVER_EIG_TYPE_1,
+			CUSOLVER_EIG_MODE_VECTOR,
+			CUBLAS_FILL_MODE_UPPER,
+			n, V._buffer->device_data(), lda,
+			B_work._buffer->device_data(), ldb,
+			D._buffer->device_data(),
+			work.device_data(), lwork,
+			info.device_data()
+		));
+
+		info.read();
+		return (info.host_data()[0] == 0);
+	}
+	else {
+		int lwork = 1 + 6 * n + 2 * n * n;
+		int liwork = 3 + 5 * n;
+		Buffer<float> work(lwork);
+		Buffer<int> iwork(liwork);
+
+		int info = LAPACKE_ssygvd_work(
+			LAPACK_COL_MAJOR, 1, 'V', 'U',
+			n, V._buffer->host_data(), lda,
+			B_work._buffer->host_data(), ldb,
+			D._buffer->host_data(),
+			work.host_data(), lwork,
+			iwork.host_data(), liwork
+		);
+
+		return (info == 0);
+	}
+}
+
+
+
 /**
  * Swap function for Matrix.
  *
@@ -31,6 +31,7 @@ public:
 	// constructor, destructor functions
 	Matrix(int rows, int cols);
 	Matrix(int rows, int cols, float *data);
+	Matrix(int rows, int cols, const std::shared_ptr<Buffer<float>>& buffer);
 	Matrix(const Matrix& M, int i, int j);
 	Matrix(const Matrix& M);
 	Matrix(Matrix&& M);
@@ -62,10 +63,13 @@ public:
 	const float& elem(int i, int j=0) const { return _buffer->host_data()[j * _rows + i]; }
 	float& elem(int i, int j=0) { return _buffer->host_data()[j * _rows + i]; }
 	const Matrix& T() const { return *_T; }
+	bool is_shared() const;
 
+	Matrix cholesky() const;
 	float determinant() const;
 	Matrix diagonalize() const;
 	void eigen(int n1, Matrix& V, Matrix& D) const;
+	void eigen(const Matrix& B, int n1, Matrix& V, Matrix& D) const;
 	Matrix inverse() const;
 	Matrix mean_column() const;
 	Matrix mean_row() const;
@@ -91,12 +95,15 @@ public:
 	void scal(float c);
 	void syr(float alpha, const Matrix& x);
 	void syrk(bool trans, float alpha, const Matrix& A, float beta);
+	void trsm(float alpha, const Matrix& A);
 
 	// LAPACK wrapper functions
 	void gesvd(Matrix& U, Matrix& S, Matrix& VT) const;
 	void getrf(Matrix& U, Buffer<int>& ipiv) const;
 	bool getrs(const Matrix& A, Matrix& B, Buffer<int>& ipiv) const;
+	bool potrf(Matrix& L) const;
 	void syev(Matrix& V, Matrix& D) const;
+	bool sygv(const Matrix& B, Matrix& V, Matrix& D) const;
 
 	// operators
 	inline Matrix operator()(int i, int j) const { return Matrix(*this, i, j); }
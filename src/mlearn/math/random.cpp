@@ -12,15 +12,20 @@ namespace mlearn {
 
 
 
-std::default_random_engine Random::_rng;
-std::uniform_int_distribution<int> Random::_Ui;
-std::uniform_real_distribution<float> Random::_Ur;
-std::normal_distribution<float> Random::_N;
+thread_local std::default_random_engine Random::_rng;
+thread_local std::uniform_int_distribution<int> Random::_Ui;
+thread_local std::uniform_real_distribution<float> Random::_Ur;
+thread_local std::normal_distribution<float> Random::_N;
 
 
 
 /**
- * Seed the global random number engine with the current time.
+ * Seed the random number engine of the calling thread. Each
+ * thread has its own engine, so a worker thread should be
+ * seeded before it draws any random numbers. A value of zero
+ * seeds the engine with the current time.
+ *
+ * @param value
  */
 void Random::seed(unsigned int value)
 {
@@ -72,4 +77,19 @@ float Random::normal(float mu, float sigma)
 
 
 
+/**
+ * Create an independent random number engine which is
+ * seeded from the engine of the calling thread. The seed is mixed through
+ * a seed sequence so that forked engines do not produce
+ * overlapping streams.
+ */
+std::default_random_engine Random::fork()
+{
+	std::seed_seq seq { _rng(), _rng() };
+
+	return std::default_random_engine(seq);
+}
+
+
+
 }
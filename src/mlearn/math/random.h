@@ -21,14 +21,15 @@ public:
 	static int uniform_int(int a, int b);
 	static float uniform_real(float a=0, float b=1);
 	static float normal(float mu=0, float sigma=1);
+	static std::default_random_engine fork();
 
 	template<class T>
 	static void shuffle(std::vector<T>& v);
 private:
-	static std::default_random_engine _rng;
-	static std::uniform_int_distribution<int> _Ui;
-	static std::uniform_real_distribution<float> _Ur;
-	static std::normal_distribution<float> _N;
+	static thread_local std::default_random_engine _rng;
+	static thread_local std::uniform_int_distribution<int> _Ui;
+	static thread_local std::uniform_real_distribution<float> _Ur;
+	static thread_local std::normal_distribution<float> _N;
 };
 
 
@@ -3,6 +3,10 @@
  *
  * Implementation of the scaler type.
  */
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <omp.h>
 #include "mlearn/preprocessing/scaler.h"
 
 
@@ -19,58 +23,291 @@ Scaler::Scaler(bool with_mean, bool with_std)
 
 
 
+/**
+ * Fit a scaler to a dataset.
+ *
+ * @param X
+ */
 void Scaler::fit(const Matrix& X)
 {
-	// compute row-wise mean of X
-	if ( _with_mean )
+	_count = 0;
+	_mu.clear();
+	_m2.clear();
+
+	partial_fit(X);
+}
+
+
+
+/**
+ * Merge the mean and sum of squared deviations of two sets
+ * of samples (Chan et al.):
+ *
+ *   mu = mu_a + delta * n_b / n
+ *   m2 = m2_a + m2_b + delta^2 * n_a * n_b / n
+ *
+ * where delta = mu_b - mu_a and n = n_a + n_b.
+ *
+ * @param n_a
+ * @param mu_a
+ * @param m2_a
+ * @param n_b
+ * @param mu_b
+ * @param m2_b
+ */
+void merge_moments(long& n_a, std::vector<double>& mu_a, std::vector<double>& m2_a, long n_b, const std::vector<double>& mu_b, const std::vector<double>& m2_b)
+{
+	if ( n_b == 0 )
 	{
-		_mean = X.mean_column();
+		return;
 	}
 
-	// compute row-wise stddev of X
-	if ( _with_std )
+	if ( n_a == 0 )
+	{
+		n_a = n_b;
+		mu_a = mu_b;
+		m2_a = m2_b;
+		return;
+	}
+
+	double n = n_a + n_b;
+	double w = n_a * (double) n_b / n;
+
+	for ( size_t i = 0; i < mu_a.size(); i++ )
+	{
+		double delta = mu_b[i] - mu_a[i];
+
+		mu_a[i] += delta * n_b / n;
+		m2_a[i] += m2_b[i] + delta * delta * w;
+	}
+
+	n_a += n_b;
+}
+
+
+
+/**
+ * Update a scaler with a batch of samples, so that a dataset
+ * which does not fit in memory can be fit in batches. The
+ * mean and variance are accumulated in one pass with Welford's
+ * algorithm, and the columns are divided into blocks which are
+ * processed in parallel and then merged, which is numerically
+ * stable and reads the matrix in storage order.
+ *
+ * The running moments are not saved with the scaler, so a
+ * loaded scaler is refit by the next call.
+ *
+ * @param X
+ */
+void Scaler::partial_fit(const Matrix& X)
+{
+	int D = X.rows();
+	int N = X.cols();
+
+	if ( _count == 0 )
 	{
-		_std = Matrix::zeros(X.rows(), 1);
+		_mu.assign(D, 0.0);
+		_m2.assign(D, 0.0);
+	}
+
+	assert(_mu.size() == (size_t) D);
 
-		for ( int i = 0; i < X.rows(); i++ )
+	if ( N == 0 )
+	{
+		return;
+	}
+
+	// compute the moments of each block of columns
+	const float *x = &X.elem(0, 0);
+	int num_blocks = std::max(1, std::min(omp_get_max_threads(), N));
+
+	std::vector<long> counts(num_blocks, 0);
+	std::vector<std::vector<double>> mus(num_blocks);
+	std::vector<std::vector<double>> m2s(num_blocks);
+
+	#pragma omp parallel for schedule(static, 1)
+	for ( int b = 0; b < num_blocks; b++ )
+	{
+		int begin = (long) N * b / num_blocks;
+		int end = (long) N * (b + 1) / num_blocks;
+		std::vector<double> mu(D, 0.0);
+		std::vector<double> m2(D, 0.0);
+		double *mu_data = mu.data();
+		double *m2_data = m2.data();
+
+		for ( int j = begin; j < end; j++ )
 		{
-			for ( int j = 0; j < X.cols(); j++ )
+			const float *x_j = x + (size_t) j * D;
+			double inv_n = 1.0 / (j - begin + 1);
+
+			#pragma omp simd
+			for ( int i = 0; i < D; i++ )
 			{
-				float temp = X.elem(i, j) - _mean.elem(i);
-				_std.elem(i) += temp * temp;
+				double delta = x_j[i] - mu_data[i];
+
+				mu_data[i] += delta * inv_n;
+				m2_data[i] += delta * (x_j[i] - mu_data[i]);
 			}
 		}
 
-		_std /= X.cols();
-		_std.elem_apply(sqrtf);
+		counts[b] = end - begin;
+		mus[b] = std::move(mu);
+		m2s[b] = std::move(m2);
+	}
+
+	// merge the blocks into the running moments
+	for ( int b = 0; b < num_blocks; b++ )
+	{
+		merge_moments(_count, _mu, _m2, counts[b], mus[b], m2s[b]);
+	}
+
+	// update the mean and standard deviation
+	_mean = Matrix();
+	_std = Matrix();
+
+	if ( _with_mean )
+	{
+		_mean = Matrix(D, 1);
+
+		for ( int i = 0; i < D; i++ )
+		{
+			_mean.elem(i) = _mu[i];
+		}
+
+		_mean.gpu_write();
+	}
+
+	if ( _with_std )
+	{
+		_std = Matrix(D, 1);
+
+		for ( int i = 0; i < D; i++ )
+		{
+			_std.elem(i) = (_count > 0) ? sqrt(_m2[i] / _count) : 0;
+		}
+
+		_std.gpu_write();
 	}
 }
 
 
 
-Matrix Scaler::transform(const Matrix& X_) const
+/**
+ * Transform a dataset with a scaler.
+ *
+ * @param X
+ */
+Matrix Scaler::transform(const Matrix& X) const
 {
-	Matrix X(X_);
+	Matrix Y(X);
 
-	// subtract row-wise mean from X
-	if ( _with_mean )
+	transform_inplace(Y);
+
+	return Y;
+}
+
+
+
+/**
+ * Transform a dataset in place with a scaler. The mean is
+ * subtracted and the result is scaled in a single pass over
+ * the matrix. If the matrix shares its memory, such as a
+ * view of a dataset, it is copied first.
+ *
+ * @param X
+ */
+void Scaler::transform_inplace(Matrix& X) const
+{
+	if ( !_with_mean && !_with_std )
 	{
-		X.subtract_columns(_mean);
+		return;
 	}
 
-	// scale X by row-wise stddev
-	if ( _with_std )
+	if ( X.is_shared() )
 	{
-		for ( int i = 0; i < X.rows(); i++ )
+		X = Matrix(X);
+	}
+
+	int D = X.rows();
+	int N = X.cols();
+
+	// compute the offset and scale of each row
+	std::vector<float> offset(D, 0.0f);
+	std::vector<float> scale(D, 1.0f);
+
+	for ( int i = 0; i < D; i++ )
+	{
+		if ( _with_mean )
 		{
-			for ( int j = 0; j < X.cols(); j++ )
-			{
-				X.elem(i, j) /= _std.elem(i);
-			}
+			offset[i] = _mean.elem(i);
+		}
+
+		if ( _with_std )
+		{
+			scale[i] = 1 / _std.elem(i);
 		}
 	}
 
-	return X;
+	// compute X = (X - mean * 1_N') .* (1 / std)
+	float *x = &X.elem(0, 0);
+	const float *offset_data = offset.data();
+	const float *scale_data = scale.data();
+
+	#pragma omp parallel for
+	for ( int j = 0; j < N; j++ )
+	{
+		float *x_j = x + (size_t) j * D;
+
+		#pragma omp simd
+		for ( int i = 0; i < D; i++ )
+		{
+			x_j[i] = (x_j[i] - offset_data[i]) * scale_data[i];
+		}
+	}
+
+	X.gpu_write();
+}
+
+
+
+/**
+ * Get the affine map of a scaler, which is diagonal:
+ *
+ *   transform(X) = diag(1 / std) * (X - mean * 1_N')
+ *
+ * which gives a = 1 ./ std and b = -mean ./ std.
+ *
+ * @param a
+ * @param b
+ */
+bool Scaler::diagonal_affine(Matrix& a, Matrix& b) const
+{
+	if ( !_with_mean && !_with_std )
+	{
+		return false;
+	}
+
+	int D = _with_mean ? _mean.rows() : _std.rows();
+
+	a = Matrix(D, 1);
+	b = Matrix::zeros(D, 1);
+
+	for ( int i = 0; i < D; i++ )
+	{
+		float scale = _with_std ? 1 / _std.elem(i) : 1;
+
+		a.elem(i) = scale;
+
+		if ( _with_mean )
+		{
+			b.elem(i) = -_mean.elem(i) * scale;
+		}
+	}
+
+	a.gpu_write();
+	b.gpu_write();
+
+	return true;
 }
 
 
@@ -6,6 +6,7 @@
 #ifndef MLEARN_PREPROCESSING_SCALER_H
 #define MLEARN_PREPROCESSING_SCALER_H
 
+#include <vector>
 #include "mlearn/layer/transformer.h"
 #include "mlearn/math/matrix.h"
 
@@ -18,9 +19,13 @@ class Scaler : public TransformerLayer {
 public:
 	Scaler(bool with_mean=true, bool with_std=true);
 
+	TransformerLayer * clone() const { return new Scaler(*this); }
 	void fit(const Matrix& X);
 	void fit(const Matrix& X, const std::vector<int>& y, int c) { fit(X); }
+	void partial_fit(const Matrix& X);
 	Matrix transform(const Matrix& X) const;
+	void transform_inplace(Matrix& X) const;
+	bool diagonal_affine(Matrix& a, Matrix& b) const;
 
 	void save(IODevice& file) const;
 	void load(IODevice& file);
@@ -31,6 +36,10 @@ private:
 	bool _with_std;
 	Matrix _mean;
 	Matrix _std;
+
+	long _count {0};
+	std::vector<double> _mu;
+	std::vector<double> _m2;
 };
 
 
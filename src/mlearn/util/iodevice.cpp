@@ -3,7 +3,12 @@
  *
  * Implementation of I/O device type.
  */
-#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "mlearn/util/iodevice.h"
 
 
@@ -12,6 +17,245 @@ namespace mlearn {
 
 
 
+const size_t IODEVICE_BUFFER_SIZE = 1 << 20;
+
+
+
+/**
+ * Stream buffer on a block of memory, which is used to read
+ * a memory-mapped file.
+ */
+class MappedBuffer : public std::streambuf {
+public:
+	MappedBuffer(char *data, size_t size)
+	{
+		setg(data, data, data + size);
+	}
+
+protected:
+	pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which)
+	{
+		off_type pos = (dir == std::ios_base::beg) ? off
+			: (dir == std::ios_base::cur) ? (gptr() - eback()) + off
+			: (egptr() - eback()) + off;
+
+		if ( !(which & std::ios_base::in) || pos < 0 || pos > egptr() - eback() ) {
+			return pos_type(off_type(-1));
+		}
+
+		setg(eback(), eback() + pos, egptr());
+		return pos_type(pos);
+	}
+
+	pos_type seekpos(pos_type pos, std::ios_base::openmode which)
+	{
+		return seekoff(off_type(pos), std::ios_base::beg, which);
+	}
+
+	friend class IODevice;
+};
+
+
+
+/**
+ * Open an I/O device on a file.
+ *
+ * Reads and writes go through a large user-space buffer. If
+ * mapped is true, the file is opened for reading and mapped
+ * into memory instead, so that matrices can be loaded without
+ * copying their data (see map()). The mapping is private, so
+ * a mapped matrix can be modified without changing the file.
+ *
+ * @param filename
+ * @param mode
+ * @param mapped
+ */
+IODevice::IODevice(const std::string& filename, std::ios_base::openmode mode, bool mapped)
+	: std::fstream()
+{
+	if ( !mapped ) {
+		_buffer.reset(new char[IODEVICE_BUFFER_SIZE]);
+		std::fstream::rdbuf()->pubsetbuf(_buffer.get(), IODEVICE_BUFFER_SIZE);
+		open(filename, mode);
+		return;
+	}
+
+	// map file into memory
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	struct stat st;
+	void *addr = MAP_FAILED;
+
+	if ( fd != -1 && fstat(fd, &st) == 0 && st.st_size > 0 ) {
+		addr = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	}
+
+	if ( fd != -1 ) {
+		::close(fd);
+	}
+
+	if ( addr == MAP_FAILED ) {
+		setstate(std::ios_base::failbit);
+		return;
+	}
+
+	size_t length = st.st_size;
+
+	_mapping = std::shared_ptr<char>((char *)addr, [length] (char *p) {
+		munmap(p, length);
+	});
+	_mapped_buffer.reset(new MappedBuffer(_mapping.get(), length));
+
+	std::ios::rdbuf(_mapped_buffer.get());
+}
+
+
+
+/**
+ * Open an I/O device for reading on a block of memory, such
+ * as a section of a memory-mapped file. Matrices which are
+ * loaded in place keep the owner of the memory alive.
+ *
+ * @param mapping
+ * @param data
+ * @param size
+ */
+IODevice::IODevice(const std::shared_ptr<char>& mapping, char *data, size_t size)
+	: std::fstream(),
+	  _mapping(mapping),
+	  _mapped_buffer(new MappedBuffer(data, size))
+{
+	std::ios::rdbuf(_mapped_buffer.get());
+}
+
+
+
+/**
+ * Open an I/O device on a stream buffer.
+ *
+ * @param buffer
+ */
+IODevice::IODevice(std::streambuf *buffer)
+	: std::fstream()
+{
+	std::ios::rdbuf(buffer);
+}
+
+
+
+/**
+ * Close an I/O device before its buffers are released.
+ */
+IODevice::~IODevice()
+{
+	if ( std::fstream::is_open() ) {
+		std::fstream::close();
+	}
+}
+
+
+
+/**
+ * Determine whether an I/O device is open.
+ */
+bool IODevice::is_open() const
+{
+	return _mapping
+		? true
+		: std::fstream::is_open();
+}
+
+
+
+/**
+ * Close an I/O device. Matrices which were mapped from the
+ * file keep the mapping alive until they are destroyed.
+ */
+void IODevice::close()
+{
+	if ( _mapping ) {
+		std::ios::rdbuf(nullptr);
+		_mapped_buffer.reset();
+		_mapping.reset();
+	}
+	else {
+		std::fstream::close();
+	}
+}
+
+
+
+/**
+ * Get a pointer to the next block of a mapped file and skip
+ * past it, in order to use the data in place. Returns nullptr
+ * if the file is not mapped, the block is not aligned or the
+ * file is truncated, in which case the block must be read.
+ *
+ * @param size
+ * @param alignment
+ */
+const char * IODevice::map(size_t size, size_t alignment)
+{
+	if ( !_mapping || fail() ) {
+		return nullptr;
+	}
+
+	const char *data = _mapped_buffer->gptr();
+
+	if ( (uintptr_t)data % alignment != 0 || _mapped_buffer->in_avail() < (std::streamsize)size ) {
+		return nullptr;
+	}
+
+	_mapped_buffer->setg(_mapped_buffer->eback(), _mapped_buffer->gptr() + size, _mapped_buffer->egptr());
+
+	return data;
+}
+
+
+
+/**
+ * Determine whether at least size bytes remain to be read,
+ * so that a length which was read from a file can be checked
+ * before memory is allocated for it. A mapped file is checked
+ * against the end of the mapping; any other stream is checked
+ * by seeking to its end, but only if the stream buffer cannot
+ * report the remaining length itself. If the length of the
+ * stream cannot be determined, the read is allowed.
+ *
+ * @param size
+ */
+bool IODevice::can_read(size_t size)
+{
+	std::streambuf *buffer = std::ios::rdbuf();
+
+	if ( fail() || buffer == nullptr ) {
+		return false;
+	}
+
+	std::streamsize avail = buffer->in_avail();
+
+	if ( avail >= (std::streamsize)size ) {
+		return true;
+	}
+
+	if ( avail < 0 || _mapping ) {
+		return false;
+	}
+
+	std::streampos pos = buffer->pubseekoff(0, std::ios_base::cur, std::ios_base::in);
+
+	if ( pos == std::streampos(-1) ) {
+		return true;
+	}
+
+	std::streampos end = buffer->pubseekoff(0, std::ios_base::end, std::ios_base::in);
+
+	buffer->pubseekpos(pos, std::ios_base::in);
+
+	return end != std::streampos(-1) && end - pos >= (std::streamoff)size;
+}
+
+
+
 IODevice& IODevice::operator<<(bool val)
 {
 	write(reinterpret_cast<char *>(&val), sizeof(bool));
@@ -76,10 +320,17 @@ IODevice& IODevice::operator>>(std::string& val)
 	int len;
 	(*this) >> len;
 
-	std::unique_ptr<char[]> buffer(new char[len]);
-	read(buffer.get(), len);
+	if ( fail() || len < 1 || !can_read(len) ) {
+		setstate(std::ios_base::failbit);
+		val.clear();
+		return (*this);
+	}
+
+	// read directly into the string, without the terminator
+	val.resize(len);
+	read(&val[0], len);
 
-	val = std::string(buffer.get());
+	val.resize(strnlen(val.data(), len));
 	return (*this);
 }
 
@@ -5,13 +5,17 @@
  *
  * This class provides methods for loading and saving
  * several common data types to a file, as well as printing
- * to a text stream.
+ * to a text stream. An I/O device can also be constructed
+ * on a stream buffer, such as a std::stringbuf, in order to
+ * serialize data to memory.
  */
 #ifndef MLEARN_UTIL_IODEVICE_H
 #define MLEARN_UTIL_IODEVICE_H
 
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <type_traits>
 #include <vector>
 
 
@@ -20,10 +24,23 @@ namespace mlearn {
 
 
 
+class MappedBuffer;
+
+
+
 class IODevice : public std::fstream {
 public:
-	IODevice(const std::string& filename, std::ios_base::openmode mode)
-		: std::fstream(filename, mode) {}
+	IODevice(const std::string& filename, std::ios_base::openmode mode, bool mapped=false);
+	IODevice(const std::shared_ptr<char>& mapping, char *data, size_t size);
+	IODevice(std::streambuf *buffer);
+	~IODevice();
+
+	bool is_open() const;
+	void close();
+
+	const std::shared_ptr<char>& mapping() const { return _mapping; }
+	const char * map(size_t size, size_t alignment=1);
+	bool can_read(size_t size);
 
 	IODevice& operator<<(bool val);
 	IODevice& operator<<(float val);
@@ -36,41 +53,116 @@ public:
 
 	template<class T> IODevice& operator<<(const std::vector<T>& v);
 	template<class T> IODevice& operator>>(std::vector<T>& v);
+
+private:
+	template<class T>
+	using is_bulk = std::integral_constant<bool, std::is_arithmetic<T>::value && !std::is_same<T, bool>::value>;
+
+	template<class T> void write_elements(const std::vector<T>& v, std::true_type);
+	template<class T> void write_elements(const std::vector<T>& v, std::false_type);
+	template<class T> void read_elements(std::vector<T>& v, int size, std::true_type);
+	template<class T> void read_elements(std::vector<T>& v, int size, std::false_type);
+
+	std::unique_ptr<char[]> _buffer;
+	std::shared_ptr<char> _mapping;
+	std::unique_ptr<MappedBuffer> _mapped_buffer;
 };
 
 
 
+/**
+ * Write a vector to a file. Vectors of arithmetic types are
+ * written with a single call, which produces the same bytes
+ * as writing each element.
+ */
 template<class T>
 IODevice& IODevice::operator<<(const std::vector<T>& v)
 {
 	int size = v.size();
 	(*this) << size;
 
-	for ( const T& e : v ) {
-		(*this) << e;
-	}
+	write_elements(v, is_bulk<T>());
 
 	return (*this);
 }
 
 
 
+/**
+ * Read a vector from a file, replacing its contents. The
+ * size is checked against the remaining length of the file
+ * before any memory is allocated, so that a corrupt size
+ * fails the read instead of exhausting memory.
+ */
 template<class T>
 IODevice& IODevice::operator>>(std::vector<T>& v)
 {
 	int size;
 	(*this) >> size;
 
+	v.clear();
+
+	if ( fail() || size < 0 ) {
+		setstate(std::ios_base::failbit);
+		return (*this);
+	}
+
+	read_elements(v, size, is_bulk<T>());
+
+	return (*this);
+}
+
+
+
+template<class T>
+void IODevice::write_elements(const std::vector<T>& v, std::true_type)
+{
+	write(reinterpret_cast<const char *>(v.data()), v.size() * sizeof(T));
+}
+
+
+
+template<class T>
+void IODevice::write_elements(const std::vector<T>& v, std::false_type)
+{
+	for ( const T& e : v ) {
+		(*this) << e;
+	}
+}
+
+
+
+template<class T>
+void IODevice::read_elements(std::vector<T>& v, int size, std::true_type)
+{
+	if ( !can_read((size_t)size * sizeof(T)) ) {
+		setstate(std::ios_base::failbit);
+		return;
+	}
+
+	v.resize(size);
+	read(reinterpret_cast<char *>(v.data()), size * sizeof(T));
+}
+
+
+
+template<class T>
+void IODevice::read_elements(std::vector<T>& v, int size, std::false_type)
+{
+	// each element takes at least one byte
+	if ( !can_read(size) ) {
+		setstate(std::ios_base::failbit);
+		return;
+	}
+
 	v.reserve(size);
 
-	for ( int i = 0; i < size; i++ ) {
+	for ( int i = 0; i < size && !fail(); i++ ) {
 		T e;
 		(*this) >> e;
 
 		v.push_back(e);
 	}
-
-	return (*this);
 }
 
 
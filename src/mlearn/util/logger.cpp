@@ -20,7 +20,8 @@ LogLevel Logger::LEVEL { LogLevel::Info };
  * Log a message with a given loglevel.
  *
  * This function uses the same argument format
- * as printf().
+ * as printf(). It is safe to call from several
+ * threads; each message is written as a whole line.
  *
  * @param level
  * @param format
@@ -34,17 +35,22 @@ void Logger::log(LogLevel level, const char *format, ...)
 		va_list ap;
 
 		time_t t = time(nullptr);
-		struct tm *tm = localtime(&t);
+		struct tm tm;
+		localtime_r(&t, &tm);
+
+		flockfile(stream);
 
 		fprintf(stream, "[%04d-%02d-%02d %02d:%02d:%02d] ",
-			1900 + tm->tm_year, 1 + tm->tm_mon, tm->tm_mday,
-			tm->tm_hour, tm->tm_min, tm->tm_sec);
+			1900 + tm.tm_year, 1 + tm.tm_mon, tm.tm_mday,
+			tm.tm_hour, tm.tm_min, tm.tm_sec);
 
 		va_start(ap, format);
 		vfprintf(stream, format, ap);
 		va_end(ap);
 
-		printf("\n");
+		fputc('\n', stream);
+
+		funlockfile(stream);
 	}
 }
 
@@ -0,0 +1,107 @@
+/**
+ * @file util/threadpool.cpp
+ *
+ * Implementation of the thread pool.
+ */
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <vector>
+#include <omp.h>
+#include "mlearn/cuda/device.h"
+#include "mlearn/util/threadpool.h"
+#include "mlearn/util/timer.h"
+
+
+
+namespace mlearn {
+
+
+
+/**
+ * Run a function on a list of independent tasks with a pool
+ * of worker threads. Tasks are started in order, so longer
+ * tasks should be listed first so that they do not end up
+ * as stragglers. The available cores are split between the
+ * workers and the OpenMP / BLAS threads of each worker. The
+ * timer items of each worker are collected by the calling
+ * thread, and an exception thrown by any task is rethrown
+ * once all workers have finished.
+ *
+ * @param num_tasks
+ * @param n_jobs     number of workers (0 = one per core)
+ * @param func
+ */
+void ThreadPool::run(int num_tasks, int n_jobs, const std::function<void(int)>& func)
+{
+	if ( num_tasks == 0 )
+	{
+		return;
+	}
+
+	// split cores between workers and inner threads
+	int num_cores = omp_get_max_threads();
+	int num_workers = (n_jobs > 0) ? n_jobs : num_cores;
+
+	// the GPU is shared, so GPU tasks are run one at a time
+	if ( Device::instance() )
+	{
+		num_workers = 1;
+	}
+
+	num_workers = std::max(1, std::min(num_workers, num_tasks));
+
+	int num_threads = std::max(1, num_cores / num_workers);
+
+	// run workers
+	std::vector<std::exception_ptr> errors(num_tasks);
+	std::vector<std::vector<timer_item_t>> timer_items(num_workers);
+	std::atomic<int> next {0};
+
+	auto worker = [&] (int w)
+	{
+		omp_set_num_threads(num_threads);
+
+		int n;
+		while ( (n = next++) < num_tasks )
+		{
+			try
+			{
+				func(n);
+			}
+			catch ( ... )
+			{
+				errors[n] = std::current_exception();
+			}
+		}
+
+		timer_items[w] = Timer::release();
+	};
+
+	std::vector<std::thread> workers;
+
+	for ( int w = 0; w < num_workers; w++ )
+	{
+		workers.emplace_back(worker, w);
+	}
+
+	for ( int w = 0; w < num_workers; w++ )
+	{
+		workers[w].join();
+
+		Timer::insert(timer_items[w]);
+	}
+
+	for ( int n = 0; n < num_tasks; n++ )
+	{
+		if ( errors[n] )
+		{
+			std::rethrow_exception(errors[n]);
+		}
+	}
+}
+
+
+
+}
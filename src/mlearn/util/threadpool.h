@@ -0,0 +1,26 @@
+/**
+ * @file util/threadpool.h
+ *
+ * Interface definitions for the thread pool.
+ */
+#ifndef MLEARN_UTIL_THREADPOOL_H
+#define MLEARN_UTIL_THREADPOOL_H
+
+#include <functional>
+
+
+
+namespace mlearn {
+
+
+
+class ThreadPool {
+public:
+	static void run(int num_tasks, int n_jobs, const std::function<void(int)>& func);
+};
+
+
+
+}
+
+#endif
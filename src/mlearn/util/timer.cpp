@@ -13,8 +13,26 @@ namespace mlearn {
 
 
 
-std::vector<timer_item_t> Timer::_items;
-int Timer::_level = 0;
+thread_local bool Timer::_enabled = true;
+thread_local std::vector<timer_item_t> Timer::_items;
+thread_local int Timer::_level = 0;
+
+
+
+/**
+ * Enable or disable timing for the calling thread.
+ *
+ * Timer items are kept per thread, so timing never touches
+ * shared state. However, the items of a thread accumulate
+ * until they are printed or released, so a thread which
+ * serves many requests should disable timing.
+ *
+ * @param enabled
+ */
+void Timer::enable(bool enabled)
+{
+	_enabled = enabled;
+}
 
 
 
@@ -25,6 +43,10 @@ int Timer::_level = 0;
  */
 void Timer::push(const std::string& name)
 {
+	if ( !_enabled ) {
+		return;
+	}
+
 	timer_item_t item;
 	item.name = name;
 	item.level = _level;
@@ -46,6 +68,10 @@ void Timer::push(const std::string& name)
  */
 float Timer::pop()
 {
+	if ( !_enabled ) {
+		return 0;
+	}
+
 	std::vector<timer_item_t>::reverse_iterator iter;
 
 	for ( iter = _items.rbegin(); iter != _items.rend(); iter++ ) {
@@ -67,7 +93,41 @@ float Timer::pop()
 
 
 /**
- * Print all timer items.
+ * Remove and return all timer items of the calling thread.
+ * This function is used to collect the timer items of a
+ * worker thread before the thread exits.
+ */
+std::vector<timer_item_t> Timer::release()
+{
+	std::vector<timer_item_t> items;
+
+	std::swap(items, _items);
+	_level = 0;
+
+	return items;
+}
+
+
+
+/**
+ * Append timer items from another thread to the timer items
+ * of the calling thread, nested under the current level.
+ *
+ * @param items
+ */
+void Timer::insert(const std::vector<timer_item_t>& items)
+{
+	for ( timer_item_t item : items ) {
+		item.level += _level;
+
+		_items.push_back(item);
+	}
+}
+
+
+
+/**
+ * Print all timer items of the calling thread.
  */
 void Timer::print()
 {
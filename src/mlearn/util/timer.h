@@ -28,13 +28,17 @@ typedef struct {
 
 class Timer {
 public:
+	static void enable(bool enabled);
 	static void push(const std::string& name);
 	static float pop();
+	static std::vector<timer_item_t> release();
+	static void insert(const std::vector<timer_item_t>& items);
 	static void print();
 
 private:
-	static std::vector<timer_item_t> _items;
-	static int _level;
+	static thread_local bool _enabled;
+	static thread_local std::vector<timer_item_t> _items;
+	static thread_local int _level;
 };
 
 
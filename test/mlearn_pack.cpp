@@ -0,0 +1,156 @@
+/**
+ * @file mlearn_pack.cpp
+ *
+ * Tool for converting a dataset into a packed dataset.
+ *
+ * By default the packed dataset is written to the packed
+ * cache of the source, which the data iterators use instead
+ * of the source as long as the source is unchanged.
+ * The source itself is always read, so that running the tool
+ * again refreshes the cache.
+ */
+#include <cstdlib>
+#include <getopt.h>
+#include <iostream>
+#include <memory>
+#include <mlearn.h>
+
+
+
+using namespace mlearn;
+
+
+
+typedef struct
+{
+	std::string data_path;
+	std::string data_type;
+	std::string output_path;
+	PackedType packed_type;
+} args_t;
+
+
+
+void print_usage()
+{
+	std::cerr <<
+		"Usage: ./mlearn-pack [options]\n"
+		"\n"
+		"Options:\n"
+		"  --loglevel LEVEL   log level (0=error, 1=warn, [2]=info, 3=verbose, 4=debug)\n"
+		"  --dataset PATH     path to dataset [data/iris.txt]\n"
+		"  --type TYPE        data type ([csv], genome, image)\n"
+		"  --output PATH      path to packed dataset [<dataset>.pack]\n"
+		"  --uint8            store features as 8-bit integers (for 8-bit images)\n";
+}
+
+
+
+args_t parse_args(int argc, char **argv)
+{
+	args_t args = {
+		"data/iris.txt",
+		"csv",
+		"",
+		PackedType::float32
+	};
+
+	struct option long_options[] = {
+		{ "loglevel", required_argument, 0, 'e' },
+		{ "dataset", required_argument, 0, 't' },
+		{ "type", required_argument, 0, 'd' },
+		{ "output", required_argument, 0, 'o' },
+		{ "uint8", no_argument, 0, 'u' },
+		{ 0, 0, 0, 0 }
+	};
+
+	int opt;
+	while ( (opt = getopt_long_only(argc, argv, "", long_options, nullptr)) != -1 )
+	{
+		switch ( opt ) {
+		case 'e':
+			Logger::LEVEL = (LogLevel) atoi(optarg);
+			break;
+		case 't':
+			args.data_path = optarg;
+			break;
+		case 'd':
+			args.data_type = optarg;
+			break;
+		case 'o':
+			args.output_path = optarg;
+			break;
+		case 'u':
+			args.packed_type = PackedType::uint8;
+			break;
+		case '?':
+			print_usage();
+			exit(1);
+		}
+	}
+
+	if ( args.output_path.empty() )
+	{
+		args.output_path = PackedIterator::cache_path(args.data_path);
+	}
+
+	return args;
+}
+
+
+
+int main(int argc, char **argv)
+{
+	// parse command-line arguments
+	args_t args = parse_args(argc, argv);
+
+	// construct data iterator
+	std::unique_ptr<DataIterator> data_iter;
+
+	Timer::push("Opening dataset");
+
+	if ( args.data_type == "csv" )
+	{
+		data_iter.reset(new CSVIterator(args.data_path, false));
+	}
+	else if ( args.data_type == "genome" )
+	{
+		data_iter.reset(new GenomeIterator(args.data_path, false));
+	}
+	else if ( args.data_type == "image" )
+	{
+		data_iter.reset(new ImageIterator(args.data_path, false));
+	}
+	else
+	{
+		std::cerr << "error: type must be csv | genome | image\n";
+		exit(1);
+	}
+
+	Timer::pop();
+
+	// write packed dataset
+	Timer::push("Writing packed dataset");
+
+	try
+	{
+		PackedIterator::save(data_iter.get(), args.output_path, args.packed_type, args.data_path);
+	}
+	catch ( std::exception& e )
+	{
+		std::cerr << "error: " << e.what() << "\n";
+		exit(1);
+	}
+
+	Timer::pop();
+
+	Logger::log(LogLevel::Info, "Packed %d samples of size %d into %s",
+		data_iter->num_samples(),
+		data_iter->sample_size(),
+		args.output_path.c_str());
+
+	// print timing results
+	Timer::print();
+
+	return 0;
+}
@@ -0,0 +1,380 @@
+/**
+ * @file mlearn_search.cpp
+ *
+ * Tool for selecting the hyperparameters of a classifier
+ * pipeline by grid search with k-fold cross-validation.
+ *
+ * Each value of n1 defines a transform configuration and each
+ * pair of k and distance defines a kNN configuration, so the
+ * transforms of each n1 are fit once per fold and shared by
+ * every kNN configuration.
+ */
+#include <cstdlib>
+#include <getopt.h>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <mlearn.h>
+
+
+
+using namespace mlearn;
+
+
+
+typedef struct
+{
+	std::string data_path;
+	std::string data_type;
+	std::string feature;
+	std::string classifier;
+	std::string ica_approach;
+	std::vector<int> n1;
+	std::vector<int> k;
+	std::vector<std::string> dist;
+	int n_folds;
+	bool shuffle;
+	int n_iter;
+	int n_jobs;
+	std::string output_path;
+} args_t;
+
+
+
+const std::map<std::string, KNNDist> DIST_NAMES = {
+	{ "cos", KNNDist::COS },
+	{ "l1", KNNDist::L1 },
+	{ "l2", KNNDist::L2 }
+};
+
+
+
+const std::map<std::string, ICAApproach> ICA_APPROACH_NAMES = {
+	{ "deflation", ICAApproach::deflation },
+	{ "symmetric", ICAApproach::symmetric }
+};
+
+
+
+void print_usage()
+{
+	std::cerr <<
+		"Usage: ./mlearn-search [options]\n"
+		"\n"
+		"Options:\n"
+		"  --gpu              enable GPU acceleration\n"
+		"  --loglevel LEVEL   log level (0=error, 1=warn, [2]=info, 3=verbose, 4=debug)\n"
+		"  --dataset PATH     path to dataset [data/iris.txt]\n"
+		"  --type TYPE        data type ([csv], genome, image)\n"
+		"  --feat FEATURE     feature extraction method (identity, [pca], lda, ica)\n"
+		"  --clas CLASSIFIER  classification method ([knn], bayes)\n"
+		"  --ica-approach A   ICA approach ([deflation], symmetric)\n"
+		"  --n1 LIST          comma-separated values of n1 for the feature layer [-1]\n"
+		"  --k LIST           comma-separated values of k for kNN [1]\n"
+		"  --dist LIST        comma-separated distances for kNN (cos, [l1], l2)\n"
+		"  --folds N          number of cross-validation folds [5]\n"
+		"  --shuffle          shuffle samples before splitting into folds\n"
+		"  --n-iter N         number of random combinations to evaluate [0=all]\n"
+		"  --jobs N           number of tasks to run in parallel [0=one per core]\n"
+		"  --output PATH      path to results table [search.tsv]\n";
+}
+
+
+
+template<class T>
+std::vector<T> parse_list(const std::string& str, const std::function<T(const std::string&)>& parse)
+{
+	std::vector<T> values;
+	std::istringstream stream(str);
+	std::string token;
+
+	while ( std::getline(stream, token, ',') )
+	{
+		values.push_back(parse(token));
+	}
+
+	return values;
+}
+
+
+
+args_t parse_args(int argc, char **argv)
+{
+	args_t args = {
+		"data/iris.txt",
+		"csv",
+		"pca",
+		"knn",
+		"deflation",
+		{ -1 },
+		{ 1 },
+		{ "l1" },
+		5,
+		false,
+		0,
+		0,
+		"search.tsv"
+	};
+
+	struct option long_options[] = {
+		{ "gpu", no_argument, 0, 'g' },
+		{ "loglevel", required_argument, 0, 'e' },
+		{ "dataset", required_argument, 0, 't' },
+		{ "type", required_argument, 0, 'd' },
+		{ "feat", required_argument, 0, 'f' },
+		{ "clas", required_argument, 0, 'c' },
+		{ "ica-approach", required_argument, 0, 'p' },
+		{ "n1", required_argument, 0, 'n' },
+		{ "k", required_argument, 0, 'k' },
+		{ "dist", required_argument, 0, 'i' },
+		{ "folds", required_argument, 0, 'v' },
+		{ "shuffle", no_argument, 0, 's' },
+		{ "n-iter", required_argument, 0, 'r' },
+		{ "jobs", required_argument, 0, 'j' },
+		{ "output", required_argument, 0, 'o' },
+		{ 0, 0, 0, 0 }
+	};
+
+	auto parse_int = [] (const std::string& s) { return atoi(s.c_str()); };
+	auto parse_string = [] (const std::string& s) { return s; };
+
+	int opt;
+	while ( (opt = getopt_long_only(argc, argv, "", long_options, nullptr)) != -1 )
+	{
+		switch ( opt ) {
+		case 'g':
+			Device::initialize();
+			break;
+		case 'e':
+			Logger::LEVEL = (LogLevel) atoi(optarg);
+			break;
+		case 't':
+			args.data_path = optarg;
+			break;
+		case 'd':
+			args.data_type = optarg;
+			break;
+		case 'f':
+			args.feature = optarg;
+			break;
+		case 'c':
+			args.classifier = optarg;
+			break;
+		case 'p':
+			args.ica_approach = optarg;
+			break;
+		case 'n':
+			args.n1 = parse_list<int>(optarg, parse_int);
+			break;
+		case 'k':
+			args.k = parse_list<int>(optarg, parse_int);
+			break;
+		case 'i':
+			args.dist = parse_list<std::string>(optarg, parse_string);
+			break;
+		case 'v':
+			args.n_folds = atoi(optarg);
+			break;
+		case 's':
+			args.shuffle = true;
+			break;
+		case 'r':
+			args.n_iter = atoi(optarg);
+			break;
+		case 'j':
+			args.n_jobs = atoi(optarg);
+			break;
+		case 'o':
+			args.output_path = optarg;
+			break;
+		case '?':
+			print_usage();
+			exit(1);
+		}
+	}
+
+	if ( args.n_folds < 2 )
+	{
+		std::cerr << "error: folds must be at least 2\n";
+		print_usage();
+		exit(1);
+	}
+
+	if ( ICA_APPROACH_NAMES.find(args.ica_approach) == ICA_APPROACH_NAMES.end() )
+	{
+		std::cerr << "error: ica approach must be deflation | symmetric\n";
+		print_usage();
+		exit(1);
+	}
+
+	for ( auto& dist : args.dist )
+	{
+		if ( DIST_NAMES.find(dist) == DIST_NAMES.end() )
+		{
+			std::cerr << "error: distance must be cos | l1 | l2\n";
+			print_usage();
+			exit(1);
+		}
+	}
+
+	return args;
+}
+
+
+
+int main(int argc, char **argv)
+{
+	// parse command-line arguments
+	args_t args = parse_args(argc, argv);
+
+	// initialize random number engine
+	Random::seed();
+
+	// construct data iterator
+	std::unique_ptr<DataIterator> data_iter;
+
+	if ( args.data_type == "csv" )
+	{
+		data_iter.reset(new CSVIterator(args.data_path));
+	}
+	else if ( args.data_type == "genome" )
+	{
+		data_iter.reset(new GenomeIterator(args.data_path));
+	}
+	else if ( args.data_type == "image" )
+	{
+		data_iter.reset(new ImageIterator(args.data_path));
+	}
+	else
+	{
+		std::cerr << "error: type must be csv | genome | image\n";
+		exit(1);
+	}
+
+	// load dataset
+	Dataset dataset(data_iter.get());
+
+	Matrix X = dataset.load_data();
+	std::vector<int> y = dataset.labels();
+
+	// construct transform configurations
+	std::vector<transform_config_t> transforms;
+
+	for ( int n1 : args.n1 )
+	{
+		std::string feature = args.feature;
+		std::function<TransformerLayer *()> create_feature;
+
+		if ( feature == "identity" )
+		{
+			create_feature = nullptr;
+		}
+		else if ( feature == "pca" )
+		{
+			create_feature = [n1] () { return new PCALayer(n1); };
+		}
+		else if ( feature == "lda" )
+		{
+			create_feature = [n1] () { return new LDALayer(n1, -1); };
+		}
+		else if ( feature == "ica" )
+		{
+			ICAApproach approach = ICA_APPROACH_NAMES.at(args.ica_approach);
+
+			create_feature = [n1, approach] () { return new ICALayer(n1, -1, ICANonl::pow3, 1000, 0.0001f, approach); };
+		}
+		else
+		{
+			std::cerr << "error: feature must be identity | pca | lda | ica\n";
+			exit(1);
+		}
+
+		transforms.push_back(transform_config_t {
+			(feature == "identity") ? feature : feature + " n1=" + std::to_string(n1),
+			[create_feature] ()
+			{
+				std::vector<TransformerLayer *> layers;
+
+				layers.push_back(new Scaler(true, false));
+
+				if ( create_feature )
+				{
+					layers.push_back(create_feature());
+				}
+
+				return layers;
+			}
+		});
+
+		if ( feature == "identity" )
+		{
+			break;
+		}
+	}
+
+	// construct estimator configurations
+	std::vector<estimator_config_t> estimators;
+
+	if ( args.classifier == "knn" )
+	{
+		for ( int k : args.k )
+		{
+			for ( auto& dist : args.dist )
+			{
+				KNNDist knn_dist = DIST_NAMES.at(dist);
+
+				estimators.push_back(estimator_config_t {
+					"knn k=" + std::to_string(k) + " " + dist,
+					[k, knn_dist] () { return new KNNLayer(k, knn_dist); }
+				});
+			}
+		}
+	}
+	else if ( args.classifier == "bayes" )
+	{
+		estimators.push_back(estimator_config_t {
+			"bayes",
+			[] () { return new BayesLayer(); }
+		});
+	}
+	else
+	{
+		std::cerr << "error: classifier must be 'knn' or 'bayes'\n";
+		exit(1);
+	}
+
+	// run grid search
+	StratifiedKFold cv(args.n_folds, args.shuffle);
+	GridSearch search(transforms, estimators, cv, args.n_iter, args.n_jobs);
+
+	Timer::push("Grid search");
+
+	try
+	{
+		search.fit(X, y, dataset.classes().size());
+	}
+	catch ( std::exception& e )
+	{
+		std::cerr << "error: " << e.what() << "\n";
+		exit(1);
+	}
+
+	Timer::pop();
+
+	search.print();
+	search.save(args.output_path);
+
+	const search_result_t& best = search.best();
+
+	Logger::log(LogLevel::Info, "Best: %s, %s (%.3f +/- %.3f)",
+		transforms[best.transform].name.c_str(),
+		estimators[best.estimator].name.c_str(),
+		best.mean,
+		best.std);
+
+	// print timing results
+	Timer::print();
+
+	return 0;
+}
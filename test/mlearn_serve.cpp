@@ -0,0 +1,798 @@
+/**
+ * @file mlearn_serve.cpp
+ *
+ * Model server for a saved classifier pipeline.
+ *
+ * The server loads a pipeline once and accepts feature vectors
+ * over a Unix domain socket or a localhost TCP port. Each request
+ * is a line of whitespace-separated features and each response
+ * is a line with the predicted label. Requests from concurrent
+ * clients are coalesced into micro-batches, so that each batch
+ * is classified by a single call to the pipeline.
+ */
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <getopt.h>
+#include <iostream>
+#include <list>
+#include <mlearn.h>
+#include <mutex>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+
+
+using namespace mlearn;
+
+
+
+typedef std::chrono::steady_clock clock_type;
+
+
+
+typedef struct
+{
+	std::string model_path;
+	std::string feature;
+	std::string classifier;
+	int num_features;
+	std::string socket_path;
+	int port;
+	int max_batch;
+	int max_wait;
+	int report_interval;
+} args_t;
+
+
+
+typedef struct
+{
+	std::vector<float> x;
+	clock_type::time_point start;
+	std::promise<int> label;
+} request_t;
+
+
+
+/**
+ * Connection of a client, which is served by its own thread.
+ * The socket is closed by the main thread after the client
+ * thread is joined, so that it can be shut down at any time.
+ */
+typedef struct
+{
+	int fd;
+	std::thread thread;
+	std::atomic<bool> done;
+} client_t;
+
+
+
+/**
+ * Latency and throughput statistics over a time window.
+ */
+class Stats {
+public:
+	Stats(): _start(clock_type::now()) {}
+
+	void record(const std::vector<float>& latencies);
+	std::string summary() const;
+	void reset();
+
+private:
+	mutable std::mutex _mutex;
+	std::vector<float> _latencies;
+	int _num_batches {0};
+	clock_type::time_point _start;
+};
+
+
+
+/**
+ * Request queue which is drained in micro-batches.
+ */
+class Batcher {
+public:
+	Batcher(const Pipeline& pipeline, int num_features, int max_batch, int max_wait, Stats& stats);
+
+	void submit(request_t *request);
+	void run();
+	void stop();
+
+private:
+	const Pipeline& _pipeline;
+	int _num_features;
+	int _max_batch;
+	std::chrono::microseconds _max_wait;
+	Stats& _stats;
+
+	std::mutex _mutex;
+	std::condition_variable _cv;
+	std::deque<request_t *> _queue;
+	bool _running {true};
+};
+
+
+
+volatile sig_atomic_t stop_requested = 0;
+
+
+
+/**
+ * Record the latencies of a batch of requests, in milliseconds.
+ *
+ * @param latencies
+ */
+void Stats::record(const std::vector<float>& latencies)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	_latencies.insert(_latencies.end(), latencies.begin(), latencies.end());
+	_num_batches++;
+}
+
+
+
+/**
+ * Summarize the statistics of the current window.
+ */
+std::string Stats::summary() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	std::vector<float> latencies(_latencies);
+	int n = latencies.size();
+
+	auto percentile = [&latencies, n] (float p)
+	{
+		if ( n == 0 )
+		{
+			return 0.0f;
+		}
+
+		auto it = latencies.begin() + (int)(p * (n - 1));
+		std::nth_element(latencies.begin(), it, latencies.end());
+		return *it;
+	};
+
+	float p50 = percentile(0.50f);
+	float p99 = percentile(0.99f);
+	float elapsed = std::chrono::duration<float>(clock_type::now() - _start).count();
+
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer),
+		"requests %d, batches %d (mean size %.1f), latency p50 %.3f ms, p99 %.3f ms, throughput %.1f req/s",
+		n,
+		_num_batches,
+		(_num_batches > 0) ? (float) n / _num_batches : 0.0f,
+		p50,
+		p99,
+		n / elapsed);
+
+	return buffer;
+}
+
+
+
+/**
+ * Start a new statistics window.
+ */
+void Stats::reset()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	_latencies.clear();
+	_num_batches = 0;
+	_start = clock_type::now();
+}
+
+
+
+/**
+ * Construct a batcher.
+ *
+ * @param pipeline
+ * @param num_features
+ * @param max_batch
+ * @param max_wait
+ * @param stats
+ */
+Batcher::Batcher(const Pipeline& pipeline, int num_features, int max_batch, int max_wait, Stats& stats):
+	_pipeline(pipeline),
+	_num_features(num_features),
+	_max_batch(max_batch),
+	_max_wait(max_wait),
+	_stats(stats)
+{
+}
+
+
+
+/**
+ * Add a request to the queue. The label is delivered
+ * through the promise of the request. A request which is
+ * submitted after the batcher is stopped is rejected with
+ * an error, so that the client never waits for it.
+ *
+ * @param request
+ */
+void Batcher::submit(request_t *request)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		if ( !_running )
+		{
+			request->label.set_exception(std::make_exception_ptr(std::runtime_error("server is shutting down")));
+			return;
+		}
+
+		_queue.push_back(request);
+	}
+
+	_cv.notify_one();
+}
+
+
+
+/**
+ * Classify queued requests until the batcher is stopped.
+ *
+ * A batch is started by the oldest request in the queue
+ * and is closed when it is full or when the oldest request
+ * has waited for the maximum wait time, whichever is first.
+ * Requests which are still queued when the batcher is
+ * stopped are classified before returning.
+ */
+void Batcher::run()
+{
+	// serving threads are long-lived, so timing is disabled
+	Timer::enable(false);
+
+	Matrix X(_num_features, _max_batch);
+
+	while ( true )
+	{
+		std::vector<request_t *> batch;
+
+		// wait for the next batch
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+
+			_cv.wait(lock, [this] { return !_queue.empty() || !_running; });
+
+			if ( _queue.empty() )
+			{
+				break;
+			}
+
+			_cv.wait_until(lock, _queue.front()->start + _max_wait, [this] {
+				return (int)_queue.size() >= _max_batch || !_running;
+			});
+
+			int n = std::min((int)_queue.size(), _max_batch);
+
+			batch.assign(_queue.begin(), _queue.begin() + n);
+			_queue.erase(_queue.begin(), _queue.begin() + n);
+		}
+
+		// classify the batch
+		int n = batch.size();
+
+		for ( int j = 0; j < n; j++ )
+		{
+			std::copy(batch[j]->x.begin(), batch[j]->x.end(), &X.elem(0, j));
+		}
+
+		X.gpu_write();
+
+		try
+		{
+			std::vector<int> y_pred = (n == _max_batch)
+				? _pipeline.predict(X)
+				: _pipeline.predict(X(0, n));
+
+			// deliver labels to clients
+			std::vector<float> latencies(n);
+			clock_type::time_point end = clock_type::now();
+
+			for ( int j = 0; j < n; j++ )
+			{
+				latencies[j] = std::chrono::duration<float, std::milli>(end - batch[j]->start).count();
+				batch[j]->label.set_value(y_pred[j]);
+			}
+
+			_stats.record(latencies);
+		}
+		catch ( ... )
+		{
+			for ( request_t *request : batch )
+			{
+				request->label.set_exception(std::current_exception());
+			}
+		}
+	}
+}
+
+
+
+/**
+ * Stop the batcher after the remaining requests are classified.
+ */
+void Batcher::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_running = false;
+	}
+
+	_cv.notify_all();
+}
+
+
+
+/**
+ * Serve the requests of a client until it disconnects or
+ * its socket is shut down.
+ *
+ * @param client
+ * @param batcher
+ * @param stats
+ * @param num_features
+ */
+void serve_client(client_t *client, Batcher& batcher, const Stats& stats, int num_features)
+{
+	FILE *in = fdopen(dup(client->fd), "r");
+	FILE *out = fdopen(dup(client->fd), "w");
+
+	char *line = nullptr;
+	size_t line_size = 0;
+
+	while ( getline(&line, &line_size, in) != -1 )
+	{
+		// handle stats command
+		if ( strncmp(line, "stats", 5) == 0 )
+		{
+			fprintf(out, "%s\n", stats.summary().c_str());
+			fflush(out);
+			continue;
+		}
+
+		// parse feature vector
+		request_t request;
+		request.x.reserve(num_features);
+
+		char *s = line;
+		char *end;
+
+		for ( float f = strtof(s, &end); end != s; f = strtof(s, &end) )
+		{
+			request.x.push_back(f);
+			s = end;
+		}
+
+		if ( request.x.empty() )
+		{
+			continue;
+		}
+
+		if ( (int)request.x.size() != num_features )
+		{
+			fprintf(out, "error: expected %d features, got %d\n", num_features, (int)request.x.size());
+			fflush(out);
+			continue;
+		}
+
+		// submit request and wait for the label
+		request.start = clock_type::now();
+
+		std::future<int> label = request.label.get_future();
+
+		batcher.submit(&request);
+
+		try
+		{
+			fprintf(out, "%d\n", label.get());
+		}
+		catch ( std::exception& e )
+		{
+			fprintf(out, "error: %s\n", e.what());
+		}
+
+		fflush(out);
+	}
+
+	free(line);
+	fclose(in);
+	fclose(out);
+
+	client->done = true;
+}
+
+
+
+/**
+ * Join the threads of clients which have disconnected, or of
+ * all clients if all is true. When all clients are joined,
+ * their sockets are shut down first, so that each client
+ * thread finishes its current request and returns.
+ *
+ * @param clients
+ * @param all
+ */
+void join_clients(std::list<client_t>& clients, bool all)
+{
+	if ( all )
+	{
+		for ( client_t& client : clients )
+		{
+			shutdown(client.fd, SHUT_RDWR);
+		}
+	}
+
+	for ( auto it = clients.begin(); it != clients.end(); )
+	{
+		if ( all || it->done )
+		{
+			it->thread.join();
+			close(it->fd);
+			it = clients.erase(it);
+		}
+		else
+		{
+			it++;
+		}
+	}
+}
+
+
+
+/**
+ * Create a listening socket on a Unix domain socket path
+ * or on a localhost TCP port.
+ *
+ * @param socket_path
+ * @param port
+ */
+int create_listener(const std::string& socket_path, int port)
+{
+	int fd;
+
+	if ( !socket_path.empty() )
+	{
+		sockaddr_un addr {};
+		addr.sun_family = AF_UNIX;
+
+		if ( socket_path.size() >= sizeof(addr.sun_path) )
+		{
+			std::cerr << "error: socket path is too long\n";
+			exit(1);
+		}
+
+		strcpy(addr.sun_path, socket_path.c_str());
+		unlink(socket_path.c_str());
+
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+		if ( fd == -1 || bind(fd, (sockaddr *)&addr, sizeof(addr)) == -1 )
+		{
+			perror("error: could not bind socket");
+			exit(1);
+		}
+	}
+	else
+	{
+		sockaddr_in addr {};
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		int reuse = 1;
+
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+
+		if ( fd == -1
+		  || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == -1
+		  || bind(fd, (sockaddr *)&addr, sizeof(addr)) == -1 )
+		{
+			perror("error: could not bind port");
+			exit(1);
+		}
+	}
+
+	if ( listen(fd, SOMAXCONN) == -1 )
+	{
+		perror("error: could not listen on socket");
+		exit(1);
+	}
+
+	return fd;
+}
+
+
+
+void handle_signal(int signum)
+{
+	stop_requested = 1;
+}
+
+
+
+void print_usage()
+{
+	std::cerr <<
+		"Usage: ./mlearn-serve [options]\n"
+		"\n"
+		"Options:\n"
+		"  --gpu              enable GPU acceleration\n"
+		"  --loglevel LEVEL   log level (0=error, 1=warn, [2]=info, 3=verbose, 4=debug)\n"
+		"  --model PATH       path to pipeline saved by test-classification --save\n"
+		"  --feat FEATURE     feature extraction method of the model ([identity], pca, lda, ica)\n"
+		"  --clas CLASSIFIER  classification method of the model ([knn], bayes)\n"
+		"  --dim N            number of features per sample\n"
+		"  --socket PATH      listen on a Unix domain socket\n"
+		"  --port PORT        listen on a localhost TCP port\n"
+		"  --max-batch N      maximum number of requests per batch [64]\n"
+		"  --max-wait USEC    maximum time a request waits for its batch [1000]\n"
+		"  --report SEC       interval between statistics reports [10]\n";
+}
+
+
+
+args_t parse_args(int argc, char **argv)
+{
+	args_t args = {
+		"",
+		"identity",
+		"knn",
+		0,
+		"",
+		0,
+		64,
+		1000,
+		10
+	};
+
+	struct option long_options[] = {
+		{ "gpu", no_argument, 0, 'g' },
+		{ "loglevel", required_argument, 0, 'e' },
+		{ "model", required_argument, 0, 'm' },
+		{ "feat", required_argument, 0, 'f' },
+		{ "clas", required_argument, 0, 'c' },
+		{ "dim", required_argument, 0, 'd' },
+		{ "socket", required_argument, 0, 's' },
+		{ "port", required_argument, 0, 'p' },
+		{ "max-batch", required_argument, 0, 'b' },
+		{ "max-wait", required_argument, 0, 'w' },
+		{ "report", required_argument, 0, 'r' },
+		{ 0, 0, 0, 0 }
+	};
+
+	int opt;
+	while ( (opt = getopt_long_only(argc, argv, "", long_options, nullptr)) != -1 )
+	{
+		switch ( opt ) {
+		case 'g':
+			Device::initialize();
+			break;
+		case 'e':
+			Logger::LEVEL = (LogLevel) atoi(optarg);
+			break;
+		case 'm':
+			args.model_path = optarg;
+			break;
+		case 'f':
+			args.feature = optarg;
+			break;
+		case 'c':
+			args.classifier = optarg;
+			break;
+		case 'd':
+			args.num_features = atoi(optarg);
+			break;
+		case 's':
+			args.socket_path = optarg;
+			break;
+		case 'p':
+			args.port = atoi(optarg);
+			break;
+		case 'b':
+			args.max_batch = atoi(optarg);
+			break;
+		case 'w':
+			args.max_wait = atoi(optarg);
+			break;
+		case 'r':
+			args.report_interval = atoi(optarg);
+			break;
+		case '?':
+			print_usage();
+			exit(1);
+		}
+	}
+
+	if ( args.model_path.empty() )
+	{
+		std::cerr << "error: model path is required\n";
+		print_usage();
+		exit(1);
+	}
+
+	if ( args.num_features < 1 )
+	{
+		std::cerr << "error: dim must be at least 1\n";
+		print_usage();
+		exit(1);
+	}
+
+	if ( args.socket_path.empty() == (args.port == 0) )
+	{
+		std::cerr << "error: exactly one of socket or port is required\n";
+		print_usage();
+		exit(1);
+	}
+
+	if ( args.max_batch < 1 || args.max_wait < 0 || args.report_interval < 1 )
+	{
+		std::cerr << "error: max-batch and report must be positive, max-wait must be non-negative\n";
+		print_usage();
+		exit(1);
+	}
+
+	return args;
+}
+
+
+
+int main(int argc, char **argv)
+{
+	// parse command-line arguments
+	args_t args = parse_args(argc, argv);
+
+	// construct transformer layers
+	std::vector<TransformerLayer*> transforms;
+
+	transforms.push_back(new Scaler(true, false));
+
+	if ( args.feature == "identity" )
+	{
+		// do nothing
+	}
+	else if ( args.feature == "pca" )
+	{
+		transforms.push_back(new PCALayer());
+	}
+	else if ( args.feature == "lda" )
+	{
+		transforms.push_back(new LDALayer());
+	}
+	else if ( args.feature == "ica" )
+	{
+		transforms.push_back(new ICALayer());
+	}
+	else
+	{
+		std::cerr << "error: feature must be identity | pca | lda | ica\n";
+		exit(1);
+	}
+
+	// construct classifier layer
+	EstimatorLayer* classifier;
+
+	if ( args.classifier == "knn" )
+	{
+		classifier = new KNNLayer();
+	}
+	else if ( args.classifier == "bayes" )
+	{
+		classifier = new BayesLayer();
+	}
+	else
+	{
+		std::cerr << "error: classifier must be 'knn' or 'bayes'\n";
+		exit(1);
+	}
+
+	// load pipeline
+	Pipeline pipeline(transforms, classifier);
+
+	// the model file is mapped, so that large matrices are not copied
+	try
+	{
+		pipeline.load(args.model_path);
+	}
+	catch ( std::exception& e )
+	{
+		std::cerr << "error: could not load model " << args.model_path << ": " << e.what() << "\n";
+		exit(1);
+	}
+
+	pipeline.print();
+
+	// start batcher
+	Stats stats;
+	Batcher batcher(pipeline, args.num_features, args.max_batch, args.max_wait, stats);
+
+	std::thread batch_thread(&Batcher::run, &batcher);
+
+	// start listening for clients
+	int listener = create_listener(args.socket_path, args.port);
+
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	if ( !args.socket_path.empty() )
+	{
+		Logger::log(LogLevel::Info, "Listening on %s", args.socket_path.c_str());
+	}
+	else
+	{
+		Logger::log(LogLevel::Info, "Listening on 127.0.0.1:%d", args.port);
+	}
+
+	std::list<client_t> clients;
+	clock_type::time_point next_report = clock_type::now() + std::chrono::seconds(args.report_interval);
+
+	while ( !stop_requested )
+	{
+		pollfd pfd { listener, POLLIN, 0 };
+
+		if ( poll(&pfd, 1, 100) > 0 )
+		{
+			int fd = accept(listener, nullptr, nullptr);
+
+			if ( fd != -1 )
+			{
+				clients.emplace_back();
+
+				client_t& client = clients.back();
+				client.fd = fd;
+				client.done = false;
+				client.thread = std::thread(serve_client, &client, std::ref(batcher), std::cref(stats), args.num_features);
+			}
+		}
+
+		join_clients(clients, false);
+
+		// report statistics periodically
+		if ( clock_type::now() >= next_report )
+		{
+			Logger::log(LogLevel::Info, "%s", stats.summary().c_str());
+			stats.reset();
+
+			next_report += std::chrono::seconds(args.report_interval);
+		}
+	}
+
+	// shut down server
+	close(listener);
+
+	if ( !args.socket_path.empty() )
+	{
+		unlink(args.socket_path.c_str());
+	}
+
+	// disconnect clients before the batcher is stopped
+	join_clients(clients, true);
+
+	batcher.stop();
+	batch_thread.join();
+
+	Logger::log(LogLevel::Info, "%s", stats.summary().c_str());
+
+	return 0;
+}
@@ -20,6 +20,10 @@ typedef struct
 	std::string data_type;
 	std::string feature;
 	std::string classifier;
+	std::string ica_approach;
+	std::string model_path;
+	std::string cache_path;
+	bool compress;
 } args_t;
 
 
@@ -35,7 +39,11 @@ void print_usage()
 		"  --dataset PATH     path to dataset [data/iris.txt]\n"
 		"  --type TYPE        data type ([csv], genome, image)\n"
 		"  --feat FEATURE     feature extraction method ([identity], pca, lda, ica)\n"
-		"  --clas CLASSIFIER  classification method ([knn], bayes)\n";
+		"  --clas CLASSIFIER  classification method ([knn], bayes)\n"
+		"  --ica-approach A   ICA approach ([deflation], symmetric)\n"
+		"  --save PATH        save the fitted pipeline to a file\n"
+		"  --compress         compress the saved pipeline\n"
+		"  --cache DIR        cache fitted transforms in a directory\n";
 }
 
 
@@ -46,7 +54,11 @@ args_t parse_args(int argc, char **argv)
 		"data/iris.txt",
 		"csv",
 		"identity",
-		"knn"
+		"knn",
+		"deflation",
+		"",
+		"",
+		false
 	};
 
 	struct option long_options[] = {
@@ -56,6 +68,10 @@ args_t parse_args(int argc, char **argv)
 		{ "type", required_argument, 0, 'd' },
 		{ "feat", required_argument, 0, 'f' },
 		{ "clas", required_argument, 0, 'c' },
+		{ "ica-approach", required_argument, 0, 'p' },
+		{ "save", required_argument, 0, 's' },
+		{ "cache", required_argument, 0, 'a' },
+		{ "compress", no_argument, 0, 'z' },
 		{ 0, 0, 0, 0 }
 	};
 
@@ -81,6 +97,18 @@ args_t parse_args(int argc, char **argv)
 		case 'c':
 			args.classifier = optarg;
 			break;
+		case 'p':
+			args.ica_approach = optarg;
+			break;
+		case 's':
+			args.model_path = optarg;
+			break;
+		case 'a':
+			args.cache_path = optarg;
+			break;
+		case 'z':
+			args.compress = true;
+			break;
 		case '?':
 			print_usage();
 			exit(1);
@@ -138,7 +166,7 @@ int main(int argc, char **argv)
 	std::vector<int> y_train;
 	std::vector<int> y_test;
 
-	Dataset::train_test_split(X, y, 0.2, X_train, y_train, X_test, y_test);
+	Dataset::train_test_split(X, y, 0.2, X_train, y_train, X_test, y_test, true);
 
 	// construct transformer layers
 	std::vector<TransformerLayer*> transforms;
@@ -159,7 +187,23 @@ int main(int argc, char **argv)
 	}
 	else if ( args.feature == "ica" )
 	{
-		transforms.push_back(new ICALayer());
+		ICAApproach approach;
+
+		if ( args.ica_approach == "deflation" )
+		{
+			approach = ICAApproach::deflation;
+		}
+		else if ( args.ica_approach == "symmetric" )
+		{
+			approach = ICAApproach::symmetric;
+		}
+		else
+		{
+			std::cerr << "error: ica approach must be deflation | symmetric\n";
+			exit(1);
+		}
+
+		transforms.push_back(new ICALayer(-1, -1, ICANonl::pow3, 1000, 0.0001f, approach));
 	}
 	else
 	{
@@ -187,11 +231,22 @@ int main(int argc, char **argv)
 	// create classifier pipeline
 	Pipeline pipeline(transforms, classifier);
 
+	if ( !args.cache_path.empty() )
+	{
+		pipeline.set_cache(args.cache_path);
+	}
+
 	pipeline.print();
 
 	// fit pipeline to training set
 	pipeline.fit(X_train, y_train, dataset.classes().size());
 
+	// save fitted pipeline
+	if ( !args.model_path.empty() )
+	{
+		pipeline.save(args.model_path, args.compress ? ModelCompression::deflate : ModelCompression::none);
+	}
+
 	// evaluate pipeline on test set
 	float accuracy = pipeline.score(X_test, y_test);
 
@@ -3,6 +3,7 @@
  *
  * Test suite for the clustering pipeline.
  */
+#include <cmath>
 #include <cstdlib>
 #include <getopt.h>
 #include <iostream>
@@ -22,11 +23,29 @@ typedef struct
 	std::string clustering;
 	int min_k;
 	int max_k;
+	int n_init;
+	GMMCovariance covariance_type;
+	float reg_covar;
 	Criterion criterion;
+	int n_jobs;
+	bool early_stopping;
+	bool warm_start;
+	int batch_size;
+	int epochs;
+	bool shuffle;
 } args_t;
 
 
 
+const std::map<std::string, GMMCovariance> COVARIANCE_NAMES = {
+	{ "full", GMMCovariance::full },
+	{ "diag", GMMCovariance::diag },
+	{ "spherical", GMMCovariance::spherical },
+	{ "tied", GMMCovariance::tied }
+};
+
+
+
 const std::map<std::string, Criterion> CRITERION_NAMES = {
         { "aic", Criterion::AIC },
         { "bic", Criterion::BIC },
@@ -48,7 +67,16 @@ void print_usage()
 		"  --clus CLUSTERING  clustering method ([kmeans], gmm)\n"
 		"  --min-k K          minimum number of clusters [1]\n"
 		"  --max-k K          maximum number of clusters [5]\n"
-		"  --crit CRITERION   model selection criterion (aic, [bic], icl)\n";
+		"  --n-init N         number of random restarts per model [1]\n"
+		"  --cov TYPE         GMM covariance type ([full], diag, spherical, tied)\n"
+		"  --reg-covar R      regularization added to GMM variances [1e-6]\n"
+		"  --crit CRITERION   model selection criterion (aic, [bic], icl)\n"
+		"  --jobs N           number of models to fit in parallel (0=all cores) [0]\n"
+		"  --early-stop       drop poor models early by successive halving\n"
+		"  --warm-start       initialize each model from the next smaller model\n"
+		"  --online BATCH     fit a GMM with max-k clusters by online EM in mini-batches\n"
+		"  --epochs N         number of passes over the dataset for online EM [10]\n"
+		"  --shuffle          shuffle the mini-batches of each epoch for online EM\n";
 }
 
 
@@ -58,8 +86,16 @@ args_t parse_args(int argc, char **argv)
 	args_t args = {
 		"data/iris.txt",
 		"csv",
-		"kmeans", 1, 5,
+		"kmeans", 1, 5, 1,
+		GMMCovariance::full,
+		1e-6f,
 		Criterion::BIC,
+		0,
+		false,
+		false,
+		0,
+		10,
+		false
 	};
 
 	struct option long_options[] = {
@@ -70,7 +106,16 @@ args_t parse_args(int argc, char **argv)
 		{ "clus", required_argument, 0, 'c' },
 		{ "min-k", required_argument, 0, 'i' },
 		{ "max-k", required_argument, 0, 'a' },
+		{ "n-init", required_argument, 0, 'n' },
+		{ "cov", required_argument, 0, 'v' },
+		{ "reg-covar", required_argument, 0, 'o' },
 		{ "crit", required_argument, 0, 'r' },
+		{ "jobs", required_argument, 0, 'j' },
+		{ "early-stop", no_argument, 0, 's' },
+		{ "warm-start", no_argument, 0, 'w' },
+		{ "online", required_argument, 0, 'b' },
+		{ "epochs", required_argument, 0, 'E' },
+		{ "shuffle", no_argument, 0, 'S' },
 		{ 0, 0, 0, 0 }
 	};
 
@@ -99,6 +144,24 @@ args_t parse_args(int argc, char **argv)
 		case 'a':
 			args.max_k = atoi(optarg);
 			break;
+		case 'n':
+			args.n_init = atoi(optarg);
+			break;
+		case 'v':
+			try
+			{
+				args.covariance_type = COVARIANCE_NAMES.at(optarg);
+			}
+			catch ( std::exception& e )
+			{
+				std::cerr << "error: covariance type must be full | diag | spherical | tied\n";
+				print_usage();
+				exit(1);
+			}
+			break;
+		case 'o':
+			args.reg_covar = atof(optarg);
+			break;
 		case 'r':
 			try
 			{
@@ -111,6 +174,24 @@ args_t parse_args(int argc, char **argv)
 				exit(1);
 			}
 			break;
+		case 'j':
+			args.n_jobs = atoi(optarg);
+			break;
+		case 's':
+			args.early_stopping = true;
+			break;
+		case 'w':
+			args.warm_start = true;
+			break;
+		case 'b':
+			args.batch_size = atoi(optarg);
+			break;
+		case 'E':
+			args.epochs = atoi(optarg);
+			break;
+		case 'S':
+			args.shuffle = true;
+			break;
 		case '?':
 			print_usage();
 			exit(1);
@@ -124,6 +205,41 @@ args_t parse_args(int argc, char **argv)
 		exit(1);
 	}
 
+	if ( args.n_init < 1 )
+	{
+		std::cerr << "error: n-init must be at least 1\n";
+		print_usage();
+		exit(1);
+	}
+
+	if ( args.reg_covar < 0 )
+	{
+		std::cerr << "error: reg-covar must be non-negative\n";
+		print_usage();
+		exit(1);
+	}
+
+	if ( args.n_jobs < 0 )
+	{
+		std::cerr << "error: jobs must be non-negative\n";
+		print_usage();
+		exit(1);
+	}
+
+	if ( args.batch_size < 0 || args.epochs < 1 )
+	{
+		std::cerr << "error: online batch size and epochs must be positive\n";
+		print_usage();
+		exit(1);
+	}
+
+	if ( args.batch_size > 0 && args.clustering != "gmm" )
+	{
+		std::cerr << "error: online EM requires clustering 'gmm'\n";
+		print_usage();
+		exit(1);
+	}
+
 	return args;
 }
 
@@ -163,6 +279,35 @@ int main(int argc, char **argv)
 	Matrix X = dataset.load_data();
 	std::vector<int> y = dataset.labels();
 
+	// fit a single GMM by online EM if specified
+	if ( args.batch_size > 0 )
+	{
+		GMMLayer model(args.max_k, 1, args.covariance_type, args.reg_covar);
+
+		model.print();
+
+		for ( int epoch = 0; epoch < args.epochs; epoch++ )
+		{
+			model.partial_fit(data_iter, args.batch_size, args.shuffle);
+		}
+
+		if ( !std::isfinite(model.bic()) )
+		{
+			std::cerr << "error: online EM did not converge\n";
+			exit(1);
+		}
+
+		float purity = model.score(X, y);
+
+		Logger::log(LogLevel::Verbose, "BIC: %.3f", model.bic());
+		Logger::log(LogLevel::Verbose, "Purity: %.3f", purity);
+		Logger::log(LogLevel::Verbose, "");
+
+		Timer::print();
+
+		return 0;
+	}
+
 	// construct clustering models
 	std::vector<ClusteringLayer *> models;
 
@@ -170,11 +315,11 @@ int main(int argc, char **argv)
 	{
 		if ( args.clustering == "gmm" )
 		{
-			models.push_back(new GMMLayer(k));
+			models.push_back(new GMMLayer(k, args.n_init, args.covariance_type, args.reg_covar));
 		}
 		else if ( args.clustering == "kmeans" )
 		{
-			models.push_back(new KMeansLayer(k));
+			models.push_back(new KMeansLayer(k, args.n_init));
 		}
 		else
 		{
@@ -184,7 +329,7 @@ int main(int argc, char **argv)
 	}
 
 	// construct criterion layer
-	CriterionLayer criterion(args.criterion, models);
+	CriterionLayer criterion(args.criterion, models, args.n_jobs, args.early_stopping, args.warm_start);
 
 	// create clustering pipeline
 	Pipeline pipeline({}, &criterion);
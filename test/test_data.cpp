@@ -2,10 +2,31 @@
  * @file test_data.cpp
  *
  * Test suite for the data types.
+ *
+ * With no arguments, the test suite is run on small datasets
+ * which are written to the working directory. With a data
+ * type, an input dataset and an output file, the dataset is
+ * packed and compared to the original dataset.
  */
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <future>
+#include <getopt.h>
+#include <iterator>
+#include <iomanip>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <mlearn.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 
 
@@ -13,6 +34,17 @@ using namespace mlearn;
 
 
 
+#define ANSI_RED    "\x1b[31m"
+#define ANSI_BOLD   "\x1b[1m"
+#define ANSI_GREEN  "\x1b[32m"
+#define ANSI_RESET  "\x1b[0m"
+
+
+
+typedef void (*test_func_t)(void);
+
+
+
 typedef struct {
 	std::string data_type;
 	std::string infile;
@@ -21,43 +53,1347 @@ typedef struct {
 
 
 
-int main(int argc, char **argv)
+/**
+ * Determine whether two matrices have the same size and
+ * exactly the same elements.
+ *
+ * @param A
+ * @param B
+ */
+bool m_equal(const Matrix& A, const Matrix& B)
 {
-	if ( argc != 4 ) {
-		std::cerr << "usage: ./test-data [type] [infile] [outfile]\n";
-		exit(1);
+	if ( A.rows() != B.rows() || A.cols() != B.cols() ) {
+		return false;
+	}
+
+	for ( int i = 0; i < A.rows(); i++ ) {
+		for ( int j = 0; j < A.cols(); j++ ) {
+			if ( A.elem(i, j) != B.elem(i, j) ) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+
+
+/**
+ * Determine whether two datasets have the same entries
+ * and the same data.
+ *
+ * @param dataset1
+ * @param dataset2
+ */
+bool is_equal(const Dataset& dataset1, const Dataset& dataset2)
+{
+	if ( dataset1.classes() != dataset2.classes() || dataset1.labels() != dataset2.labels() ) {
+		return false;
+	}
+
+	for ( size_t i = 0; i < dataset1.entries().size(); i++ ) {
+		if ( dataset1.entries()[i].name != dataset2.entries()[i].name ) {
+			return false;
+		}
+	}
+
+	return m_equal(dataset1.load_data(), dataset2.load_data());
+}
+
+
+
+/**
+ * Print a test result.
+ *
+ * @param name
+ * @param result
+ */
+void print_result(const char *name, bool result)
+{
+	std::string color = result ? ANSI_GREEN : ANSI_RED;
+	std::string message = result ? "PASSED" : "FAILED";
+
+	std::cout << color << std::left << std::setw(25) << name << "  " << message << ANSI_RESET << "\n";
+}
+
+
+
+/**
+ * Write a text file for a test.
+ *
+ * @param path
+ * @param text
+ */
+void write_file(const std::string& path, const std::string& text)
+{
+	std::ofstream file(path, std::ios_base::binary);
+
+	file << text;
+}
+
+
+
+/**
+ * Read a file into a string.
+ *
+ * @param path
+ */
+std::string read_file(const std::string& path)
+{
+	std::ifstream file(path, std::ios_base::binary);
+	std::ostringstream text;
+
+	text << file.rdbuf();
+
+	return text.str();
+}
+
+
+
+/**
+ * Load every sample of a data iterator one at a time,
+ * in order.
+ *
+ * @param iter
+ */
+Matrix load_sequential(DataIterator *iter)
+{
+	Matrix X(iter->sample_size(), iter->num_samples());
+
+	for ( int i = 0; i < iter->num_samples(); i++ ) {
+		iter->sample(X, i);
+	}
+
+	return X;
+}
+
+
+
+/**
+ * Test the parallel data loader against a sequential load
+ * of the same samples: a full range, a shuffled subset,
+ * and several asynchronous chunks in flight at once.
+ */
+void test_dataloader()
+{
+	// generate a dataset with more samples than threads
+	const int N = 1000;
+	const int D = 7;
+	std::string path = "test-dataloader.csv";
+	std::ostringstream text;
+
+	for ( int i = 0; i < N; i++ ) {
+		for ( int k = 0; k < D; k++ ) {
+			text << (i * D + k) * 0.25f - 100 << ",";
+		}
+		text << "c" << i % 3 << "\n";
+	}
+
+	write_file(path, text.str());
+
+	CSVIterator iter(path, false);
+	Matrix X = load_sequential(&iter);
+
+	// load the full range
+	DataLoader loader(&iter, 4, 2);
+	Matrix X_range(D, N);
+
+	loader.load(X_range, 0, N);
+
+	print_result("load(X, begin, end)", m_equal(X_range, X));
+
+	// load a shuffled subset
+	std::vector<int> indices(N);
+
+	for ( int i = 0; i < N; i++ ) {
+		indices[i] = (i * 37) % N;
+	}
+	indices.resize(N / 2);
+
+	Matrix X_subset(D, indices.size());
+	Matrix X_gather;
+
+	loader.load(X_subset, indices);
+	Dataset::gather(X, indices, X_gather);
+
+	print_result("load(X, indices)", m_equal(X_subset, X_gather));
+
+	// load several chunks asynchronously
+	const int CHUNK_SIZE = 64;
+	int num_chunks = (N + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	std::vector<Matrix> chunks(num_chunks);
+	std::vector<std::future<void>> pending;
+	bool result = true;
+
+	for ( int c = 0; c < num_chunks; c++ ) {
+		int begin = c * CHUNK_SIZE;
+		int end = std::min(N, begin + CHUNK_SIZE);
+
+		chunks[c] = Matrix(D, end - begin);
+		pending.push_back(loader.load_async(chunks[c], begin, end));
+	}
+
+	for ( int c = 0; c < num_chunks; c++ ) {
+		pending[c].get();
+
+		int begin = c * CHUNK_SIZE;
+
+		result &= m_equal(chunks[c], X(begin, begin + chunks[c].cols()));
+	}
+
+	print_result("load_async(X, begin, end)", result);
+
+	remove(path.c_str());
+}
+
+
+
+/**
+ * Parse a CSV file and compare it to the expected data,
+ * which is given in row-major order with one sample per
+ * row, and the expected labels.
+ *
+ * @param text
+ * @param data
+ * @param labels
+ */
+bool check_csv(const std::string& text, const std::vector<float>& data, const std::vector<std::string>& labels)
+{
+	std::string path = "test-csv.csv";
+
+	write_file(path, text);
+
+	CSVIterator iter(path, false);
+	Matrix X = load_sequential(&iter);
+
+	remove(path.c_str());
+
+	int N = labels.size();
+	int D = (N > 0) ? data.size() / N : 0;
+
+	if ( iter.num_samples() != N || iter.sample_size() != D ) {
+		return false;
+	}
+
+	for ( int i = 0; i < N; i++ ) {
+		if ( iter.entries()[i].label != labels[i] ) {
+			return false;
+		}
+
+		for ( int k = 0; k < D; k++ ) {
+			if ( X.elem(k, i) != data[i * D + k] ) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+
+
+/**
+ * Determine whether a CSV file is rejected as malformed.
+ * The file is parsed in a child process, because the CSV
+ * iterator exits on a malformed file.
+ *
+ * @param text
+ */
+bool is_rejected(const std::string& text)
+{
+	std::string path = "test-csv-malformed.csv";
+
+	write_file(path, text);
+
+	std::cout.flush();
+
+	pid_t pid = fork();
+
+	if ( pid == 0 ) {
+		freopen("/dev/null", "w", stderr);
+
+		CSVIterator iter(path, false);
+		_exit(0);
 	}
 
-	args_t args = {
-		argv[1],
-		argv[2],
-		argv[3]
+	int status = 0;
+
+	waitpid(pid, &status, 0);
+	remove(path.c_str());
+
+	return WIFEXITED(status) && WEXITSTATUS(status) != 0;
+}
+
+
+
+/**
+ * Test CSV files with a header of column names.
+ */
+void test_csv_header()
+{
+	print_result("names header", check_csv(
+		"x,y,label\n"
+		"1,2,a\n"
+		"3,4,b\n",
+		{ 1, 2, 3, 4 },
+		{ "a", "b" }
+	));
+
+	print_result("names header (spaces)", check_csv(
+		"x y label\n"
+		"1 2 a\n"
+		"3 4 b\n",
+		{ 1, 2, 3, 4 },
+		{ "a", "b" }
+	));
+
+	print_result("no header", check_csv(
+		"1,2,a\n"
+		"3,4,b\n",
+		{ 1, 2, 3, 4 },
+		{ "a", "b" }
+	));
+}
+
+
+
+/**
+ * Test CSV files with a "<num_samples> <num_features>"
+ * header, which is only a header if both fields are
+ * integers and the number of samples matches the file.
+ */
+void test_csv_legacy_header()
+{
+	print_result("legacy header", check_csv(
+		"3 2\n"
+		"1 2 a\n"
+		"3 4 b\n"
+		"5 6 c\n",
+		{ 1, 2, 3, 4, 5, 6 },
+		{ "a", "b", "c" }
+	));
+
+	print_result("legacy header (count)", check_csv(
+		"5 1\n"
+		"1 a\n"
+		"2 b\n",
+		{ 5, 1, 2 },
+		{ "1", "a", "b" }
+	));
+
+	print_result("legacy header (float)", check_csv(
+		"2.5 1\n"
+		"1 a\n",
+		{ 2.5, 1 },
+		{ "1", "a" }
+	));
+}
+
+
+
+/**
+ * Test CSV files with Windows line endings, blank lines
+ * and trailing whitespace.
+ */
+void test_csv_crlf()
+{
+	print_result("CRLF", check_csv(
+		"x,y,label\r\n"
+		"1,2,a\r\n"
+		"\r\n"
+		"3,4,b\r\n",
+		{ 1, 2, 3, 4 },
+		{ "a", "b" }
+	));
+
+	print_result("CRLF (spaces)", check_csv(
+		"1 2 a \r\n"
+		"3\t4\tb\r\n",
+		{ 1, 2, 3, 4 },
+		{ "a", "b" }
+	));
+}
+
+
+
+/**
+ * Test CSV files with quoted labels.
+ */
+void test_csv_quoted_labels()
+{
+	print_result("quoted labels", check_csv(
+		"1,2,\"a b\"\n"
+		"3,4,\"c\"\r\n"
+		"5,6,d\n",
+		{ 1, 2, 3, 4, 5, 6 },
+		{ "a b", "c", "d" }
+	));
+}
+
+
+
+/**
+ * Test that malformed CSV files are rejected.
+ */
+void test_csv_malformed()
+{
+	print_result("bad feature", is_rejected(
+		"1,2,a\n"
+		"3,x,b\n"
+	));
+
+	print_result("missing field", is_rejected(
+		"1,2,a\n"
+		"3,b\n"
+	));
+
+	print_result("extra field", is_rejected(
+		"1,2,a\n"
+		"3,4,b,c\n"
+	));
+
+	print_result("missing label", is_rejected(
+		"1,2,a\n"
+		"3,4,\n"
+	));
+}
+
+
+
+/**
+ * Test the fast float parser of the CSV iterator against
+ * strtof, on random decimal numbers, numbers which strtof
+ * must round, and special values.
+ */
+void test_csv_floats()
+{
+	std::vector<std::string> values = {
+		"0", "-0", "+1.5", ".5", "5.", "1e5", "1E+05", "2.5e-3",
+		"0.1", "0.2", "0.3", "3.14159265358979323846",
+		"16777217", "16777219", "33554434",
+		"3.4028235e38", "1.17549435e-38", "1e-39", "1.4e-45",
+		"1e-50", "1e50", "123456789012345678901234567890",
+		"0.000000000000000000000000000001",
+		"9007199254740993", "1.00000005960464477539062",
+		"inf", "-inf", "nan"
 	};
 
-	// initialize data type
-	std::unique_ptr<DataIterator> iter;
+	// generate random decimal numbers
+	unsigned long long seed = 12345;
+
+	for ( int i = 0; i < 10000; i++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+
+		long long mantissa = (long long)(seed >> 11) % 100000000000LL;
+		int exponent = (int)((seed >> 3) % 61) - 30;
+		char buffer[64];
+
+		snprintf(buffer, sizeof(buffer), "%s%llde%d", (seed & 1) ? "-" : "", mantissa, exponent);
+		values.push_back(buffer);
 
-	if ( args.data_type == "genome" ) {
-		iter.reset(new Genome());
+		snprintf(buffer, sizeof(buffer), "%.*f", (int)(seed >> 20) % 10, mantissa / 1e5);
+		values.push_back(buffer);
 	}
-	else if ( args.data_type == "image" ) {
-		iter.reset(new Image());
+
+	// parse values with the CSV iterator
+	std::string path = "test-csv-floats.csv";
+	std::ostringstream text;
+
+	for ( const std::string& value : values ) {
+		text << value << ",x\n";
 	}
-	else {
-		std::cerr << "error: data type must be 'genome' or 'image'\n";
-		exit(1);
+
+	write_file(path, text.str());
+
+	CSVIterator iter(path, false);
+	Matrix X = load_sequential(&iter);
+
+	remove(path.c_str());
+
+	// compare each value to strtof
+	bool result = (X.cols() == (int)values.size());
+
+	for ( int i = 0; result && i < X.cols(); i++ ) {
+		float expected = strtof(values[i].c_str(), nullptr);
+		float actual = X.elem(0, i);
+
+		if ( std::isnan(expected) ) {
+			result = std::isnan(actual);
+		}
+		else {
+			result = (memcmp(&expected, &actual, sizeof(float)) == 0);
+		}
+
+		if ( !result ) {
+			std::cout << values[i] << ": expected " << expected << ", got " << actual << "\n";
+		}
+	}
+
+	print_result("parse_float = strtof", result);
+}
+
+
+
+/**
+ * Test that modifying a view of a dataset in place does
+ * not modify the dataset.
+ */
+void test_csv_view()
+{
+	std::string path = "test-csv-view.csv";
+
+	write_file(path,
+		"1,2,a\n"
+		"3,4,b\n"
+		"5,9,c\n"
+	);
+
+	CSVIterator iter(path, false);
+	Dataset dataset(&iter);
+	Matrix X = dataset.load_data();
+	Matrix X_copy(X);
+
+	remove(path.c_str());
+
+	print_result("view is shared", X.is_shared() && !X_copy.is_shared());
+
+	Scaler scaler;
+	scaler.fit(X);
+	scaler.transform_inplace(X);
+
+	print_result("view is not modified", m_equal(dataset.load_data(), X_copy));
+}
+
+
+
+/**
+ * Test that gathering columns into a view of a dataset, or
+ * into the input matrix itself, does not overwrite the data
+ * that is being gathered.
+ */
+void test_gather()
+{
+	std::string path = "test-gather.csv";
+
+	write_file(path,
+		"1,2,a\n"
+		"3,4,b\n"
+		"5,9,c\n"
+	);
+
+	CSVIterator iter(path, false);
+	Dataset dataset(&iter);
+	Matrix X_copy(dataset.load_data());
+
+	remove(path.c_str());
+
+	// compute the expected output by gathering one column at a time
+	std::vector<int> indices { 2, 0, 1 };
+	Matrix X_expected(X_copy.rows(), indices.size());
+
+	for ( int i = 0; i < X_copy.rows(); i++ ) {
+		for ( size_t j = 0; j < indices.size(); j++ ) {
+			X_expected.elem(i, j) = X_copy.elem(i, indices[j]);
+		}
+	}
+
+	// gather into a view of the dataset
+	Matrix X_out = dataset.load_data();
+
+	Dataset::gather(dataset.load_data(), indices, X_out);
+
+	print_result("gather into view", m_equal(X_out, X_expected) && m_equal(dataset.load_data(), X_copy));
+
+	// gather a matrix into itself
+	Matrix X(X_copy);
+
+	Dataset::gather(X, indices, X);
+
+	print_result("gather into input", m_equal(X, X_expected));
+}
+
+
+
+/**
+ * Test that a packed dataset is read back like the original
+ * dataset, and that a packed dataset with an unknown data
+ * type is rejected.
+ */
+void test_packed_type()
+{
+	std::string path = "test-packed.csv";
+	std::string path_packed = "test-packed.dat";
+
+	write_file(path,
+		"1,2,a\n"
+		"3,4,b\n"
+		"5,9,c\n"
+	);
+
+	CSVIterator iter(path, false);
+	Dataset dataset(&iter);
+
+	PackedIterator::save(&iter, path_packed);
+
+	PackedIterator packed(path_packed);
+	Dataset dataset_packed(&packed);
+
+	print_result("packed", is_equal(dataset, dataset_packed));
+
+	// replace the data type, which follows the magic and version
+	std::string data = read_file(path_packed);
+	int type = 2;
+
+	memcpy(&data[2 * sizeof(int)], &type, sizeof(int));
+	write_file(path_packed, data);
+
+	bool rejected = false;
+
+	try {
+		PackedIterator packed_invalid(path_packed);
 	}
+	catch ( std::runtime_error& e ) {
+		rejected = true;
+	}
+
+	print_result("packed (invalid type)", rejected);
 
-	// map a sample to a column vector
-	iter->load(args.infile);
+	remove(path.c_str());
+	remove(path_packed.c_str());
+}
+
+
+
+/**
+ * Determine whether the folds of a cross-validator are
+ * valid: the train and test sets of each fold are sorted,
+ * disjoint and together contain every sample, the test
+ * sets of all folds partition the samples, and the fold
+ * sizes differ by at most one.
+ *
+ * @param folds
+ * @param N
+ */
+bool is_partition(const std::vector<fold_t>& folds, int N)
+{
+	std::vector<int> num_tests(N, 0);
+	size_t min_size = N;
+	size_t max_size = 0;
 
-	Matrix x(iter->size(), 1);
+	for ( const fold_t& fold : folds ) {
+		if ( !std::is_sorted(fold.train.begin(), fold.train.end()) || !std::is_sorted(fold.test.begin(), fold.test.end()) ) {
+			return false;
+		}
 
-	iter->to_matrix(x, 0);
+		std::vector<int> all;
 
-	// map the column vector to a sample
-	iter->from_matrix(x, 0);
-	iter->save(args.outfile);
+		std::merge(
+			fold.train.begin(), fold.train.end(),
+			fold.test.begin(), fold.test.end(),
+			std::back_inserter(all));
+
+		for ( int i = 0; i < (int)all.size(); i++ ) {
+			if ( all[i] != i ) {
+				return false;
+			}
+		}
+
+		if ( (int)all.size() != N ) {
+			return false;
+		}
+
+		for ( int i : fold.test ) {
+			num_tests[i]++;
+		}
+
+		min_size = std::min(min_size, fold.test.size());
+		max_size = std::max(max_size, fold.test.size());
+	}
+
+	return std::all_of(num_tests.begin(), num_tests.end(), [] (int n) { return n == 1; })
+		&& max_size - min_size <= 1;
+}
+
+
+
+/**
+ * Determine whether the test sets of a cross-validator
+ * are stratified, that is, whether the number of samples
+ * of each class differs by at most one between folds.
+ *
+ * @param folds
+ * @param y
+ * @param c
+ */
+bool is_stratified(const std::vector<fold_t>& folds, const std::vector<int>& y, int c)
+{
+	for ( int k = 0; k < c; k++ ) {
+		int min_count = y.size();
+		int max_count = 0;
+
+		for ( const fold_t& fold : folds ) {
+			int count = std::count_if(fold.test.begin(), fold.test.end(), [&] (int i) {
+				return y[i] == k;
+			});
+
+			min_count = std::min(min_count, count);
+			max_count = std::max(max_count, count);
+		}
+
+		if ( max_count - min_count > 1 ) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+
+/**
+ * Test the k-fold and stratified k-fold cross-validators
+ * on an unbalanced dataset whose size is not a multiple of
+ * the number of folds.
+ */
+void test_kfold()
+{
+	// generate labels with unbalanced classes in runs
+	const int N = 103;
+	const int c = 3;
+	std::vector<int> y(N);
+
+	for ( int i = 0; i < N; i++ ) {
+		y[i] = (i % 10 < 5) ? 0 : (i % 10 < 8) ? 1 : 2;
+	}
+
+	// test k-fold
+	KFold kfold(5, false);
+	std::vector<fold_t> folds = kfold.split(y);
+	bool consecutive = true;
+
+	for ( const fold_t& fold : folds ) {
+		consecutive &= (fold.test.back() - fold.test.front() + 1 == (int)fold.test.size());
+	}
+
+	print_result("KFold", folds.size() == 5 && is_partition(folds, N) && consecutive);
+
+	KFold kfold_shuffle(5, true);
+
+	print_result("KFold (shuffle)", is_partition(kfold_shuffle.split(y), N));
+
+	// test stratified k-fold
+	for ( bool shuffle : { false, true } ) {
+		StratifiedKFold skfold(5, shuffle);
+		std::vector<fold_t> folds = skfold.split(y);
+
+		print_result(
+			shuffle ? "StratifiedKFold (shuffle)" : "StratifiedKFold",
+			folds.size() == 5 && is_partition(folds, N) && is_stratified(folds, y, c));
+	}
+
+	// test stratified k-fold with a class smaller than k
+	std::vector<int> y_small(y);
+
+	y_small[N - 1] = c;
+	y_small[N - 2] = c;
+
+	StratifiedKFold skfold(5, true);
+	std::vector<fold_t> folds_small = skfold.split(y_small);
+
+	print_result("StratifiedKFold (small)", is_partition(folds_small, N) && is_stratified(folds_small, y_small, c + 1));
+}
+
+
+
+/**
+ * Determine whether two vectors are equal within a
+ * relative tolerance.
+ *
+ * @param a
+ * @param b
+ * @param tol
+ */
+bool is_close(const Matrix& a, const Matrix& b, float tol)
+{
+	if ( a.rows() != b.rows() || a.cols() != b.cols() ) {
+		return false;
+	}
+
+	for ( int i = 0; i < a.rows(); i++ ) {
+		if ( fabsf(a.elem(i) - b.elem(i)) > tol * std::max(1.0f, fabsf(b.elem(i))) ) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+
+/**
+ * Test the scaler against a two-pass reference in double
+ * precision, and partial_fit() over batches of several
+ * sizes against fit(). The data has a large mean and a
+ * small variance, which a one-pass sum of squares in
+ * single precision would not compute accurately.
+ */
+void test_scaler()
+{
+	// generate data with a large offset
+	const int D = 4;
+	const int N = 1000;
+	Matrix X(D, N);
+	unsigned long long seed = 42;
+
+	for ( int j = 0; j < N; j++ ) {
+		for ( int i = 0; i < D; i++ ) {
+			seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+
+			double u = (double)(seed >> 11) / (1ULL << 53);
+
+			X.elem(i, j) = 1e3 * (i + 1) + pow(10, i - 1) * (u - 0.5);
+		}
+	}
+
+	X.gpu_write();
+
+	// compute reference moments with two passes
+	Matrix a_ref(D, 1);
+	Matrix b_ref(D, 1);
+
+	for ( int i = 0; i < D; i++ ) {
+		double mu = 0;
+		double m2 = 0;
+
+		for ( int j = 0; j < N; j++ ) {
+			mu += X.elem(i, j);
+		}
+		mu /= N;
+
+		for ( int j = 0; j < N; j++ ) {
+			m2 += (X.elem(i, j) - mu) * (X.elem(i, j) - mu);
+		}
+
+		double std = sqrt(m2 / N);
+
+		a_ref.elem(i) = 1 / std;
+		b_ref.elem(i) = -mu / std;
+	}
+
+	// compare fit() to the reference
+	Scaler scaler;
+	Matrix a;
+	Matrix b;
+
+	scaler.fit(X);
+	scaler.diagonal_affine(a, b);
+
+	print_result("fit = two-pass", is_close(a, a_ref, 1e-4) && is_close(b, b_ref, 1e-4));
+
+	// compare partial_fit() to fit()
+	bool result = true;
+
+	for ( int batch_size : { 1, 7, 64, 333, N } ) {
+		Scaler scaler_batch;
+		Matrix a_batch;
+		Matrix b_batch;
+
+		for ( int j = 0; j < N; j += batch_size ) {
+			scaler_batch.partial_fit(X(j, std::min(N, j + batch_size)));
+		}
+
+		scaler_batch.diagonal_affine(a_batch, b_batch);
+
+		result &= is_close(a_batch, a, 1e-5) && is_close(b_batch, b, 1e-5);
+	}
+
+	print_result("partial_fit = fit", result);
+
+	// check that fit() restarts the moments
+	Scaler scaler_refit;
+	Matrix a_refit;
+	Matrix b_refit;
+
+	scaler_refit.fit(X(0, N / 2));
+	scaler_refit.fit(X);
+	scaler_refit.diagonal_affine(a_refit, b_refit);
+
+	print_result("fit after fit", is_close(a_refit, a, 1e-5) && is_close(b_refit, b, 1e-5));
+
+	// check that the transformed data is standardized
+	Matrix Z = scaler.transform(X);
+	Matrix mean = Z.mean_column();
+	Matrix std(D, 1);
+
+	for ( int i = 0; i < D; i++ ) {
+		double m2 = 0;
+
+		for ( int j = 0; j < N; j++ ) {
+			m2 += (Z.elem(i, j) - mean.elem(i)) * (Z.elem(i, j) - mean.elem(i));
+		}
+
+		std.elem(i) = sqrt(m2 / N);
+	}
+
+	print_result("transform", is_close(mean, Matrix::zeros(D, 1), 1e-2) && is_close(std, Matrix::ones(D, 1), 1e-2));
+}
+
+
+
+/**
+ * Test that a pipeline which is given a view of a dataset
+ * as a temporary does not modify the dataset, so that the
+ * dataset can be used again. Both a fused diagonal
+ * transform, which is applied in place, and a fused dense
+ * transform are tested.
+ */
+void test_pipeline_view()
+{
+	// generate a dataset
+	const int N = 200;
+	const int D = 5;
+	std::string path = "test-pipeline.csv";
+	std::ostringstream text;
+
+	for ( int i = 0; i < N; i++ ) {
+		for ( int k = 0; k < D; k++ ) {
+			text << (i % 2) * 3 + ((i * 7 + k * 13) % 17) * 0.1f + 10 * k << ",";
+		}
+		text << "c" << i % 2 << "\n";
+	}
+
+	write_file(path, text.str());
+
+	CSVIterator iter(path, false);
+	Dataset dataset(&iter);
+	const std::vector<int>& y = dataset.labels();
+	int c = dataset.classes().size();
+	Matrix X = load_sequential(&iter);
+
+	remove(path.c_str());
+
+	for ( bool dense : { false, true } ) {
+		std::vector<TransformerLayer *> transforms = {
+			new Scaler(),
+			dense ? (TransformerLayer *) new PCALayer(2) : new Scaler(false, true)
+		};
+
+		Pipeline pipeline(transforms, new KNNLayer(3, KNNDist::L2));
+
+		// fit and predict on views twice
+		pipeline.fit(dataset.load_data(), y, c);
+		std::vector<int> y_pred1 = pipeline.predict(dataset.load_data());
+		float score1 = pipeline.score(dataset.load_data(), y);
+
+		pipeline.fit(dataset.load_data(), y, c);
+		std::vector<int> y_pred2 = pipeline.predict(dataset.load_data());
+		float score2 = pipeline.score(dataset.load_data(), y);
+
+		// fit and predict on a copy, which is used in place
+		pipeline.fit(Matrix(X), y, c);
+		std::vector<int> y_pred3 = pipeline.predict(Matrix(X));
+
+		print_result(
+			dense ? "view unmodified (dense)" : "view unmodified (diag)",
+			m_equal(dataset.load_data(), X));
+		print_result(
+			dense ? "fit view twice (dense)" : "fit view twice (diag)",
+			y_pred1 == y_pred2 && y_pred1 == y_pred3 && score1 == score2 && y_pred1 == pipeline.predict(X));
+	}
+}
+
+
+
+/**
+ * Determine whether a model file is rejected when it is
+ * loaded into a pipeline.
+ *
+ * @param path
+ */
+bool is_rejected_model(const std::string& path)
+{
+	Pipeline pipeline({ new Scaler(), new PCALayer(2) }, new KNNLayer(3, KNNDist::L2));
+
+	try {
+		pipeline.load(path);
+	}
+	catch ( std::runtime_error& e ) {
+		return true;
+	}
+
+	return false;
+}
+
+
+
+/**
+ * Test that a pipeline saved to a model file, with and
+ * without compression, predicts the same labels when it is
+ * loaded, and that a corrupt or truncated model file is
+ * rejected.
+ */
+void test_model_file()
+{
+	// generate a dataset
+	const int N = 300;
+	const int D = 6;
+	Matrix X(D, N);
+	std::vector<int> y(N);
+
+	for ( int j = 0; j < N; j++ ) {
+		y[j] = j % 3;
+
+		for ( int i = 0; i < D; i++ ) {
+			X.elem(i, j) = y[j] * (i + 1) + ((j * 31 + i * 17) % 23) * 0.1f;
+		}
+	}
+
+	X.gpu_write();
+
+	Pipeline pipeline({ new Scaler(), new PCALayer(2) }, new KNNLayer(3, KNNDist::L2));
+
+	pipeline.fit(X, y, 3);
+
+	std::vector<int> y_pred = pipeline.predict(X);
+
+	// save and load the pipeline
+	std::string path = "test-model.model";
+	std::string path_corrupt = "test-model-corrupt.model";
+
+	for ( ModelCompression compression : { ModelCompression::none, ModelCompression::deflate } ) {
+		bool deflate = (compression == ModelCompression::deflate);
+
+		pipeline.save(path, compression);
+
+		Pipeline pipeline_in({ new Scaler(), new PCALayer(2) }, new KNNLayer(3, KNNDist::L2));
+
+		pipeline_in.load(path);
+
+		print_result(deflate ? "round trip (deflate)" : "round trip", pipeline_in.predict(X) == y_pred);
+
+		// corrupt one byte of each region of the file
+		std::string model = read_file(path);
+		bool result = true;
+
+		for ( size_t offset : { (size_t)0, (size_t)64, model.size() / 2, model.size() - 1 } ) {
+			std::string corrupt = model;
+			corrupt[offset] ^= 0x5a;
+
+			write_file(path_corrupt, corrupt);
+			result &= is_rejected_model(path_corrupt);
+		}
+
+		print_result(deflate ? "corrupt (deflate)" : "corrupt", result);
+
+		// truncate the file
+		result = true;
+
+		for ( size_t size : { (size_t)16, model.size() / 2, model.size() - 1 } ) {
+			write_file(path_corrupt, model.substr(0, size));
+			result &= is_rejected_model(path_corrupt);
+		}
+
+		print_result(deflate ? "truncated (deflate)" : "truncated", result);
+	}
+
+	remove(path.c_str());
+	remove(path_corrupt.c_str());
+}
+
+
+
+/**
+ * List the entries of a cache directory with their inode
+ * numbers. An entry which is written again gets a new inode,
+ * since entries are renamed into place.
+ *
+ * @param path
+ */
+std::map<std::string, ino_t> list_cache(const std::string& path)
+{
+	std::map<std::string, ino_t> entries;
+	DIR *dir = opendir(path.c_str());
+
+	if ( dir == nullptr ) {
+		return entries;
+	}
+
+	struct dirent *entry;
+
+	while ( (entry = readdir(dir)) != nullptr ) {
+		std::string name = entry->d_name;
+
+		if ( name.size() > 6 && name.substr(name.size() - 6) == ".layer" ) {
+			struct stat info;
+
+			stat((path + "/" + name).c_str(), &info);
+			entries[name] = info.st_ino;
+		}
+	}
+
+	closedir(dir);
+
+	return entries;
+}
+
+
+
+/**
+ * Fit a pipeline with the fitted-transform cache and
+ * serialize it, so that two fitted pipelines can be compared.
+ *
+ * @param cache_path
+ * @param n1
+ * @param X
+ * @param y
+ */
+std::string fit_cached(const std::string& cache_path, int n1, const Matrix& X, const std::vector<int>& y)
+{
+	Pipeline pipeline({ new Scaler(), new PCALayer(n1) }, new KNNLayer(3, KNNDist::L2));
+
+	if ( !cache_path.empty() ) {
+		pipeline.set_cache(cache_path);
+	}
+
+	pipeline.fit(X, y, 3);
+
+	std::stringbuf buffer;
+	IODevice memory(&buffer);
+
+	pipeline.save(memory);
+
+	return buffer.str();
+}
+
+
+
+/**
+ * Test the fitted-transform cache of a pipeline: a fit with
+ * the same data and hyperparameters loads each transform
+ * from the cache instead of fitting it, a change to either
+ * misses the cache, and a truncated or corrupt entry is
+ * ignored, so that the transform is fit as if there were no
+ * cache.
+ */
+void test_pipeline_cache()
+{
+	// generate a dataset
+	const int N = 300;
+	const int D = 6;
+	Matrix X(D, N);
+	std::vector<int> y(N);
+
+	for ( int j = 0; j < N; j++ ) {
+		y[j] = j % 3;
+
+		for ( int i = 0; i < D; i++ ) {
+			X.elem(i, j) = y[j] * (i + 1) + ((j * 31 + i * 17) % 23) * 0.1f;
+		}
+	}
+
+	X.gpu_write();
+
+	std::string path = "test-cache";
+
+	mkdir(path.c_str(), 0755);
+
+	// fit without and with the cache
+	std::string model = fit_cached("", 2, X, y);
+	std::string model_miss = fit_cached(path, 2, X, y);
+	std::map<std::string, ino_t> entries = list_cache(path);
+
+	print_result("cache miss", model_miss == model && entries.size() == 2);
+
+	// fit again, which should load each transform without writing it
+	std::string model_hit = fit_cached(path, 2, X, y);
+
+	print_result("cache hit", model_hit == model && list_cache(path) == entries);
+
+	// change the data
+	Matrix X2(X);
+	X2.elem(0, 0) += 1;
+	X2.gpu_write();
+
+	fit_cached(path, 2, X2, y);
+
+	print_result("cache miss (data)", list_cache(path).size() == 4);
+
+	// change a hyperparameter of the second transform
+	fit_cached(path, 3, X, y);
+
+	print_result("cache miss (n1)", list_cache(path).size() == 5);
+
+	// truncate or corrupt each entry of the first fit, and keep
+	// the first int, which is a hyperparameter of the transform,
+	// valid but different; each entry must be ignored and written
+	// again
+	for ( bool truncate : { true, false } ) {
+		std::map<std::string, std::string> corrupt;
+
+		for ( auto& entry : entries ) {
+			std::string entry_path = path + "/" + entry.first;
+			std::string data = read_file(entry_path);
+			int value = 1;
+
+			memcpy(&data[0], &value, sizeof(int));
+
+			if ( truncate ) {
+				data.resize(data.size() / 2);
+			}
+			else {
+				std::fill(data.begin() + sizeof(int), data.end(), '\xff');
+			}
+
+			write_file(entry_path, data);
+			corrupt[entry.first] = data;
+		}
+
+		std::string model_corrupt = fit_cached(path, 2, X, y);
+		bool rewritten = true;
+
+		for ( auto& entry : corrupt ) {
+			rewritten &= (read_file(path + "/" + entry.first) != entry.second);
+		}
+
+		print_result(truncate ? "cache truncated" : "cache corrupt", model_corrupt == model && rewritten);
+	}
+
+	// remove the cache directory
+	for ( auto& entry : list_cache(path) ) {
+		remove((path + "/" + entry.first).c_str());
+	}
+
+	rmdir(path.c_str());
+}
+
+
+
+/**
+ * Pack a dataset and compare it to the original dataset.
+ *
+ * @param args
+ */
+int test_pack(const args_t& args)
+{
+	// initialize data iterator
+	std::unique_ptr<DataIterator> iter;
+
+	if ( args.data_type == "csv" ) {
+		iter.reset(new CSVIterator(args.infile, false));
+	}
+	else if ( args.data_type == "genome" ) {
+		iter.reset(new GenomeIterator(args.infile, false));
+	}
+	else if ( args.data_type == "image" ) {
+		iter.reset(new ImageIterator(args.infile, false));
+	}
+	else {
+		std::cerr << "error: data type must be 'csv', 'genome' or 'image'\n";
+		exit(1);
+	}
+
+	Dataset dataset(iter.get());
+
+	// pack the dataset and compare it to the original
+	PackedType type = (args.data_type == "image")
+		? PackedType::uint8
+		: PackedType::float32;
+
+	PackedIterator::save(iter.get(), args.outfile, type);
+
+	PackedIterator packed(args.outfile);
+	Dataset dataset_packed(&packed);
+
+	if ( !is_equal(dataset, dataset_packed) ) {
+		std::cerr << "error: packed dataset does not match original dataset\n";
+		exit(1);
+	}
+
+	std::cout << "packed dataset matches original dataset\n";
+
+	return 0;
+}
+
+
+
+void print_usage()
+{
+	std::cerr <<
+		"Usage: ./test-data [options] [type infile outfile]\n"
+		"\n"
+		"Options:\n"
+		"  --loglevel LEVEL  log level (0=error, 1=warn, [2]=info, 3=verbose, 4=debug)\n"
+		"\n"
+		"With a data type, an input dataset and an output file, the\n"
+		"dataset is packed and compared to the original dataset.\n";
+}
+
+
+
+int main(int argc, char **argv)
+{
+	// parse command-line arguments
+	struct option long_options[] = {
+		{ "loglevel", required_argument, 0, 'e' },
+		{ 0, 0, 0, 0 }
+	};
+
+	int opt;
+	while ( (opt = getopt_long_only(argc, argv, "", long_options, nullptr)) != -1 ) {
+		switch ( opt ) {
+		case 'e':
+			Logger::LEVEL = (LogLevel) atoi(optarg);
+			break;
+		case '?':
+			print_usage();
+			exit(1);
+		}
+	}
+
+	int num_args = argc - optind;
+
+	if ( num_args == 3 ) {
+		args_t args = {
+			argv[optind],
+			argv[optind + 1],
+			argv[optind + 2]
+		};
+
+		return test_pack(args);
+	}
+	else if ( num_args != 0 ) {
+		print_usage();
+		exit(1);
+	}
+
+	// run tests
+	test_func_t tests[] = {
+		test_dataloader,
+		test_csv_header,
+		test_csv_legacy_header,
+		test_csv_crlf,
+		test_csv_quoted_labels,
+		test_csv_malformed,
+		test_csv_floats,
+		test_csv_view,
+		test_gather,
+		test_packed_type,
+		test_kfold,
+		test_scaler,
+		test_pipeline_view,
+		test_model_file,
+		test_pipeline_cache
+	};
+	int num_tests = sizeof(tests) / sizeof(test_func_t);
+
+	for ( int i = 0; i < num_tests; i++ ) {
+		test_func_t test = tests[i];
+
+		std::cout << "TEST " << i + 1 << "\n";
+		test();
+		std::cout << "\n";
+	}
 
 	return 0;
 }
@@ -0,0 +1,582 @@
+/**
+ * @file test_gmm.cpp
+ *
+ * Test suite for Gaussian mixture models.
+ *
+ * Each test compares the GMM layer on a small fixed dataset
+ * to a direct per-sample reference computed in double
+ * precision.
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <mlearn.h>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+
+using namespace mlearn;
+
+
+
+#define ANSI_RED    "\x1b[31m"
+#define ANSI_BOLD   "\x1b[1m"
+#define ANSI_GREEN  "\x1b[32m"
+#define ANSI_RESET  "\x1b[0m"
+
+
+
+typedef void (*test_func_t)(void);
+
+
+
+/**
+ * Print a test result.
+ *
+ * @param name
+ * @param result
+ */
+void print_result(const char *name, bool result)
+{
+	std::string color = result ? ANSI_GREEN : ANSI_RED;
+	std::string message = result ? "PASSED" : "FAILED";
+
+	std::cout << color << std::left << std::setw(25) << name << "  " << message << ANSI_RESET << "\n";
+}
+
+
+
+/**
+ * Determine whether a value is close to a reference value,
+ * relative to the magnitude of the reference.
+ *
+ * @param a
+ * @param b
+ * @param tol
+ */
+bool is_close(double a, double b, double tol)
+{
+	return fabs(a - b) <= tol * std::max(1.0, fabs(b));
+}
+
+
+
+/**
+ * Generate a fixed dataset of N samples in D dimensions
+ * drawn from three well-separated clusters.
+ *
+ * @param N
+ * @param D
+ */
+Matrix make_data(int N, int D)
+{
+	std::mt19937 rng(1);
+	std::normal_distribution<float> noise(0, 1);
+	Matrix X(D, N);
+
+	for ( int j = 0; j < N; j++ ) {
+		int c = j % 3;
+
+		for ( int i = 0; i < D; i++ ) {
+			X.elem(i, j) = 5.0f * c * ((i + c) % 2 ? 1 : -1) + (1 + 0.5f * i) * noise(rng);
+		}
+	}
+
+	X.gpu_write();
+
+	return X;
+}
+
+
+
+/**
+ * Convert the covariance of a component to a full D x D
+ * matrix in double precision, stored by rows. A diagonal
+ * covariance is a D x 1 vector of variances and a spherical
+ * covariance is a single variance.
+ *
+ * @param sigma
+ * @param D
+ */
+std::vector<double> full_covariance(const Matrix& sigma, int D)
+{
+	std::vector<double> S(D * D, 0.0);
+
+	for ( int i = 0; i < D; i++ ) {
+		for ( int j = 0; j < D; j++ ) {
+			if ( sigma.cols() == D ) {
+				S[i * D + j] = sigma.elem(i, j);
+			}
+			else if ( i == j ) {
+				S[i * D + j] = (sigma.rows() == D) ? sigma.elem(i) : sigma.elem(0);
+			}
+		}
+	}
+
+	return S;
+}
+
+
+
+/**
+ * Compute the log-density of a sample under a multivariate
+ * normal distribution directly, by factoring S = L * L' and
+ * solving L * z = x - mu for this sample alone.
+ *
+ * @param X
+ * @param i
+ * @param mu
+ * @param S
+ */
+double ref_log_prob(const Matrix& X, int i, const Matrix& mu, const std::vector<double>& S)
+{
+	const int D = X.rows();
+	std::vector<double> L(D * D, 0.0);
+
+	// compute the Cholesky factor of S
+	for ( int j = 0; j < D; j++ ) {
+		for ( int k = 0; k <= j; k++ ) {
+			double sum = S[j * D + k];
+
+			for ( int p = 0; p < k; p++ ) {
+				sum -= L[j * D + p] * L[k * D + p];
+			}
+
+			L[j * D + k] = (j == k) ? sqrt(sum) : sum / L[k * D + k];
+		}
+	}
+
+	// solve L * z = x - mu by forward substitution
+	std::vector<double> z(D);
+	double log_det = 0;
+	double dist = 0;
+
+	for ( int j = 0; j < D; j++ ) {
+		double sum = X.elem(j, i) - mu.elem(j);
+
+		for ( int p = 0; p < j; p++ ) {
+			sum -= L[j * D + p] * z[p];
+		}
+
+		z[j] = sum / L[j * D + j];
+		log_det += 2 * log(L[j * D + j]);
+		dist += z[j] * z[j];
+	}
+
+	return -0.5 * (D * log(2 * M_PI) + log_det + dist);
+}
+
+
+
+const GMMCovariance COVARIANCE_TYPES[] = {
+	GMMCovariance::full,
+	GMMCovariance::diag,
+	GMMCovariance::spherical,
+	GMMCovariance::tied
+};
+
+const char *COVARIANCE_NAMES[] = {
+	"full",
+	"diag",
+	"spherical",
+	"tied"
+};
+
+
+
+/**
+ * Test the log-probabilities of the E step, which are
+ * computed for all samples at once with a triangular solve,
+ * against the log-density of each sample computed directly,
+ * for each covariance type.
+ */
+void test_log_prob()
+{
+	const int N = 60;
+	const int D = 4;
+	const int K = 3;
+	Matrix X = make_data(N, D);
+
+	for ( int t = 0; t < 4; t++ ) {
+		GMMCovariance type = COVARIANCE_TYPES[t];
+
+		// construct components with distinct covariances
+		std::vector<GMMLayer::Component> components(K);
+
+		for ( int k = 0; k < K; k++ ) {
+			GMMLayer::Component& c = components[k];
+
+			c.initialize(1.0f / K, X(k), type);
+
+			if ( type == GMMCovariance::full || type == GMMCovariance::tied ) {
+				// use S = A * A' + I for a fixed matrix A
+				for ( int i = 0; i < D; i++ ) {
+					for ( int j = 0; j < D; j++ ) {
+						float sum = (i == j);
+
+						for ( int p = 0; p < D; p++ ) {
+							sum += 0.1f * ((i + 2 * p + k) % 5) * 0.1f * ((j + 2 * p + k) % 5);
+						}
+
+						c.sigma.elem(i, j) = sum;
+					}
+				}
+			}
+			else if ( type == GMMCovariance::diag ) {
+				for ( int i = 0; i < D; i++ ) {
+					c.sigma.elem(i) = 0.5f + 0.3f * ((i + k) % 4);
+				}
+			}
+			else {
+				c.sigma.elem(0) = 0.5f + 0.5f * k;
+			}
+
+			c.sigma.gpu_write();
+			c.prepare(type);
+		}
+
+		// compare the log-probabilities to the reference
+		Matrix logP(K, N);
+		bool result = true;
+
+		for ( int k = 0; k < K; k++ ) {
+			components[k].compute_log_prob(X, logP, k, type);
+
+			std::vector<double> S = full_covariance(components[k].sigma, D);
+
+			for ( int i = 0; i < N; i++ ) {
+				result &= is_close(logP.elem(k, i), ref_log_prob(X, i, components[k].mu, S), 1e-4);
+			}
+		}
+
+		std::string name = std::string("log prob (") + COVARIANCE_NAMES[t] + ")";
+
+		print_result(name.c_str(), result);
+	}
+}
+
+
+
+/**
+ * Determine whether the parameters of a component are close
+ * to reference parameters.
+ *
+ * @param c
+ * @param pi
+ * @param mu
+ * @param S
+ * @param tol
+ */
+bool is_close(const GMMLayer::Component& c, double pi, const std::vector<double>& mu, const std::vector<double>& S, double tol)
+{
+	const int D = mu.size();
+	std::vector<double> sigma = full_covariance(c.sigma, D);
+	bool result = is_close(c.pi, pi, tol);
+
+	for ( int i = 0; i < D; i++ ) {
+		result &= is_close(c.mu.elem(i), mu[i], tol);
+	}
+
+	for ( int i = 0; i < D * D; i++ ) {
+		result &= is_close(sigma[i], S[i], tol);
+	}
+
+	return result;
+}
+
+
+
+/**
+ * Test one iteration of EM against a direct reference, for
+ * each covariance type: the responsibilities of each sample
+ * are computed from the initial components, and each
+ * component is updated with a sum over samples of
+ * gamma_ki * x_i and gamma_ki * d_i * d_i', where
+ * d_i = x_i - mu_k. The covariance is then reduced to its
+ * diagonal, its mean variance, or the average over
+ * components weighted by n_k / N.
+ */
+void test_m_step()
+{
+	const int N = 60;
+	const int D = 4;
+	const int K = 3;
+	const float REG_COVAR = 1e-3f;
+	Matrix X = make_data(N, D);
+
+	for ( int t = 0; t < 4; t++ ) {
+		GMMCovariance type = COVARIANCE_TYPES[t];
+		GMMLayer model(K, 1, type, REG_COVAR);
+
+		model.fit_init(X, nullptr);
+
+		std::vector<GMMLayer::Component> init = model.components();
+
+		model.fit_step(X, 1);
+
+		// compute the responsibilities from the initial components
+		std::vector<std::vector<double>> gamma(K, std::vector<double>(N));
+
+		for ( int i = 0; i < N; i++ ) {
+			std::vector<double> logp(K);
+			double max_logp = -INFINITY;
+
+			for ( int k = 0; k < K; k++ ) {
+				logp[k] = log(init[k].pi) + ref_log_prob(X, i, init[k].mu, full_covariance(init[k].sigma, D));
+				max_logp = std::max(max_logp, logp[k]);
+			}
+
+			double sum = 0;
+
+			for ( int k = 0; k < K; k++ ) {
+				sum += exp(logp[k] - max_logp);
+			}
+
+			for ( int k = 0; k < K; k++ ) {
+				gamma[k][i] = exp(logp[k] - max_logp) / sum;
+			}
+		}
+
+		// compute the reference parameters of each component
+		std::vector<double> n(K, 0.0);
+		std::vector<std::vector<double>> mu(K, std::vector<double>(D, 0.0));
+		std::vector<std::vector<double>> S(K, std::vector<double>(D * D, 0.0));
+
+		for ( int k = 0; k < K; k++ ) {
+			for ( int i = 0; i < N; i++ ) {
+				n[k] += gamma[k][i];
+
+				for ( int p = 0; p < D; p++ ) {
+					mu[k][p] += gamma[k][i] * X.elem(p, i);
+				}
+			}
+
+			for ( int p = 0; p < D; p++ ) {
+				mu[k][p] /= n[k];
+			}
+
+			for ( int i = 0; i < N; i++ ) {
+				for ( int p = 0; p < D; p++ ) {
+					for ( int q = 0; q < D; q++ ) {
+						S[k][p * D + q] += gamma[k][i] * (X.elem(p, i) - mu[k][p]) * (X.elem(q, i) - mu[k][q]) / n[k];
+					}
+				}
+			}
+
+			// reduce the covariance for diagonal and spherical covariance
+			double trace = 0;
+
+			for ( int p = 0; p < D; p++ ) {
+				trace += S[k][p * D + p];
+			}
+
+			for ( int p = 0; p < D; p++ ) {
+				for ( int q = 0; q < D; q++ ) {
+					if ( type == GMMCovariance::diag && p != q ) {
+						S[k][p * D + q] = 0;
+					}
+					else if ( type == GMMCovariance::spherical ) {
+						S[k][p * D + q] = (p == q) ? trace / D : 0;
+					}
+				}
+
+				S[k][p * D + p] += REG_COVAR;
+			}
+		}
+
+		// average the covariances for tied covariance
+		if ( type == GMMCovariance::tied ) {
+			std::vector<double> S_tied(D * D, 0.0);
+
+			for ( int k = 0; k < K; k++ ) {
+				for ( int p = 0; p < D * D; p++ ) {
+					S_tied[p] += n[k] / N * S[k][p];
+				}
+			}
+
+			S.assign(K, S_tied);
+		}
+
+		// compare the updated components to the reference
+		bool result = true;
+
+		for ( int k = 0; k < K; k++ ) {
+			result &= is_close(model.components()[k], n[k] / N, mu[k], S[k], 1e-3);
+		}
+
+		std::string name = std::string("m step (") + COVARIANCE_NAMES[t] + ")";
+
+		print_result(name.c_str(), result);
+	}
+}
+
+
+
+/**
+ * Determine whether two matrices have the same size and
+ * exactly the same elements.
+ *
+ * @param A
+ * @param B
+ */
+bool m_equal(const Matrix& A, const Matrix& B)
+{
+	if ( A.rows() != B.rows() || A.cols() != B.cols() ) {
+		return false;
+	}
+
+	for ( int i = 0; i < A.rows(); i++ ) {
+		for ( int j = 0; j < A.cols(); j++ ) {
+			if ( A.elem(i, j) != B.elem(i, j) ) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+
+
+/**
+ * Determine whether two GMMs have exactly the same
+ * components.
+ *
+ * @param model1
+ * @param model2
+ */
+bool is_equal(const GMMLayer& model1, const GMMLayer& model2)
+{
+	const std::vector<GMMLayer::Component>& c1 = model1.components();
+	const std::vector<GMMLayer::Component>& c2 = model2.components();
+
+	if ( c1.size() != c2.size() ) {
+		return false;
+	}
+
+	for ( size_t k = 0; k < c1.size(); k++ ) {
+		if ( c1[k].pi != c2[k].pi || !m_equal(c1[k].mu, c2[k].mu) || !m_equal(c1[k].sigma, c2[k].sigma) ) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+
+/**
+ * Test that online EM can be checkpointed mid-stream: a
+ * model which is saved after some mini-batches and loaded
+ * into a new layer must continue exactly like the original
+ * model. The prepare interval is chosen so that the model is
+ * saved between parameter updates, when the sufficient
+ * statistics are ahead of the parameters.
+ */
+void test_partial_fit()
+{
+	const int N = 120;
+	const int D = 4;
+	const int K = 3;
+	const int BATCH_SIZE = 20;
+	Matrix X = make_data(N, D);
+
+	for ( int t = 0; t < 4; t++ ) {
+		GMMCovariance type = COVARIANCE_TYPES[t];
+		GMMLayer model(K, 1, type, 1e-3f, 0.6f, 2);
+
+		// fit the first half of the stream
+		for ( int i = 0; i < N / 2; i += BATCH_SIZE ) {
+			model.partial_fit(X(i, i + BATCH_SIZE));
+		}
+
+		// save the model and load it into a new layer
+		std::stringbuf buffer;
+		IODevice memory(&buffer);
+
+		model.save(memory);
+
+		GMMLayer resumed(1);
+
+		resumed.load(memory);
+
+		bool result = !memory.fail() && is_equal(resumed, model);
+
+		// fit the second half of the stream with both models
+		for ( int i = N / 2; i < N; i += BATCH_SIZE ) {
+			model.partial_fit(X(i, i + BATCH_SIZE));
+			resumed.partial_fit(X(i, i + BATCH_SIZE));
+		}
+
+		result &= is_equal(resumed, model);
+		result &= (resumed.bic() == model.bic());
+		result &= (resumed.predict(X) == model.predict(X));
+
+		std::string name = std::string("partial fit (") + COVARIANCE_NAMES[t] + ")";
+
+		print_result(name.c_str(), result);
+	}
+}
+
+
+
+void print_usage()
+{
+	std::cerr <<
+		"Usage: ./test-gmm [options]\n"
+		"\n"
+		"Options:\n"
+		"  --loglevel LEVEL  log level (0=error, 1=warn, [2]=info, 3=verbose, 4=debug)\n";
+}
+
+
+
+int main(int argc, char **argv)
+{
+	// parse command-line arguments
+	struct option long_options[] = {
+		{ "loglevel", required_argument, 0, 'e' },
+		{ 0, 0, 0, 0 }
+	};
+
+	int opt;
+	while ( (opt = getopt_long_only(argc, argv, "", long_options, nullptr)) != -1 ) {
+		switch ( opt ) {
+		case 'e':
+			Logger::LEVEL = (LogLevel) atoi(optarg);
+			break;
+		case '?':
+			print_usage();
+			exit(1);
+		}
+	}
+
+	if ( optind != argc ) {
+		print_usage();
+		exit(1);
+	}
+
+	// run tests
+	test_func_t tests[] = {
+		test_log_prob,
+		test_m_step,
+		test_partial_fit
+	};
+	int num_tests = sizeof(tests) / sizeof(test_func_t);
+
+	for ( int i = 0; i < num_tests; i++ ) {
+		test_func_t test = tests[i];
+
+		std::cout << "TEST " << i + 1 << "\n";
+		test();
+		std::cout << "\n";
+	}
+
+	return 0;
+}
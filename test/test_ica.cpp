@@ -0,0 +1,225 @@
+/**
+ * @file test_ica.cpp
+ *
+ * Test suite for independent component analysis.
+ *
+ * Each test mixes a few known, non-Gaussian sources and
+ * checks that the ICA layer recovers them.
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <mlearn.h>
+
+
+
+using namespace mlearn;
+
+
+
+#define ANSI_RED    "\x1b[31m"
+#define ANSI_BOLD   "\x1b[1m"
+#define ANSI_GREEN  "\x1b[32m"
+#define ANSI_RESET  "\x1b[0m"
+
+
+
+typedef void (*test_func_t)(void);
+
+
+
+/**
+ * Print a test result.
+ *
+ * @param name
+ * @param result
+ */
+void print_result(const char *name, bool result)
+{
+	std::string color = result ? ANSI_GREEN : ANSI_RED;
+	std::string message = result ? "PASSED" : "FAILED";
+
+	std::cout << color << std::left << std::setw(25) << name << "  " << message << ANSI_RESET << "\n";
+}
+
+
+
+/**
+ * Compute the correlation coefficient of row i of A and
+ * row j of B.
+ *
+ * @param A
+ * @param i
+ * @param B
+ * @param j
+ */
+double corr(const Matrix& A, int i, const Matrix& B, int j)
+{
+	const int N = A.cols();
+	double mean_a = 0;
+	double mean_b = 0;
+
+	for ( int t = 0; t < N; t++ ) {
+		mean_a += A.elem(i, t);
+		mean_b += B.elem(j, t);
+	}
+
+	mean_a /= N;
+	mean_b /= N;
+
+	double s_ab = 0;
+	double s_aa = 0;
+	double s_bb = 0;
+
+	for ( int t = 0; t < N; t++ ) {
+		double a = A.elem(i, t) - mean_a;
+		double b = B.elem(j, t) - mean_b;
+
+		s_ab += a * b;
+		s_aa += a * a;
+		s_bb += b * b;
+	}
+
+	return s_ab / sqrt(s_aa * s_bb);
+}
+
+
+
+/**
+ * Test that ICA separates three linear mixtures of a sine
+ * wave, a square wave and a sawtooth wave, with the
+ * deflation and the symmetric approach.
+ *
+ * Each signal is a sample of the data matrix, so the mixed
+ * signals are the columns of X and the recovered sources are
+ * the rows of the ICA projection. Every source must have a
+ * recovered component with |corr| > 0.998, up to sign and
+ * order. A whitened input which does not have unit variance
+ * fails this test.
+ */
+void test_ica_sources()
+{
+	const int T = 5000;
+	const int M = 3;
+
+	// generate the sources
+	Matrix S(M, T);
+
+	for ( int t = 0; t < T; t++ ) {
+		float x = t * 0.01f;
+
+		S.elem(0, t) = sinf(2 * x);
+		S.elem(1, t) = (fmodf(x, 2.0f) < 1) ? 1 : -1;
+		S.elem(2, t) = fmodf(1.3f * x, 2.0f) - 1;
+	}
+
+	// mix the sources, X = (A * S)'
+	const float A[M][M] = {
+		{ 1.0f, 0.5f, 0.3f },
+		{ 0.4f, 1.0f, 0.6f },
+		{ 0.2f, 0.7f, 1.0f }
+	};
+	Matrix X(T, M);
+
+	for ( int t = 0; t < T; t++ ) {
+		for ( int i = 0; i < M; i++ ) {
+			float sum = 0;
+
+			for ( int p = 0; p < M; p++ ) {
+				sum += A[i][p] * S.elem(p, t);
+			}
+
+			X.elem(t, i) = sum;
+		}
+	}
+
+	X.gpu_write();
+
+	for ( ICAApproach approach : { ICAApproach::deflation, ICAApproach::symmetric } ) {
+		ICALayer ica(-1, -1, ICANonl::pow3, 1000, 0.0001f, approach);
+
+		ica.fit(X);
+
+		// get the recovered sources from the projection
+		Matrix W;
+		Matrix b;
+
+		ica.affine(W, b);
+		W.gpu_read();
+
+		bool result = (W.rows() == M && W.cols() == T);
+
+		for ( int p = 0; p < M && result; p++ ) {
+			double max_corr = 0;
+
+			for ( int i = 0; i < W.rows(); i++ ) {
+				max_corr = std::max(max_corr, fabs(corr(S, p, W, i)));
+			}
+
+			result &= (max_corr > 0.998);
+		}
+
+		print_result((approach == ICAApproach::symmetric) ? "sources (symmetric)" : "sources (deflation)", result);
+	}
+}
+
+
+
+void print_usage()
+{
+	std::cerr <<
+		"Usage: ./test-ica [options]\n"
+		"\n"
+		"Options:\n"
+		"  --loglevel LEVEL  log level (0=error, 1=warn, [2]=info, 3=verbose, 4=debug)\n";
+}
+
+
+
+int main(int argc, char **argv)
+{
+	// parse command-line arguments
+	struct option long_options[] = {
+		{ "loglevel", required_argument, 0, 'e' },
+		{ 0, 0, 0, 0 }
+	};
+
+	int opt;
+	while ( (opt = getopt_long_only(argc, argv, "", long_options, nullptr)) != -1 ) {
+		switch ( opt ) {
+		case 'e':
+			Logger::LEVEL = (LogLevel) atoi(optarg);
+			break;
+		case '?':
+			print_usage();
+			exit(1);
+		}
+	}
+
+	if ( optind != argc ) {
+		print_usage();
+		exit(1);
+	}
+
+	// initialize random number engine
+	Random::seed(1);
+
+	// run tests
+	test_func_t tests[] = {
+		test_ica_sources
+	};
+	int num_tests = sizeof(tests) / sizeof(test_func_t);
+
+	for ( int i = 0; i < num_tests; i++ ) {
+		test_func_t test = tests[i];
+
+		std::cout << "TEST " << i + 1 << "\n";
+		test();
+		std::cout << "\n";
+	}
+
+	return 0;
+}
@@ -12,6 +12,7 @@
 #include <iomanip>
 #include <iostream>
 #include <mlearn.h>
+#include <sstream>
 
 
 
@@ -253,6 +254,34 @@ void test_copy_columns()
 
 
 
+/**
+ * Test the Cholesky decomposition.
+ */
+void test_cholesky()
+{
+	float A_data[] = {
+		  4,  12, -16,
+		 12,  37, -43,
+		-16, -43,  98
+	};
+	float L_data[] = {
+		 2,  0,  0,
+		 6,  1,  0,
+		-8,  5,  3
+	};
+	Matrix A(3, 3, A_data);
+	Matrix L = A.cholesky();
+
+	if ( Logger::test(LogLevel::Verbose) ) {
+		A.print();
+		L.print();
+	}
+
+	assert_matrix_value(L, L_data, "chol(A)");
+}
+
+
+
 /**
  * The the matrix determinant.
  */
@@ -372,6 +401,57 @@ void test_eigen()
 
 
 
+/**
+ * Test the generalized eigenvalues and eigenvectors of a
+ * symmetric-definite matrix pair. The eigenvectors are
+ * checked through the residual A * V - B * V * D, since
+ * their signs are arbitrary.
+ */
+void test_eigen_generalized()
+{
+	float A_data[] = {
+		4, 1, 0,
+		1, 3, 1,
+		0, 1, 2
+	};
+	float B_data[] = {
+		2, 1, 0,
+		1, 2, 1,
+		0, 1, 2
+	};
+	float D_data[] = {
+		1.0000, 0.0000, 0.0000,
+		0.0000, 1.5000, 0.0000,
+		0.0000, 0.0000, 3.0000
+	};
+	float R_data[] = {
+		0, 0, 0,
+		0, 0, 0,
+		0, 0, 0
+	};
+	Matrix A(3, 3, A_data);
+	Matrix B(3, 3, B_data);
+	Matrix V;
+	Matrix D;
+
+	A.eigen(B, A.rows(), V, D);
+
+	Matrix R = A * V;
+	R -= B * V * D;
+
+	if ( Logger::test(LogLevel::Verbose) ) {
+		A.print();
+		B.print();
+		V.print();
+		D.print();
+	}
+
+	assert_matrix_value(D, D_data, "generalized eigenvalues of (A, B)");
+	assert_matrix_value(R, R_data, "A * V - B * V * D");
+}
+
+
+
 /**
  * Test matrix inverse.
  */
@@ -933,6 +1013,135 @@ void test_subtract_rows()
 
 
 
+/**
+ * Test triangular solve.
+ */
+void test_trsm()
+{
+	float L_data[] = {
+		 2,  0,  0,
+		 6,  1,  0,
+		-8,  5,  3
+	};
+	float B_data1[] = {
+		 2,  4,
+		 9, 16,
+		22, 22
+	};
+	float B_data2[] = {
+		1, 2,
+		3, 4,
+		5, 6
+	};
+	Matrix L(3, 3, L_data);
+	Matrix B(3, 2, B_data1);
+
+	if ( Logger::test(LogLevel::Verbose) ) {
+		L.print();
+		B.print();
+	}
+
+	B.trsm(1.0f, L);
+
+	if ( Logger::test(LogLevel::Verbose) ) {
+		B.print();
+	}
+
+	assert_matrix_value(B, B_data2, "L \\ B");
+}
+
+
+
+/**
+ * Test loading matrices and vectors from a file, from a
+ * mapped file and from memory. Sizes which exceed the
+ * remaining length of the file must fail the read without
+ * allocating memory for them.
+ */
+void test_load()
+{
+	std::string path = "test-load.bin";
+
+	// save a matrix larger than the file buffer, and a matrix,
+	// a vector and a string with corrupt sizes
+	Matrix A = Matrix::random(512, 1024);
+	Matrix B = Matrix::random(3, 4);
+	int huge = 1 << 30;
+
+	{
+		IODevice file(path, std::ios_base::out | std::ios_base::binary);
+
+		file << A;
+		file << B;
+		file << huge;
+		file << huge;
+		file << B;
+	}
+
+	// load the file, mapped and not mapped
+	for ( bool mapped : { false, true } ) {
+		IODevice file(path, std::ios_base::in | std::ios_base::binary, mapped);
+		Matrix A_in;
+		Matrix B_in;
+
+		file >> A_in;
+		file >> B_in;
+
+		bool result = !file.fail() && m_equal(A_in, A) && m_equal(B_in, B);
+		std::streampos pos = file.tellg();
+
+		// read a corrupt matrix
+		Matrix C_in;
+		file >> C_in;
+		result &= file.fail() && C_in.rows() == 0;
+
+		// read a corrupt vector of floats
+		std::vector<float> v;
+		file.clear();
+		file.seekg(pos);
+		file.seekg(sizeof(int), std::ios_base::cur);
+		file >> v;
+		result &= file.fail() && v.empty();
+
+		// read a corrupt vector of strings
+		std::vector<std::string> s;
+		file.clear();
+		file.seekg(pos);
+		file.seekg(sizeof(int), std::ios_base::cur);
+		file >> s;
+		result &= file.fail() && s.empty();
+
+		// read a corrupt string
+		std::string str;
+		file.clear();
+		file.seekg(pos);
+		file.seekg(sizeof(int), std::ios_base::cur);
+		file >> str;
+		result &= file.fail() && str.empty();
+
+		print_result(mapped ? "load (mapped)" : "load", result);
+	}
+
+	// load from memory
+	std::stringbuf buffer;
+	IODevice memory(&buffer);
+	Matrix B_in;
+	Matrix C_in;
+
+	memory << B;
+	memory << huge;
+	memory << huge;
+
+	memory >> B_in;
+	memory >> C_in;
+
+	print_result("load (memory)", m_equal(B_in, B) && memory.fail() && C_in.rows() == 0);
+
+	remove(path.c_str());
+}
+
+
+
 void print_usage()
 {
 	std::cerr <<
@@ -976,10 +1185,12 @@ int main(int argc, char **argv)
 		test_zeros,
 		test_copy,
 		test_copy_columns,
+		test_cholesky,
 		test_determinant,
 		test_diagonalize,
 		test_dot,
 		test_eigen,
+		test_eigen_generalized,
 		test_inverse,
 		test_mean_column,
 		test_mean_row,
@@ -995,7 +1206,9 @@ int main(int argc, char **argv)
 		test_elem_apply,
 		test_scal,
 		test_subtract_columns,
-		test_subtract_rows
+		test_subtract_rows,
+		test_trsm,
+		test_load
 	};
 	int num_tests = sizeof(tests) / sizeof(test_func_t);
 